@@ -36,6 +36,8 @@
 #include <string>
 #include <stdio.h>
 #include <ctype.h>
+#include <sys/uio.h>
+#include "MD5Stats.h"
 
 using namespace std;
 
@@ -84,6 +86,55 @@ public:
   static void make_hash(const string &data, unsigned char *hash);
   static void make_hash(FILE *f, unsigned char *hash);
 
+  /* Scatter-gather sources. Segments are streamed into one context in order,
+   * blocks that straddle segments are assembled in the working buffer.
+   * make_hash_segments() takes any range of spans providing data() and size(),
+   * for example vector<string>. make_hash_range() takes a pair of iterators
+   * over chars that need not be contiguous, for example a deque<char>. */
+  static void make_hash(const struct iovec *iov, int iovcnt, unsigned char *hash);
+
+  /* Hashes of several prefixes of one source in a single pass, e.g. every
+   * 1 GiB boundary of an upload. offsets are ascending byte counts, with
+   * PREFIX_END standing for the whole source. hashes receives n consecutive
+   * 17 element arrays, the i-th covering the first offsets[i] bytes; each is
+   * finalized on a copy of the running context (see checkpoint()). Prefixes
+   * past the end of the source, or out of order, are left null and the FILE
+   * version returns false. */
+  static const size_t PREFIX_END = (size_t) -1;
+  static void make_prefix_hashes(const char *data, size_t len, const size_t *offsets, size_t n,
+                                 unsigned char *hashes);
+  static bool make_prefix_hashes(FILE *f, const size_t *offsets, size_t n, unsigned char *hashes);
+
+  template <class Range>
+  static void make_hash_segments(const Range &segments, unsigned char *hash)
+  {
+    MD5 context;
+    for (typename Range::const_iterator it = segments.begin(); it != segments.end(); ++it)
+    {
+      context.update((const char *) it->data(), it->size() * sizeof(*it->data()));
+    }
+    context.finish(hash);
+  }
+
+  template <class InputIt>
+  static void make_hash_range(InputIt first, InputIt last, unsigned char *hash)
+  {
+    MD5 context;
+    char staging[BUFFER_LEN << 6];
+    size_t n = 0;
+    for (; first != last; ++first)
+    {
+      staging[n++] = *first;
+      if (n == sizeof(staging))
+      {
+        context.update(staging, n);
+        n = 0;
+      }
+    }
+    context.update(staging, n);
+    context.finish(hash);
+  }
+
   /* Utility function to generate a human readable c_string from MD5 hash.
    * hash   - pointer to null terminated char array holding MD5 hash.
    *          Should be a 17 element array.
@@ -96,6 +147,10 @@ public:
    * to a 17 element unsigned char array. */
   static bool comp_hash(const unsigned char *hash_1, const unsigned char *hash_2);
 
+  /* Counters summed over all threads. All zero unless built with -DMD5_STATS,
+   * see MD5Stats.h. */
+  static MD5Counters stats(void);
+
   /* Initializes MD5 context variables and buffer. */
   void init(void);
 
@@ -110,6 +165,20 @@ public:
    * hash - unsigned char pointer to a 17 element array */
   void encode(unsigned char *hash);
 
+  /* Same as encode() without the terminating null, for packed 16 byte storage */
+  void store(unsigned char *hash);
+
+  /* Streaming interface for sources that arrive in pieces. Use with a context
+   * created by MD5(void). update() transforms full blocks in place from data and
+   * holds any remainder in the working buffer until the next update() or finish().
+   * finish() pads the pending bytes and encodes the hash (17 element array). */
+  void update(const char *data, size_t len);
+  void finish(unsigned char *hash);
+
+  /* Hash of the bytes streamed so far without ending the stream. Copies the
+   * registers and the pending tail and finishes the copy. */
+  void checkpoint(unsigned char *hash) const;
+
 private:
 
   /* The basic MD5 functions.
@@ -140,11 +209,41 @@ private:
     cx1 += cx2;
   }
 
-  /* Convert four char elements to a 32 bit int. */
-  MD5_u32 decode(const char *data, int index)
-  {
-    return ( *(MD5_u32*) (data + (index << 2)));
-  }
+  /* Block loaders for transform_blocks(). Each converts the four chars of
+   * word index of a block, stored low order byte first, to a 32 bit int.
+   *   AlignedLoad   - little endian host, data on a 4 byte boundary.
+   *   UnalignedLoad - little endian host, any alignment.
+   *   ByteLoad      - any host byte order, assembles the word from bytes.
+   * All use memcpy or char access, so none violate strict aliasing. */
+  struct AlignedLoad {
+    static MD5_u32 load(const char *data, int index)
+    {
+      MD5_u32 x;
+      memcpy(&x, (const char *) __builtin_assume_aligned(data, 4) + (index << 2), sizeof(x));
+      return x;
+    }
+  };
+
+  struct UnalignedLoad {
+    static MD5_u32 load(const char *data, int index)
+    {
+      MD5_u32 x;
+      memcpy(&x, data + (index << 2), sizeof(x));
+      return x;
+    }
+  };
+
+  struct ByteLoad {
+    static MD5_u32 load(const char *data, int index)
+    {
+      const unsigned char *p = (const unsigned char *) data + (index << 2);
+      return (MD5_u32) p[0] | ((MD5_u32) p[1] << 8) | ((MD5_u32) p[2] << 16) | ((MD5_u32) p[3] << 24);
+    }
+  };
+
+  /* transform() specialized on a block loader */
+  template <class Loader>
+  const char *transform_blocks(const char *data);
 
 };
 #endif
@@ -0,0 +1,242 @@
+/*
+ * MD5Async.cpp
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "MD5Async.h"
+
+MD5Executor::MD5Executor(void)
+{
+  parked = 0;
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd < 0)
+  {
+    perror("Failed to create epoll instance.\n");
+  }
+}
+
+MD5Executor::~MD5Executor(void)
+{
+  if (epoll_fd >= 0)
+  {
+    close(epoll_fd);
+  }
+}
+
+void MD5Executor::post(coroutine_handle<> h)
+{
+  ready.push_back(h);
+}
+
+/* Parks h until fd is readable. A descriptor is registered once, however
+ * many coroutines wait on it, and all of them are resumed when it becomes
+ * readable. Descriptors epoll can not watch (regular files) are always
+ * readable, so h is posted straight back to the ready queue. */
+void MD5Executor::watch(int fd, coroutine_handle<> h)
+{
+  deque<coroutine_handle<> > &queue = waiters[fd];
+  if (queue.empty())
+  {
+    struct epoll_event ev;
+    memset(&ev, '\0', sizeof(ev));
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+    {
+      waiters.erase(fd);
+      post(h);
+      return;
+    }
+  }
+  queue.push_back(h);
+  parked++;
+}
+
+void MD5Executor::run(void)
+{
+  static const int MAX_EVENTS = 64;
+  struct epoll_event events[MAX_EVENTS];
+
+  while (!ready.empty() || (parked > 0))
+  {
+    while (!ready.empty())
+    {
+      coroutine_handle<> h = ready.front();
+      ready.pop_front();
+      h.resume();
+    }
+
+    if (parked > 0)
+    {
+      int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+      if ((n < 0) && (errno != EINTR))
+      {
+        perror("Failed waiting on epoll.\n");
+        return;
+      }
+      for (int i = 0; i < n; i++)
+      {
+        // deregister before resuming, the waiters may close the descriptor
+        int fd = events[i].data.fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+        map<int, deque<coroutine_handle<> > >::iterator it = waiters.find(fd);
+        if (it == waiters.end())
+        {
+          continue;
+        }
+        parked -= it->second.size();
+        while (!it->second.empty())
+        {
+          post(it->second.front());
+          it->second.pop_front();
+        }
+        waiters.erase(it);
+      }
+    }
+  }
+}
+
+MD5Task::MD5Task(MD5Task &&task)
+{
+  handle = task.handle;
+  task.handle = nullptr;
+}
+
+MD5Task::~MD5Task(void)
+{
+  if (handle)
+  {
+    handle.destroy();
+  }
+}
+
+coroutine_handle<> MD5Task::await_suspend(coroutine_handle<> caller)
+{
+  handle.promise().continuation = caller;
+  return handle;
+}
+
+void MD5Task::start(MD5Executor &ex)
+{
+  ex.post(handle);
+}
+
+bool MD5Task::done(void)
+{
+  return handle.done();
+}
+
+MD5Hash MD5Task::result(void)
+{
+  return handle.promise().value;
+}
+
+MD5Task MD5Async::hash_file_async(MD5Executor &ex, const char *path)
+{
+  MD5 context;
+  unsigned char hash[MD5::HASH_LEN + 1];
+  memset(hash, '\0', sizeof(hash));
+  char buffer[READ_LEN];
+  ssize_t bytes_read = 0;
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    perror("Failed to open file.\n");
+    co_return MD5Hash(hash);
+  }
+
+  while ((bytes_read = read(fd, buffer, READ_LEN)) != 0)
+  {
+    if (bytes_read < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      perror("Failed to read from file.\n");
+      close(fd);
+      co_return MD5Hash(hash);
+    }
+    context.update(buffer, bytes_read);
+    co_await ex.yield();
+  }
+  close(fd);
+  context.finish(hash);
+  co_return MD5Hash(hash);
+}
+
+/* Puts back the file status flags of a descriptor when the coroutine frame
+ * holding it is destroyed, however the coroutine ends */
+struct MDRestoreFlags {
+  int fd;
+  int flags;
+
+  ~MDRestoreFlags(void)
+  {
+    if (this->flags >= 0)
+    {
+      fcntl(this->fd, F_SETFL, this->flags);
+    }
+  }
+};
+
+MD5Task MD5Async::hash_stream_async(MD5Executor &ex, int fd)
+{
+  MD5 context;
+  unsigned char hash[MD5::HASH_LEN + 1];
+  memset(hash, '\0', sizeof(hash));
+  char buffer[READ_LEN];
+  ssize_t bytes_read = 0;
+
+  // the descriptor belongs to the caller, its blocking mode is restored
+  MDRestoreFlags restore = { fd, fcntl(fd, F_GETFL) };
+  if (restore.flags >= 0)
+  {
+    fcntl(fd, F_SETFL, restore.flags | O_NONBLOCK);
+  }
+
+  while ((bytes_read = read(fd, buffer, READ_LEN)) != 0)
+  {
+    if (bytes_read < 0)
+    {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+      {
+        co_await ex.readable(fd);
+        continue;
+      }
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      perror("Failed to read from stream.\n");
+      co_return MD5Hash(hash);
+    }
+    context.update(buffer, bytes_read);
+    co_await ex.yield();
+  }
+  context.finish(hash);
+  co_return MD5Hash(hash);
+}
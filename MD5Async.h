@@ -0,0 +1,151 @@
+/*
+ * MD5Async.h
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+/* C++20 coroutine interface for hashing files and streams without blocking
+ * an event loop. Requires -std=c++20. */
+
+#ifndef MD5ASYNC_H
+#define MD5ASYNC_H
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <map>
+#include "MD5Hash.h"
+
+/* Single threaded scheduler. Coroutines are resumed in the order they are
+ * posted; coroutines waiting for a readable descriptor are parked in epoll
+ * until data arrives. run() returns when nothing is ready or parked. */
+class MD5Executor {
+
+  int epoll_fd;
+  size_t parked;                     // coroutines waiting in epoll
+  deque<coroutine_handle<> > ready;  // coroutines ready to resume
+  map<int, deque<coroutine_handle<> > > waiters;  // parked coroutines by descriptor
+
+public:
+
+  MD5Executor(void);
+  ~MD5Executor(void);
+
+  /* Queue a coroutine to be resumed by run() */
+  void post(coroutine_handle<> h);
+
+  /* Resume coroutines until all have completed */
+  void run(void);
+
+  /* Awaitable returned by yield(), reposts the caller behind other ready coroutines */
+  struct Yield {
+    MD5Executor *ex;
+    bool await_ready(void) { return false; }
+    void await_suspend(coroutine_handle<> h) { ex->post(h); }
+    void await_resume(void) {}
+  };
+
+  /* Awaitable returned by readable(), parks the caller until fd has data */
+  struct Readable {
+    MD5Executor *ex;
+    int fd;
+    bool await_ready(void) { return false; }
+    void await_suspend(coroutine_handle<> h) { ex->watch(fd, h); }
+    void await_resume(void) {}
+  };
+
+  Yield yield(void) { return Yield{this}; }
+  Readable readable(int fd) { return Readable{this, fd}; }
+
+private:
+
+  void watch(int fd, coroutine_handle<> h);
+
+};
+
+/* Coroutine returning a MD5Hash. Tasks are lazy: they run when awaited from
+ * another coroutine or when start() posts them to an executor. */
+class MD5Task {
+
+public:
+
+  struct promise_type {
+    MD5Hash value;
+    coroutine_handle<> continuation;
+
+    /* Resumes the awaiting coroutine, if any, when the task completes */
+    struct FinalAwaiter {
+      bool await_ready(void) noexcept { return false; }
+      coroutine_handle<> await_suspend(coroutine_handle<promise_type> h) noexcept
+      {
+        coroutine_handle<> next = h.promise().continuation;
+        return next ? next : noop_coroutine();
+      }
+      void await_resume(void) noexcept {}
+    };
+
+    MD5Task get_return_object(void) { return MD5Task(coroutine_handle<promise_type>::from_promise(*this)); }
+    suspend_always initial_suspend(void) noexcept { return suspend_always(); }
+    FinalAwaiter final_suspend(void) noexcept { return FinalAwaiter(); }
+    void return_value(const MD5Hash &hash) { value = hash; }
+    void unhandled_exception(void) { terminate(); }
+  };
+
+  MD5Task(MD5Task &&task);
+  ~MD5Task(void);
+
+  MD5Task(const MD5Task &) = delete;
+  MD5Task& operator=(const MD5Task &) = delete;
+
+  // awaitable interface
+  bool await_ready(void) { return handle.done(); }
+  coroutine_handle<> await_suspend(coroutine_handle<> caller);
+  MD5Hash await_resume(void) { return handle.promise().value; }
+
+  /* Posts the task to ex, result() is valid once done() */
+  void start(MD5Executor &ex);
+  bool done(void);
+  MD5Hash result(void);
+
+private:
+
+  coroutine_handle<promise_type> handle;
+  explicit MD5Task(coroutine_handle<promise_type> h) : handle(h) {}
+
+};
+
+class MD5Async {
+
+public:
+
+  /* Size of the read buffer held in each coroutine frame */
+  static const int READ_LEN = 16384;
+
+  /* Hashes a file, yielding to other coroutines on ex after every read.
+   * Regular files can not be polled, so reads are sized to keep each slice short. */
+  static MD5Task hash_file_async(MD5Executor &ex, const char *path);
+
+  /* Hashes a pipe or socket until end of stream. fd is switched to non-blocking
+   * while the coroutine runs, and restored when it ends, and the coroutine
+   * parks in ex while no data is available. */
+  static MD5Task hash_stream_async(MD5Executor &ex, int fd);
+
+};
+#endif
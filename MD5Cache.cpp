@@ -0,0 +1,272 @@
+/*
+ * MD5Cache.cpp
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include "MD5Cache.h"
+
+const char MD5Cache::MAGIC[8] = {'M', 'D', '5', 'C', 'A', 'C', 'H', 'E'};
+
+static int64_t MDTimeNs(const struct timespec &ts)
+{
+  return (int64_t) ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+MD5Cache::MD5Cache(void)
+{
+  fd = -1;
+  header = NULL;
+  entries = NULL;
+  map_len = 0;
+  mask = 0;
+  hits = 0;
+  misses = 0;
+}
+
+MD5Cache::~MD5Cache(void)
+{
+  close();
+}
+
+/* Builds an empty table next to path and renames it into place. Processes
+ * still mapping the old file keep their inode, so they never see it shrink. */
+bool MD5Cache::create(const char *path, size_t slots)
+{
+  char tmp_path[4096];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%ld", path, (long) getpid());
+
+  int tmp_fd = ::open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (tmp_fd < 0)
+  {
+    perror("Failed to create hash cache.\n");
+    return false;
+  }
+
+  Header h;
+  memset(&h, '\0', sizeof(h));
+  memcpy(h.magic, MAGIC, sizeof(h.magic));
+  h.version = VERSION;
+  h.entry_len = sizeof(Entry);
+  h.slots = slots;
+
+  bool result = (ftruncate(tmp_fd, sizeof(Header) + slots * sizeof(Entry)) == 0) &&
+                (pwrite(tmp_fd, &h, sizeof(h), 0) == (ssize_t) sizeof(h)) &&
+                (rename(tmp_path, path) == 0);
+  if (!result)
+  {
+    perror("Failed to initialize hash cache.\n");
+    unlink(tmp_path);
+  }
+  ::close(tmp_fd);
+  return result;
+}
+
+bool MD5Cache::open(const char *path, size_t slots)
+{
+  size_t n = 1;
+  while (n < slots)
+  {
+    n <<= 1;
+  }
+  slots = n;
+
+  close();
+
+  for (int attempt = 0; attempt < 2; attempt++)
+  {
+    this->fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (this->fd < 0)
+    {
+      perror("Failed to open hash cache.\n");
+      return false;
+    }
+
+    struct stat st;
+    Header h;
+    memset(&h, '\0', sizeof(h));
+    if ((fstat(this->fd, &st) == 0) &&
+        (pread(this->fd, &h, sizeof(h), 0) == (ssize_t) sizeof(h)) &&
+        (memcmp(h.magic, MAGIC, sizeof(h.magic)) == 0) &&
+        (h.version == VERSION) &&
+        (h.entry_len == sizeof(Entry)) &&
+        (h.slots > 0) && ((h.slots & (h.slots - 1)) == 0) &&
+        ((size_t) st.st_size == sizeof(Header) + h.slots * sizeof(Entry)))
+    {
+      this->map_len = st.st_size;
+      void *map = mmap(NULL, this->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+      if (map == MAP_FAILED)
+      {
+        perror("Failed to map hash cache.\n");
+        close();
+        return false;
+      }
+      this->header = (Header *) map;
+      this->entries = (Entry *) ((char *) map + sizeof(Header));
+      this->mask = h.slots - 1;
+      return true;
+    }
+
+    // stale layout or new file
+    ::close(this->fd);
+    this->fd = -1;
+    if (!create(path, slots))
+    {
+      return false;
+    }
+  }
+  return false;
+}
+
+void MD5Cache::close(void)
+{
+  if (this->header != NULL)
+  {
+    munmap(this->header, this->map_len);
+  }
+  if (this->fd >= 0)
+  {
+    ::close(this->fd);
+  }
+  this->fd = -1;
+  this->header = NULL;
+  this->entries = NULL;
+  this->map_len = 0;
+  this->mask = 0;
+}
+
+size_t MD5Cache::home(const struct stat &st)
+{
+  uint64_t key = ((uint64_t) st.st_dev * 0x9e3779b97f4a7c15ULL) ^ (uint64_t) st.st_ino;
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  return key & this->mask;
+}
+
+bool MD5Cache::matches(const Entry &entry, const struct stat &st)
+{
+  return (entry.ino == (uint64_t) st.st_ino) &&
+         (entry.dev == (uint64_t) st.st_dev) &&
+         (entry.size == (uint64_t) st.st_size) &&
+         (entry.mtime_ns == MDTimeNs(st.st_mtim)) &&
+         (entry.ctime_ns == MDTimeNs(st.st_ctim));
+}
+
+bool MD5Cache::lookup(const struct stat &st, unsigned char *hash)
+{
+  if (this->entries == NULL)
+  {
+    return false;
+  }
+
+  size_t slot = home(st);
+  for (int i = 0; i < MAX_PROBE; i++, slot = (slot + 1) & this->mask)
+  {
+    Entry *e = &this->entries[slot];
+    uint64_t seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+    if (seq == 0)
+    {
+      break;
+    }
+    Entry copy;
+    memcpy(&copy, e, sizeof(Entry));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (((seq & 1) == 0) && (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) == seq) && matches(copy, st))
+    {
+      memcpy(hash, copy.hash, MD5::HASH_LEN);
+      hash[MD5::HASH_LEN] = '\0';
+      this->hits++;
+      return true;
+    }
+  }
+  this->misses++;
+  return false;
+}
+
+void MD5Cache::store(const struct stat &st, const unsigned char *hash)
+{
+  if ((this->entries == NULL) || (flock(this->fd, LOCK_EX) != 0))
+  {
+    return;
+  }
+
+  // reuse the slot holding this inode, else the first empty one, else evict home
+  size_t first = home(st);
+  size_t target = first;
+  size_t slot = first;
+  for (int i = 0; i < MAX_PROBE; i++, slot = (slot + 1) & this->mask)
+  {
+    Entry *e = &this->entries[slot];
+    if ((e->seq == 0) || ((e->ino == (uint64_t) st.st_ino) && (e->dev == (uint64_t) st.st_dev)))
+    {
+      target = slot;
+      break;
+    }
+  }
+
+  Entry *e = &this->entries[target];
+  uint64_t seq = __atomic_load_n(&e->seq, __ATOMIC_RELAXED);
+  __atomic_store_n(&e->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  e->dev = st.st_dev;
+  e->ino = st.st_ino;
+  e->size = st.st_size;
+  e->mtime_ns = MDTimeNs(st.st_mtim);
+  e->ctime_ns = MDTimeNs(st.st_ctim);
+  memcpy(e->hash, hash, MD5::HASH_LEN);
+  __atomic_store_n(&e->seq, seq + 2, __ATOMIC_RELEASE);
+
+  flock(this->fd, LOCK_UN);
+}
+
+void MD5Cache::make_hash(FILE *f, unsigned char *hash)
+{
+  struct stat before;
+  struct stat after;
+
+  if ((f == NULL) || (fstat(fileno(f), &before) != 0) || !S_ISREG(before.st_mode))
+  {
+    MD5::make_hash(f, hash);
+    return;
+  }
+  if (lookup(before, hash))
+  {
+    return;
+  }
+
+  MD5::make_hash(f, hash);
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  if (!ferror(f) && (fstat(fileno(f), &after) == 0) &&
+      (MDTimeNs(after.st_mtim) == MDTimeNs(before.st_mtim)) &&
+      (MDTimeNs(after.st_ctim) == MDTimeNs(before.st_ctim)) &&
+      (after.st_size == before.st_size) &&
+      (after.st_mtim.tv_sec < now.tv_sec - 1))
+  {
+    store(before, hash);
+  }
+}
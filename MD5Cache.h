@@ -0,0 +1,102 @@
+/*
+ * MD5Cache.h
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#ifndef MD5CACHE_H
+#define MD5CACHE_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include "MD5.h"
+
+/* Persistent cache of file hashes in a memory mapped open addressing table.
+ * Entries are keyed by device, inode, size, mtime and ctime so any change to
+ * a file misses. Lookups are lock free; each entry carries a sequence count
+ * that is odd while a writer is updating it. Writers serialize on flock().
+ * A file with a different magic, version or layout is replaced on open. */
+class MD5Cache {
+
+public:
+
+  static const char MAGIC[8];
+  static const uint32_t VERSION = 1;
+  static const size_t SLOTS = 1 << 20;   // default table size, 64 MiB sparse file
+  static const int MAX_PROBE = 8;        // slots searched from the home slot
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_len;
+    uint64_t slots;
+    char reserved[40];
+  };
+
+  struct Entry {
+    uint64_t seq;          // odd while being written, 0 when empty
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    unsigned char hash[MD5::HASH_LEN];
+  };
+
+private:
+
+  int fd;
+  Header *header;
+  Entry *entries;
+  size_t map_len;
+  size_t mask;       // slots - 1
+
+public:
+
+  size_t hits;
+  size_t misses;
+
+  MD5Cache(void);
+  ~MD5Cache(void);
+
+  /* Maps the cache at path, creating or replacing it if it does not match
+   * this layout. slots is rounded up to a power of two. */
+  bool open(const char *path, size_t slots = SLOTS);
+  void close(void);
+
+  /* Copies the cached hash for st into hash (17 element array) on a hit */
+  bool lookup(const struct stat &st, unsigned char *hash);
+
+  /* Records hash for st */
+  void store(const struct stat &st, const unsigned char *hash);
+
+  /* Hashes f, consulting the cache first and updating it afterwards. Files
+   * changed while being read, or modified within the last second, are not
+   * stored since their timestamps can not be trusted to reveal a change. */
+  void make_hash(FILE *f, unsigned char *hash);
+
+private:
+
+  bool create(const char *path, size_t slots);
+  size_t home(const struct stat &st);
+  static bool matches(const Entry &entry, const struct stat &st);
+
+};
+#endif
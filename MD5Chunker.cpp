@@ -0,0 +1,283 @@
+/*
+ * MD5Chunker.cpp
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <condition_variable>
+#include <deque>
+#include <errno.h>
+#include <fcntl.h>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "MD5Chunker.h"
+
+/* Gear table, 256 random 64 bit values from splitmix64 with a fixed seed so
+ * cut points are stable across builds and hosts */
+static uint64_t GEAR[256];
+
+static bool MDGearInit(void)
+{
+  uint64_t x = 0x4d4435436843444bULL;
+  for (int i = 0; i < 256; i++)
+  {
+    uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    GEAR[i] = z ^ (z >> 31);
+  }
+  return true;
+}
+
+static const bool gear_ready = MDGearInit();
+
+/* Mask of the top bits of the Gear hash, the bits that cover a full 64 byte window */
+static uint64_t MDTopMask(int bits)
+{
+  return (bits <= 0) ? 0 : ~0ULL << (64 - bits);
+}
+
+MD5Chunker::MD5Chunker(size_t min_len, size_t avg_len, size_t max_len)
+{
+  this->min_len = min_len;
+  this->avg_len = avg_len;
+  this->max_len = max_len;
+  int bits = 0;
+  while (((size_t) 2 << bits) <= avg_len)
+  {
+    bits++;
+  }
+  this->mask_s = MDTopMask(bits + 1);
+  this->mask_l = MDTopMask(bits - 1);
+  this->offset = 0;
+  reset();
+}
+
+void MD5Chunker::reset(void)
+{
+  this->gear = 0;
+  this->chunk_len = 0;
+  this->context.init();
+}
+
+size_t MD5Chunker::scan(const unsigned char *data, size_t len, bool &cut)
+{
+  uint64_t h = this->gear;
+  size_t n = this->chunk_len;
+  size_t i = 0;
+  cut = false;
+
+  // bytes below min_len can not end a chunk, so are not hashed
+  if (n < this->min_len)
+  {
+    i = (len < this->min_len - n) ? len : this->min_len - n;
+    n += i;
+  }
+  while (i < len)
+  {
+    h = (h << 1) + GEAR[data[i++]];
+    n++;
+    uint64_t mask = (n < this->avg_len) ? this->mask_s : this->mask_l;
+    if (((h & mask) == 0) || (n >= this->max_len))
+    {
+      cut = true;
+      break;
+    }
+  }
+  this->gear = h;
+  this->chunk_len = n;
+  return i;
+}
+
+void MD5Chunker::update(const char *data, size_t len, vector<Chunk> &chunks)
+{
+  unsigned char hash[MD5::HASH_LEN + 1];
+  while (len > 0)
+  {
+    bool cut = false;
+    size_t n = scan((const unsigned char *) data, len, cut);
+    this->context.update(data, n);
+    data += n;
+    len -= n;
+    if (cut)
+    {
+      this->context.finish(hash);
+      Chunk chunk = { this->offset, (uint32_t) this->chunk_len, MD5Hash(hash) };
+      chunks.push_back(chunk);
+      this->offset += this->chunk_len;
+      reset();
+    }
+  }
+}
+
+void MD5Chunker::finish(vector<Chunk> &chunks)
+{
+  unsigned char hash[MD5::HASH_LEN + 1];
+  if (this->chunk_len > 0)
+  {
+    this->context.finish(hash);
+    Chunk chunk = { this->offset, (uint32_t) this->chunk_len, MD5Hash(hash) };
+    chunks.push_back(chunk);
+  }
+  this->offset = 0;
+  reset();
+}
+
+/* Cut points published by the scanning thread, claimed in batches by the
+ * hashing threads. deque keeps element addresses stable while it grows. */
+struct MDChunkQueue {
+  const char *data;
+  deque<MD5Chunker::Chunk> chunks;
+  size_t published;
+  size_t next;
+  bool done;
+  mutex lock;
+  condition_variable ready;
+};
+
+static void MDHashChunks(MDChunkQueue *q)
+{
+  unsigned char hash[MD5::HASH_LEN + 1];
+  MD5Chunker::Chunk *batch[MD5Chunker::BATCH];
+  for (;;)
+  {
+    size_t n = 0;
+    {
+      // the deque index is only safe while the scanner can not grow it
+      unique_lock<mutex> guard(q->lock);
+      while ((q->next == q->published) && !q->done)
+      {
+        q->ready.wait(guard);
+      }
+      while ((q->next < q->published) && (n < MD5Chunker::BATCH))
+      {
+        batch[n++] = &q->chunks[q->next++];
+      }
+    }
+    if (n == 0)
+    {
+      return;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+      MD5::make_hash(q->data + batch[i]->offset, batch[i]->len, hash);
+      batch[i]->hash = MD5Hash(hash);
+    }
+  }
+}
+
+bool MD5Chunker::chunk_file(const char *path, vector<Chunk> &chunks, int threads)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return false;
+  }
+
+  this->offset = 0;
+  reset();
+  struct stat st;
+  const char *map = (const char *) MAP_FAILED;
+  if ((fstat(fd, &st) == 0) && S_ISREG(st.st_mode) && (st.st_size > 0))
+  {
+    map = (const char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+
+  if (map == MAP_FAILED)
+  {
+    // pipes, devices and empty files stream through update()
+    char buffer[1 << 16];
+    ssize_t n = 0;
+    while ((n = read(fd, buffer, sizeof(buffer))) != 0)
+    {
+      if (n < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        close(fd);
+        return false;
+      }
+      update(buffer, n, chunks);
+    }
+    close(fd);
+    finish(chunks);
+    return true;
+  }
+  close(fd);
+  size_t len = st.st_size;
+  madvise((void *) map, len, MADV_SEQUENTIAL);
+
+  if (threads <= 0)
+  {
+    update(map, len, chunks);
+    finish(chunks);
+    munmap((void *) map, len);
+    return true;
+  }
+
+  MDChunkQueue q;
+  q.data = map;
+  q.published = 0;
+  q.next = 0;
+  q.done = false;
+  vector<thread> pool;
+  for (int i = 0; i < threads; i++)
+  {
+    pool.push_back(thread(MDHashChunks, &q));
+  }
+
+  size_t pos = 0;
+  vector<Chunk> batch;
+  while (pos < len)
+  {
+    bool cut = false;
+    size_t n = scan((const unsigned char *) map + pos, len - pos, cut);
+    Chunk chunk = { pos, (uint32_t) n, MD5Hash() };
+    batch.push_back(chunk);
+    pos += n;
+    reset();
+    if ((batch.size() == BATCH) || (pos == len))
+    {
+      unique_lock<mutex> guard(q.lock);
+      q.chunks.insert(q.chunks.end(), batch.begin(), batch.end());
+      q.published = q.chunks.size();
+      q.ready.notify_all();
+      batch.clear();
+    }
+  }
+  {
+    unique_lock<mutex> guard(q.lock);
+    q.done = true;
+    q.ready.notify_all();
+  }
+  for (size_t i = 0; i < pool.size(); i++)
+  {
+    pool[i].join();
+  }
+  munmap((void *) map, len);
+  chunks.insert(chunks.end(), q.chunks.begin(), q.chunks.end());
+  reset();
+  return true;
+}
@@ -0,0 +1,86 @@
+/*
+ * MD5Chunker.h
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#ifndef MD5CHUNKER_H
+#define MD5CHUNKER_H
+
+#include <stdint.h>
+#include <vector>
+#include "MD5Hash.h"
+
+/* Content defined chunking (FastCDC) with an MD5 hash per chunk. A Gear
+ * rolling hash over the last 64 bytes picks the cut points, so an insert or
+ * delete only changes the chunks around it and the rest still dedup.
+ * Normalized chunking uses a stricter mask below avg_len and a looser one
+ * above it, keeping most chunks near avg_len; no chunk is shorter than
+ * min_len (except the last) or longer than max_len. */
+class MD5Chunker {
+
+public:
+
+  struct Chunk {
+    uint64_t offset;
+    uint32_t len;
+    MD5Hash hash;
+  };
+
+  static const size_t BATCH = 64;   // chunks handed to a hashing thread at once
+
+private:
+
+  size_t min_len, avg_len, max_len;
+  uint64_t mask_s, mask_l;
+
+  // streaming state for the chunk in progress
+  uint64_t gear;
+  uint64_t offset;
+  size_t chunk_len;
+  MD5 context;
+
+public:
+
+  /* Requires 64 <= min_len < avg_len < max_len <= 4 GiB */
+  MD5Chunker(size_t min_len, size_t avg_len, size_t max_len);
+
+  /* Streaming interface, chunks are hashed in the same pass that finds them.
+   * update() appends every chunk completed by data to chunks, finish() emits
+   * the final partial chunk and resets for the next stream. */
+  void update(const char *data, size_t len, vector<Chunk> &chunks);
+  void finish(vector<Chunk> &chunks);
+
+  /* Chunks a whole file. Regular files are mapped; the calling thread finds
+   * cut points and hands batches of chunks to threads hashing threads, so
+   * boundary detection and hashing overlap. threads == 0 hashes in the
+   * scanning pass. Other files use update(). Returns false on error. */
+  bool chunk_file(const char *path, vector<Chunk> &chunks, int threads);
+
+private:
+
+  /* Advances the Gear hash over data, returns the bytes up to and including a
+   * cut point, or len if the chunk continues past data (cut left false). */
+  size_t scan(const unsigned char *data, size_t len, bool &cut);
+
+  void reset(void);
+
+};
+#endif
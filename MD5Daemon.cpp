@@ -0,0 +1,678 @@
+/*
+ * MD5Daemon.cpp
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "MD5Daemon.h"
+#include "MD5Lanes.h"
+
+/* A client connection. Workers still replying keep it open after the main
+ * loop has seen the client hang up. All fields are guarded by the daemon
+ * lock. */
+struct MDDaemonConn {
+  int fd;
+  int pending;      // requests not yet replied to
+  bool closed;      // hung up, close once pending reaches 0
+  bool dropped;     // shut down for not reading its replies
+  deque<MD5Daemon::Reply> replies;   // waiting for the socket to turn writable
+};
+
+struct MDDaemonBatch {
+  MDDaemonConn *conn;
+  MD5Daemon::Reply reply;
+  int remaining;    // jobs not yet hashed
+};
+
+struct MDDaemonJob {
+  MDDaemonBatch *batch;
+  int index;
+  const char *data;   // mapped buffer
+  size_t len;
+};
+
+static bool MDUnixAddress(const char *path, struct sockaddr_un &addr)
+{
+  memset(&addr, '\0', sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    return false;
+  }
+  strcpy(addr.sun_path, path);
+  return true;
+}
+
+MD5Daemon::MD5Daemon(int threads)
+{
+  listen_fd = -1;
+  stopping = false;
+  wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  flush_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if ((wake_fd < 0) || (flush_fd < 0))
+  {
+    perror("Failed to create eventfd.\n");
+  }
+  if (threads <= 0)
+  {
+    threads = thread::hardware_concurrency();
+  }
+  threads = (threads > MAX_THREADS) ? MAX_THREADS : threads;
+  for (int i = 0; i < ((threads > 0) ? threads : 1); i++)
+  {
+    workers.push_back(thread(&MD5Daemon::work, this));
+  }
+}
+
+MD5Daemon::~MD5Daemon(void)
+{
+  {
+    unique_lock<mutex> guard(this->lock);
+    this->stopping = true;
+  }
+  this->ready.notify_all();
+  for (size_t i = 0; i < this->workers.size(); i++)
+  {
+    this->workers[i].join();
+  }
+  if (this->listen_fd >= 0)
+  {
+    ::close(this->listen_fd);
+  }
+  if (this->wake_fd >= 0)
+  {
+    ::close(this->wake_fd);
+  }
+  if (this->flush_fd >= 0)
+  {
+    ::close(this->flush_fd);
+  }
+}
+
+bool MD5Daemon::listen(const char *path)
+{
+  struct sockaddr_un addr;
+  struct stat st;
+  if (!MDUnixAddress(path, addr))
+  {
+    fprintf(stderr, "Socket path too long.\n");
+    return false;
+  }
+  if ((lstat(path, &st) == 0) && S_ISSOCK(st.st_mode))
+  {
+    unlink(path);
+  }
+  this->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if ((this->listen_fd < 0) ||
+      (bind(this->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) ||
+      (::listen(this->listen_fd, SOMAXCONN) != 0))
+  {
+    perror("Failed to listen on socket.\n");
+    return false;
+  }
+  return true;
+}
+
+void MD5Daemon::stop(void)
+{
+  uint64_t one = 1;
+  if (write(this->wake_fd, &one, sizeof(one)) < 0)
+  {
+    // already signalled
+  }
+}
+
+void MD5Daemon::run(void)
+{
+  vector<MDDaemonConn *> conns;
+  vector<struct pollfd> fds;
+
+  for (;;)
+  {
+    fds.resize(3 + conns.size());
+    fds[0].fd = this->wake_fd;
+    fds[1].fd = this->listen_fd;
+    fds[2].fd = this->flush_fd;
+    for (size_t i = 0; i < fds.size(); i++)
+    {
+      fds[i].events = POLLIN;
+      fds[i].revents = 0;
+    }
+    {
+      unique_lock<mutex> guard(this->lock);
+      for (size_t i = 0; i < conns.size(); i++)
+      {
+        fds[3 + i].fd = conns[i]->fd;
+        fds[3 + i].events = conns[i]->replies.empty() ? POLLIN : POLLIN | POLLOUT;
+      }
+    }
+    if (poll(&fds[0], fds.size(), -1) < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      perror("Failed to poll connections.\n");
+      break;
+    }
+    if (fds[0].revents != 0)
+    {
+      break;
+    }
+    if (fds[2].revents & POLLIN)
+    {
+      // the next round polls the queued connections for POLLOUT
+      uint64_t count = 0;
+      if (read(this->flush_fd, &count, sizeof(count)) < 0)
+      {
+        // already drained
+      }
+    }
+    if (fds[1].revents & POLLIN)
+    {
+      int fd = accept4(this->listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+      if (fd >= 0)
+      {
+        MDDaemonConn *conn = new MDDaemonConn;
+        conn->fd = fd;
+        conn->pending = 0;
+        conn->closed = false;
+        conn->dropped = false;
+        conns.push_back(conn);
+      }
+    }
+    // new connections were appended after fds was filled
+    for (size_t i = fds.size() - 3; i-- > 0; )
+    {
+      short revents = fds[3 + i].revents;
+      if (revents == 0)
+      {
+        continue;
+      }
+      bool open = true;
+      if (revents & POLLOUT)
+      {
+        unique_lock<mutex> guard(this->lock);
+        flush(conns[i]);
+      }
+      if (revents & POLLIN)
+      {
+        open = receive(conns[i]);
+      }
+      else if (revents & (POLLHUP | POLLERR | POLLNVAL))
+      {
+        open = false;
+      }
+      unique_lock<mutex> guard(this->lock);
+      if (!open || conns[i]->dropped)
+      {
+        conns[i]->closed = true;
+        if (conns[i]->pending == 0)
+        {
+          ::close(conns[i]->fd);
+          delete conns[i];
+        }
+        conns.erase(conns.begin() + i);
+      }
+    }
+  }
+
+  unique_lock<mutex> guard(this->lock);
+  for (size_t i = 0; i < conns.size(); i++)
+  {
+    conns[i]->closed = true;
+    if (conns[i]->pending == 0)
+    {
+      ::close(conns[i]->fd);
+      delete conns[i];
+    }
+  }
+}
+
+/* Sends queued replies until the socket would block. A client whose
+ * socket fails is dropped along with its queue. */
+void MD5Daemon::flush(MDDaemonConn *conn)
+{
+  while (!conn->replies.empty())
+  {
+    ssize_t n = send(conn->fd, &conn->replies.front(), sizeof(Reply), MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+      {
+        conn->dropped = true;
+        conn->replies.clear();
+      }
+      return;
+    }
+    conn->replies.pop_front();
+  }
+}
+
+/* Queues a reply behind any still unsent and sends what the socket takes.
+ * Replies to closed or dropped connections are discarded. */
+void MD5Daemon::queue_reply(MDDaemonConn *conn, const Reply &reply)
+{
+  if (conn->closed || conn->dropped)
+  {
+    return;
+  }
+  conn->replies.push_back(reply);
+  if (conn->replies.size() > MAX_REPLIES)
+  {
+    // the main loop sees the hang up and closes the connection
+    conn->dropped = true;
+    conn->replies.clear();
+    shutdown(conn->fd, SHUT_RDWR);
+    return;
+  }
+  flush(conn);
+  if (!conn->replies.empty())
+  {
+    uint64_t one = 1;
+    if (write(this->flush_fd, &one, sizeof(one)) < 0)
+    {
+      // already signalled
+    }
+  }
+}
+
+/* Reads one request, maps its buffers and queues them for the workers.
+ * Returns false when the client has gone. */
+bool MD5Daemon::receive(MDDaemonConn *conn)
+{
+  Request request;
+  char control[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+  struct iovec iov;
+  struct msghdr msg;
+  memset(&request, '\0', sizeof(request));
+  memset(&msg, '\0', sizeof(msg));
+  iov.iov_base = &request;
+  iov.iov_len = sizeof(request);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  ssize_t n = recvmsg(conn->fd, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+  if (n < 0)
+  {
+    return (errno == EINTR) || (errno == EAGAIN);
+  }
+  if (n == 0)
+  {
+    return false;
+  }
+
+  vector<int> fds;
+  for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c))
+  {
+    if ((c->cmsg_level == SOL_SOCKET) && (c->cmsg_type == SCM_RIGHTS))
+    {
+      int *p = (int *) CMSG_DATA(c);
+      for (size_t i = 0; i < (c->cmsg_len - CMSG_LEN(0)) / sizeof(int); i++)
+      {
+        fds.push_back(p[i]);
+      }
+    }
+  }
+
+  MDDaemonBatch *batch = new MDDaemonBatch;
+  Reply &reply = batch->reply;
+  memset(&reply, '\0', sizeof(reply));
+  reply.magic = MAGIC;
+  reply.id = request.id;
+  batch->conn = conn;
+  batch->remaining = 0;
+
+  vector<MDDaemonJob *> queued;
+  if ((n < (ssize_t) offsetof(Request, len)) || (request.magic != MAGIC) ||
+      (request.count > (uint32_t) MAX_FDS) || (request.count != fds.size()) ||
+      (n < (ssize_t) (offsetof(Request, len) + request.count * sizeof(uint64_t))) ||
+      (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+  {
+    reply.status[0] = BAD_REQUEST;
+  }
+  else
+  {
+    reply.count = request.count;
+    for (uint32_t i = 0; i < request.count; i++)
+    {
+      struct stat st;
+      int seals = fcntl(fds[i], F_GET_SEALS);
+      size_t len = request.len[i];
+      if ((seals < 0) || !(seals & F_SEAL_SHRINK) || (fstat(fds[i], &st) != 0) ||
+          ((uint64_t) st.st_size < request.len[i]))
+      {
+        reply.status[i] = BAD_BUFFER;
+        continue;
+      }
+      if (len == 0)
+      {
+        unsigned char hash[MD5::HASH_LEN + 1];
+        MD5::make_hash("", 0, hash);
+        memcpy(reply.hash[i], hash, MD5::HASH_LEN);
+        continue;
+      }
+      void *map = mmap(NULL, len, PROT_READ, MAP_SHARED, fds[i], 0);
+      if (map == MAP_FAILED)
+      {
+        reply.status[i] = BAD_BUFFER;
+        continue;
+      }
+      MDDaemonJob *job = new MDDaemonJob;
+      job->batch = batch;
+      job->index = i;
+      job->data = (const char *) map;
+      job->len = len;
+      queued.push_back(job);
+    }
+  }
+  for (size_t i = 0; i < fds.size(); i++)
+  {
+    ::close(fds[i]);
+  }
+
+  if (queued.empty())
+  {
+    unique_lock<mutex> guard(this->lock);
+    queue_reply(conn, reply);
+    delete batch;
+    return true;
+  }
+  {
+    unique_lock<mutex> guard(this->lock);
+    batch->remaining = queued.size();
+    conn->pending++;
+    for (size_t i = 0; i < queued.size(); i++)
+    {
+      this->jobs.push_back(queued[i]);
+    }
+  }
+  this->ready.notify_all();
+  return true;
+}
+
+/* Takes the next job, plus queued jobs of the same length to fill the
+ * lanes when it is short, and hashes them in place */
+void MD5Daemon::work(void)
+{
+  MDDaemonJob *batch[MD5Lanes::LANES];
+  const char *data[MD5Lanes::LANES];
+  unsigned char hashes[MD5Lanes::LANES * (MD5::HASH_LEN + 1)];
+
+  for (;;)
+  {
+    int n = 0;
+    {
+      unique_lock<mutex> guard(this->lock);
+      while (this->jobs.empty() && !this->stopping)
+      {
+        this->ready.wait(guard);
+      }
+      if (this->jobs.empty())
+      {
+        return;
+      }
+      batch[n++] = this->jobs.front();
+      this->jobs.pop_front();
+      if (batch[0]->len <= LANE_MAX)
+      {
+        size_t window = (this->jobs.size() < LANE_WINDOW) ? this->jobs.size() : LANE_WINDOW;
+        for (size_t i = 0; (i < window) && (n < MD5Lanes::LANES); )
+        {
+          if (this->jobs[i]->len == batch[0]->len)
+          {
+            batch[n++] = this->jobs[i];
+            this->jobs.erase(this->jobs.begin() + i);
+            window--;
+          }
+          else
+          {
+            i++;
+          }
+        }
+        if (n < MD5Lanes::LANES)
+        {
+          // not enough partners, hand the others back in order
+          while (n > 1)
+          {
+            this->jobs.push_front(batch[--n]);
+          }
+        }
+      }
+    }
+
+    if (n == MD5Lanes::LANES)
+    {
+      for (int i = 0; i < n; i++)
+      {
+        data[i] = batch[i]->data;
+      }
+      MD5Lanes::make_hashes(data, batch[0]->len, hashes);
+    }
+    else
+    {
+      MD5::make_hash(batch[0]->data, batch[0]->len, hashes);
+    }
+    for (int i = 0; i < n; i++)
+    {
+      memcpy(batch[i]->batch->reply.hash[batch[i]->index], hashes + i * (MD5::HASH_LEN + 1), MD5::HASH_LEN);
+      finish(batch[i]);
+    }
+  }
+}
+
+/* Releases a hashed job; the last job of a request sends the reply */
+void MD5Daemon::finish(MDDaemonJob *job)
+{
+  MDDaemonBatch *batch = job->batch;
+  MDDaemonConn *conn = batch->conn;
+  munmap((void *) job->data, job->len);
+  delete job;
+
+  unique_lock<mutex> guard(this->lock);
+  if (--batch->remaining != 0)
+  {
+    return;
+  }
+  queue_reply(conn, batch->reply);
+  delete batch;
+  if ((--conn->pending == 0) && conn->closed)
+  {
+    ::close(conn->fd);
+    delete conn;
+  }
+}
+
+MD5Client::MD5Client(void)
+{
+  fd = -1;
+  next_id = 0;
+}
+
+MD5Client::~MD5Client(void)
+{
+  close();
+}
+
+bool MD5Client::connect(const char *path)
+{
+  struct sockaddr_un addr;
+  close();
+  if (!MDUnixAddress(path, addr))
+  {
+    return false;
+  }
+  this->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if ((this->fd < 0) || (::connect(this->fd, (struct sockaddr *) &addr, sizeof(addr)) != 0))
+  {
+    perror("Failed to connect to md5d.\n");
+    close();
+    return false;
+  }
+  return true;
+}
+
+void MD5Client::close(void)
+{
+  if (this->fd >= 0)
+  {
+    ::close(this->fd);
+    this->fd = -1;
+  }
+}
+
+int MD5Client::create_buffer(size_t len, char **data)
+{
+  *data = NULL;
+  int fd = memfd_create("md5", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0)
+  {
+    perror("Failed to create memfd.\n");
+    return -1;
+  }
+  if (ftruncate(fd, len) != 0)
+  {
+    perror("Failed to size memfd.\n");
+    ::close(fd);
+    return -1;
+  }
+  if (len > 0)
+  {
+    void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+      perror("Failed to map memfd.\n");
+      ::close(fd);
+      return -1;
+    }
+    *data = (char *) map;
+  }
+  return fd;
+}
+
+bool MD5Client::make_hashes(const int *fds, const uint64_t *lens, int count, unsigned char *hashes, bool *ok)
+{
+  if ((this->fd < 0) || (count < 0) || (count > MD5Daemon::MAX_FDS))
+  {
+    return false;
+  }
+
+  MD5Daemon::Request request;
+  char control[CMSG_SPACE(sizeof(int) * MD5Daemon::MAX_FDS)];
+  struct iovec iov;
+  struct msghdr msg;
+  memset(&request, '\0', sizeof(request));
+  memset(control, '\0', sizeof(control));
+  memset(&msg, '\0', sizeof(msg));
+  request.magic = MD5Daemon::MAGIC;
+  request.count = count;
+  request.id = ++this->next_id;
+  for (int i = 0; i < count; i++)
+  {
+    // the daemon only maps buffers that can not shrink under it
+    fcntl(fds[i], F_ADD_SEALS, F_SEAL_SHRINK);
+    request.len[i] = lens[i];
+  }
+  iov.iov_base = &request;
+  iov.iov_len = offsetof(MD5Daemon::Request, len) + count * sizeof(uint64_t);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (count > 0)
+  {
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(c), fds, sizeof(int) * count);
+  }
+  if (sendmsg(this->fd, &msg, MSG_NOSIGNAL) < 0)
+  {
+    perror("Failed to send to md5d.\n");
+    return false;
+  }
+
+  MD5Daemon::Reply reply;
+  do
+  {
+    ssize_t n = recv(this->fd, &reply, sizeof(reply), 0);
+    if ((n < 0) && (errno == EINTR))
+    {
+      reply.id = 0;
+      continue;
+    }
+    if (n != (ssize_t) sizeof(reply))
+    {
+      perror("Failed to receive from md5d.\n");
+      return false;
+    }
+  } while (reply.id != request.id);
+
+  bool accepted = (reply.magic == MD5Daemon::MAGIC) && (reply.count == (uint32_t) count);
+  for (int i = 0; i < count; i++)
+  {
+    unsigned char *hash = hashes + i * (MD5::HASH_LEN + 1);
+    ok[i] = accepted && (reply.status[i] == MD5Daemon::OK);
+    memset(hash, '\0', MD5::HASH_LEN + 1);
+    if (ok[i])
+    {
+      memcpy(hash, reply.hash[i], MD5::HASH_LEN);
+    }
+  }
+  return accepted || (count == 0);
+}
+
+bool MD5Client::make_hash(const char *data, size_t len, unsigned char *hash)
+{
+  char *buffer = NULL;
+  int fd = create_buffer(len, &buffer);
+  if (fd < 0)
+  {
+    memset(hash, '\0', MD5::HASH_LEN + 1);
+    return false;
+  }
+  if (len > 0)
+  {
+    memcpy(buffer, data, len);
+    munmap(buffer, len);
+  }
+  uint64_t len64 = len;
+  bool ok = false;
+  bool sent = make_hashes(&fd, &len64, 1, hash, &ok);
+  ::close(fd);
+  return sent && ok;
+}
@@ -0,0 +1,143 @@
+/*
+ * MD5Daemon.h
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#ifndef MD5DAEMON_H
+#define MD5DAEMON_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+#include "MD5.h"
+
+struct MDDaemonConn;
+struct MDDaemonJob;
+
+/* Hashing service on a UNIX domain (SOCK_SEQPACKET) socket, see md5d. A
+ * request passes up to MAX_FDS sealed memfd buffers with SCM_RIGHTS; the
+ * daemon maps them and hashes in place on its worker threads, then replies
+ * with one digest per buffer. Jobs from all connections share one queue, so
+ * small buffers of equal length submitted by different processes are
+ * batched through MD5Lanes. Buffers must carry F_SEAL_SHRINK so a client
+ * can not truncate a mapping while it is being hashed. Connections are non
+ * blocking: replies a client is not reading yet wait in a per connection
+ * queue flushed when the socket turns writable, and a client that lets
+ * more than MAX_REPLIES pile up is disconnected. */
+class MD5Daemon {
+
+public:
+
+  static const int MAX_FDS = 16;
+  static const uint32_t MAGIC = 0x4435444d;     // "MD5D"
+  static const size_t LANE_MAX = 1 << 16;       // longest buffer batched into lanes
+  static const size_t LANE_WINDOW = 64;         // queued jobs searched for lane partners
+  static const size_t MAX_REPLIES = 256;        // unsent replies before a client is dropped
+  static const int MAX_THREADS = 1024;
+
+  enum Status { OK = 0, BAD_BUFFER = 1, BAD_REQUEST = 2 };
+
+  struct Request {
+    uint32_t magic;
+    uint32_t count;
+    uint64_t id;              // echoed in the reply
+    uint64_t len[MAX_FDS];    // bytes hashed from offset 0 of each buffer
+  };
+
+  struct Reply {
+    uint32_t magic;
+    uint32_t count;
+    uint64_t id;
+    uint8_t status[MAX_FDS];
+    unsigned char hash[MAX_FDS][MD5::HASH_LEN];
+  };
+
+private:
+
+  int listen_fd;
+  int wake_fd;                      // eventfd written by stop()
+  int flush_fd;                     // eventfd written when a reply is left queued
+  vector<thread> workers;
+  deque<MDDaemonJob *> jobs;
+  bool stopping;
+  mutex lock;
+  condition_variable ready;
+
+public:
+
+  /* threads <= 0 uses one worker per CPU, at most MAX_THREADS are started */
+  MD5Daemon(int threads);
+  ~MD5Daemon(void);
+
+  /* Binds and listens on path, replacing a stale socket file */
+  bool listen(const char *path);
+
+  /* Serves connections until stop() */
+  void run(void);
+
+  /* Makes run() return, safe to call from a signal handler */
+  void stop(void);
+
+private:
+
+  void work(void);
+  bool receive(MDDaemonConn *conn);
+  void finish(MDDaemonJob *job);
+
+  /* Both called with lock held */
+  void queue_reply(MDDaemonConn *conn, const Reply &reply);
+  void flush(MDDaemonConn *conn);
+
+};
+
+/* Client side of md5d. Buffers are created with create_buffer(), filled in
+ * place and submitted without copying. */
+class MD5Client {
+
+  int fd;
+  uint64_t next_id;
+
+public:
+
+  MD5Client(void);
+  ~MD5Client(void);
+
+  bool connect(const char *path);
+  void close(void);
+
+  /* Sealable memfd of len bytes mapped writable at *data. Returns the
+   * descriptor, or -1. Unmap with munmap(*data, len) and close when done. */
+  static int create_buffer(size_t len, char **data);
+
+  /* Hashes the first lens[i] bytes of count (<= MD5Daemon::MAX_FDS) memfds
+   * into hashes (count * (HASH_LEN + 1) bytes). The buffers are sealed
+   * against shrinking first. ok[i] is false for buffers the daemon refused.
+   * Returns false when the daemon could not be reached. */
+  bool make_hashes(const int *fds, const uint64_t *lens, int count, unsigned char *hashes, bool *ok);
+
+  /* Copies data into a memfd and hashes it */
+  bool make_hash(const char *data, size_t len, unsigned char *hash);
+
+};
+#endif
@@ -0,0 +1,582 @@
+/*
+ * MD5Decompress.cpp
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <condition_variable>
+#include <deque>
+#include <errno.h>
+#include <lzma.h>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef MD5_ZSTD
+#include <zstd.h>
+#endif
+#include "MD5Decompress.h"
+
+static const size_t READ_LEN = 1 << 17;   // compressed bytes read per call
+static const size_t MAX_FRAME_LEN = 32 << 20;   // largest zstd frame decoded whole
+
+/* Bounded queue of decoded buffers from the decoder thread to the hasher.
+ * Buffers are recycled through spare to avoid reallocating. */
+struct MDPipe {
+  deque<vector<char> > ready;
+  deque<vector<char> > spare;
+  bool done;
+  bool failed;
+  mutex lock;
+  condition_variable changed;
+
+  MDPipe(void) : done(false), failed(false) {}
+
+  /* Decoder side: an empty buffer with CHUNK_LEN capacity */
+  vector<char> take(void)
+  {
+    unique_lock<mutex> guard(lock);
+    vector<char> buffer;
+    if (!spare.empty())
+    {
+      buffer.swap(spare.front());
+      spare.pop_front();
+    }
+    buffer.reserve(MD5Decompress::CHUNK_LEN);
+    buffer.clear();
+    return buffer;
+  }
+
+  /* Decoder side: queue a filled buffer, waiting while the queue is full */
+  void put(vector<char> &buffer)
+  {
+    unique_lock<mutex> guard(lock);
+    while (ready.size() >= MD5Decompress::QUEUE_DEPTH)
+    {
+      changed.wait(guard);
+    }
+    ready.push_back(vector<char>());
+    ready.back().swap(buffer);
+    changed.notify_all();
+  }
+
+  void finish(bool ok)
+  {
+    unique_lock<mutex> guard(lock);
+    done = true;
+    failed = !ok;
+    changed.notify_all();
+  }
+
+  /* Hasher side: next buffer, false once the decoder has finished */
+  bool get(vector<char> &buffer)
+  {
+    unique_lock<mutex> guard(lock);
+    while (ready.empty() && !done)
+    {
+      changed.wait(guard);
+    }
+    if (ready.empty())
+    {
+      return false;
+    }
+    buffer.swap(ready.front());
+    ready.pop_front();
+    changed.notify_all();
+    return true;
+  }
+
+  void recycle(vector<char> &buffer)
+  {
+    unique_lock<mutex> guard(lock);
+    spare.push_back(vector<char>());
+    spare.back().swap(buffer);
+  }
+};
+
+/* Compressed input: bytes already read for detection, then fd */
+struct MDSource {
+  int fd;
+  vector<char> buffer;
+  size_t len;
+  bool eof;
+
+  /* Refills buffer, returns false on a read error */
+  bool fill(void)
+  {
+    buffer.resize(READ_LEN);
+    for (;;)
+    {
+      ssize_t n = read(fd, &buffer[0], READ_LEN);
+      if (n < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        return false;
+      }
+      len = n;
+      eof = (n == 0);
+      return true;
+    }
+  }
+};
+
+static bool MDPlain(MDSource &in, MDPipe &pipe)
+{
+  while (in.len > 0)
+  {
+    vector<char> out = pipe.take();
+    out.assign(in.buffer.begin(), in.buffer.begin() + in.len);
+    pipe.put(out);
+    if (!in.fill())
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool MDGunzip(MDSource &in, MDPipe &pipe)
+{
+  z_stream strm;
+  memset(&strm, '\0', sizeof(strm));
+  if (inflateInit2(&strm, 15 + 32) != Z_OK)   // gzip or zlib header
+  {
+    return false;
+  }
+  vector<char> out = pipe.take();
+  out.resize(MD5Decompress::CHUNK_LEN);
+  strm.next_out = (Bytef *) &out[0];
+  strm.avail_out = out.size();
+  strm.next_in = (Bytef *) &in.buffer[0];
+  strm.avail_in = in.len;
+
+  bool ok = true;
+  bool member = false;    // inside a gzip member
+  bool padding = false;   // zeros after the last member, which gzip -dc ignores
+  for (;;)
+  {
+    if (strm.avail_in == 0)
+    {
+      if (in.eof)
+      {
+        ok = !member;   // a member cut short is an error
+        break;
+      }
+      if (!in.fill())
+      {
+        ok = false;
+        break;
+      }
+      strm.next_in = (Bytef *) &in.buffer[0];
+      strm.avail_in = in.len;
+      continue;
+    }
+    if (!member && (*strm.next_in == 0))
+    {
+      padding = true;
+      strm.next_in++;
+      strm.avail_in--;
+      continue;
+    }
+    if (padding)
+    {
+      ok = false;   // data after the padding
+      break;
+    }
+    member = true;
+    int rc = inflate(&strm, Z_NO_FLUSH);
+    if (strm.avail_out == 0)
+    {
+      pipe.put(out);
+      out = pipe.take();
+      out.resize(MD5Decompress::CHUNK_LEN);
+      strm.next_out = (Bytef *) &out[0];
+      strm.avail_out = out.size();
+    }
+    if (rc == Z_STREAM_END)
+    {
+      // concatenated members continue after the trailer
+      member = false;
+      inflateReset(&strm);
+    }
+    else if ((rc != Z_OK) && (rc != Z_BUF_ERROR))
+    {
+      ok = false;
+      break;
+    }
+  }
+  out.resize(out.size() - strm.avail_out);
+  if (ok && !out.empty())
+  {
+    pipe.put(out);
+  }
+  inflateEnd(&strm);
+  return ok;
+}
+
+static bool MDUnxz(MDSource &in, MDPipe &pipe)
+{
+  lzma_stream strm = LZMA_STREAM_INIT;
+  if (lzma_stream_decoder(&strm, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK)
+  {
+    return false;
+  }
+  vector<char> out = pipe.take();
+  out.resize(MD5Decompress::CHUNK_LEN);
+  strm.next_out = (uint8_t *) &out[0];
+  strm.avail_out = out.size();
+  strm.next_in = (const uint8_t *) &in.buffer[0];
+  strm.avail_in = in.len;
+
+  bool ok = true;
+  for (;;)
+  {
+    if ((strm.avail_in == 0) && !in.eof)
+    {
+      if (!in.fill())
+      {
+        ok = false;
+        break;
+      }
+      strm.next_in = (const uint8_t *) &in.buffer[0];
+      strm.avail_in = in.len;
+    }
+    lzma_ret rc = lzma_code(&strm, in.eof ? LZMA_FINISH : LZMA_RUN);
+    if ((strm.avail_out == 0) || (rc == LZMA_STREAM_END))
+    {
+      out.resize(out.size() - strm.avail_out);
+      if (!out.empty())
+      {
+        pipe.put(out);
+      }
+      out = pipe.take();
+      out.resize(MD5Decompress::CHUNK_LEN);
+      strm.next_out = (uint8_t *) &out[0];
+      strm.avail_out = out.size();
+    }
+    if (rc == LZMA_STREAM_END)
+    {
+      break;
+    }
+    if (rc != LZMA_OK)
+    {
+      ok = false;
+      break;
+    }
+  }
+  lzma_end(&strm);
+  return ok;
+}
+
+#ifdef MD5_ZSTD
+
+static bool MDUnzstd(MDSource &in, MDPipe &pipe)
+{
+  ZSTD_DStream *strm = ZSTD_createDStream();
+  if (strm == NULL)
+  {
+    return false;
+  }
+  ZSTD_initDStream(strm);
+  ZSTD_inBuffer src = { &in.buffer[0], in.len, 0 };
+  vector<char> out = pipe.take();
+  out.resize(MD5Decompress::CHUNK_LEN);
+  ZSTD_outBuffer dst = { &out[0], out.size(), 0 };
+
+  bool ok = true;
+  size_t rc = 0;
+  for (;;)
+  {
+    if (src.pos == src.size)
+    {
+      if (in.eof)
+      {
+        ok = (rc == 0);   // 0 once a frame is complete
+        break;
+      }
+      if (!in.fill())
+      {
+        ok = false;
+        break;
+      }
+      src.src = &in.buffer[0];
+      src.size = in.len;
+      src.pos = 0;
+      continue;
+    }
+    rc = ZSTD_decompressStream(strm, &dst, &src);
+    if (ZSTD_isError(rc))
+    {
+      ok = false;
+      break;
+    }
+    if (dst.pos == dst.size)
+    {
+      pipe.put(out);
+      out = pipe.take();
+      out.resize(MD5Decompress::CHUNK_LEN);
+      dst.dst = &out[0];
+      dst.size = out.size();
+      dst.pos = 0;
+    }
+  }
+  out.resize(dst.pos);
+  if (ok && !out.empty())
+  {
+    pipe.put(out);
+  }
+  ZSTD_freeDStream(strm);
+  return ok;
+}
+
+/* Decodes one complete frame into out, failing past MAX_FRAME_LEN bytes */
+static void MDZstdFrame(const char *frame, size_t len, vector<char> *out, bool *ok)
+{
+  unsigned long long size = ZSTD_getFrameContentSize(frame, len);
+  *ok = false;
+  if (size == ZSTD_CONTENTSIZE_ERROR)
+  {
+    return;
+  }
+  if (size != ZSTD_CONTENTSIZE_UNKNOWN)
+  {
+    if (size <= MAX_FRAME_LEN)
+    {
+      out->resize(size);
+      size_t rc = ZSTD_decompress(out->data(), size, frame, len);
+      *ok = !ZSTD_isError(rc) && (rc == size);
+    }
+    return;
+  }
+  // no size in the frame header, stream it
+  ZSTD_DStream *strm = ZSTD_createDStream();
+  if (strm == NULL)
+  {
+    return;
+  }
+  ZSTD_initDStream(strm);
+  ZSTD_inBuffer src = { frame, len, 0 };
+  size_t rc = 1;
+  out->clear();
+  while (!ZSTD_isError(rc) && (rc != 0) && (out->size() < MAX_FRAME_LEN))
+  {
+    size_t used = out->size();
+    out->resize(used + MD5Decompress::CHUNK_LEN);
+    ZSTD_outBuffer dst = { out->data() + used, MD5Decompress::CHUNK_LEN, 0 };
+    rc = ZSTD_decompressStream(strm, &dst, &src);
+    out->resize(used + dst.pos);
+    if ((src.pos == src.size) && (dst.pos == 0) && (rc != 0))
+    {
+      break;   // truncated
+    }
+  }
+  *ok = (rc == 0);
+  ZSTD_freeDStream(strm);
+}
+
+/* True when the mapped input holds at least two frames, each declaring a
+ * size of at most MAX_FRAME_LEN; others are streamed by MDUnzstd() */
+static bool MDZstdSplittable(const char *map, size_t len)
+{
+  size_t pos = 0, frames = 0;
+  while (pos < len)
+  {
+    size_t n = ZSTD_findFrameCompressedSize(map + pos, len - pos);
+    unsigned long long size = ZSTD_getFrameContentSize(map + pos, len - pos);
+    if (ZSTD_isError(n) || (size == ZSTD_CONTENTSIZE_UNKNOWN) ||
+        (size == ZSTD_CONTENTSIZE_ERROR) || (size > MAX_FRAME_LEN))
+    {
+      return false;
+    }
+    pos += n;
+    frames++;
+  }
+  return frames >= 2;
+}
+
+/* Mapped input with several frames: each batch of up to threads frames is
+ * decoded in parallel, then queued in order while the next batch decodes. */
+static bool MDUnzstdFrames(const char *map, size_t len, MDPipe &pipe, int threads)
+{
+  size_t pos = 0;
+  while (pos < len)
+  {
+    vector<size_t> starts, lens;
+    while ((pos < len) && (starts.size() < (size_t) threads))
+    {
+      size_t n = ZSTD_findFrameCompressedSize(map + pos, len - pos);
+      if (ZSTD_isError(n))
+      {
+        return false;
+      }
+      starts.push_back(pos);
+      lens.push_back(n);
+      pos += n;
+    }
+    vector<vector<char> > outs(starts.size());
+    bool *ok = new bool[starts.size()];
+    vector<thread> pool;
+    for (size_t i = 0; i < starts.size(); i++)
+    {
+      outs[i] = pipe.take();
+      pool.push_back(thread(MDZstdFrame, map + starts[i], lens[i], &outs[i], ok + i));
+    }
+    bool result = true;
+    for (size_t i = 0; i < pool.size(); i++)
+    {
+      pool[i].join();
+      result = result && ok[i];
+    }
+    delete[] ok;
+    if (!result)
+    {
+      return false;
+    }
+    for (size_t i = 0; i < outs.size(); i++)
+    {
+      if (!outs[i].empty())
+      {
+        pipe.put(outs[i]);
+      }
+    }
+  }
+  return true;
+}
+
+#endif
+
+MD5Decompress::Format MD5Decompress::detect(const unsigned char *data, size_t len)
+{
+  static const unsigned char XZ_MAGIC[6] = { 0xfd, '7', 'z', 'X', 'Z', 0x00 };
+  static const unsigned char ZSTD_MAGIC[4] = { 0x28, 0xb5, 0x2f, 0xfd };
+  if ((len >= 2) && (data[0] == 0x1f) && (data[1] == 0x8b))
+  {
+    return GZIP;
+  }
+  if ((len >= sizeof(XZ_MAGIC)) && (memcmp(data, XZ_MAGIC, sizeof(XZ_MAGIC)) == 0))
+  {
+    return XZ;
+  }
+  if ((len >= sizeof(ZSTD_MAGIC)) && (memcmp(data, ZSTD_MAGIC, sizeof(ZSTD_MAGIC)) == 0))
+  {
+    return ZSTD;
+  }
+  return PLAIN;
+}
+
+/* Decoder thread body */
+static void MDDecode(MDSource *in, MDPipe *pipe, MD5Decompress::Format format, int threads)
+{
+  bool ok = false;
+  switch (format)
+  {
+  case MD5Decompress::GZIP:
+    ok = MDGunzip(*in, *pipe);
+    break;
+  case MD5Decompress::XZ:
+    ok = MDUnxz(*in, *pipe);
+    break;
+  case MD5Decompress::ZSTD:
+#ifdef MD5_ZSTD
+    {
+      struct stat st;
+      off_t offset = lseek(in->fd, 0, SEEK_CUR);
+      const char *map = (const char *) MAP_FAILED;
+      if ((threads > 1) && (fstat(in->fd, &st) == 0) && S_ISREG(st.st_mode) && (offset >= 0))
+      {
+        map = (const char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+      }
+      // the detection read already consumed in->len bytes
+      size_t start = offset - in->len;
+      if ((map != MAP_FAILED) && !MDZstdSplittable(map + start, st.st_size - start))
+      {
+        munmap((void *) map, st.st_size);
+        map = (const char *) MAP_FAILED;
+      }
+      if (map != MAP_FAILED)
+      {
+        ok = MDUnzstdFrames(map + start, st.st_size - start, *pipe, threads);
+        munmap((void *) map, st.st_size);
+      }
+      else
+      {
+        ok = MDUnzstd(*in, *pipe);
+      }
+    }
+#else
+    (void) threads;
+    fprintf(stderr, "zstd input needs a build with -DMD5_ZSTD\n");
+#endif
+    break;
+  default:
+    ok = MDPlain(*in, *pipe);
+    break;
+  }
+  pipe->finish(ok);
+}
+
+bool MD5Decompress::make_hash(int fd, unsigned char *hash, int threads)
+{
+  memset(hash, '\0', MD5::HASH_LEN + 1);
+  MDSource in;
+  in.fd = fd;
+  in.len = 0;
+  in.eof = false;
+  if (!in.fill())
+  {
+    return false;
+  }
+  // pipes may deliver the magic in pieces
+  while (!in.eof && (in.len < 6))
+  {
+    ssize_t n = read(fd, &in.buffer[in.len], READ_LEN - in.len);
+    if ((n < 0) && (errno != EINTR))
+    {
+      return false;
+    }
+    in.len += (n > 0) ? n : 0;
+    in.eof = (n == 0);
+  }
+  in.eof = false;   // in.len bytes are still to be decoded
+  Format format = detect((const unsigned char *) &in.buffer[0], in.len);
+
+  MD5 context;
+  MDPipe pipe;
+  thread decoder(MDDecode, &in, &pipe, format, threads);
+  vector<char> buffer;
+  while (pipe.get(buffer))
+  {
+    context.update(buffer.data(), buffer.size());
+    pipe.recycle(buffer);
+  }
+  decoder.join();
+  if (pipe.failed)
+  {
+    return false;
+  }
+  context.finish(hash);
+  return true;
+}
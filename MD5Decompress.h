@@ -0,0 +1,56 @@
+/*
+ * MD5Decompress.h
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#ifndef MD5DECOMPRESS_H
+#define MD5DECOMPRESS_H
+
+#include "MD5.h"
+
+/* Hashes the decompressed content of gzip, xz and zstd inputs without a
+ * temporary file. A decoder thread fills CHUNK_LEN buffers that the calling
+ * thread hashes, with up to QUEUE_DEPTH buffers in flight, so decompression
+ * and hashing overlap. Concatenated gzip members and xz streams are
+ * followed, and zero padding after the last gzip member is ignored as gzip
+ * does. zstd needs -DMD5_ZSTD and -lzstd; mapped zstd files with several
+ * frames of known, bounded size are decompressed a batch of frames at a
+ * time on parallel threads. Input in no known format is hashed as is. */
+class MD5Decompress {
+
+public:
+
+  enum Format { PLAIN, GZIP, XZ, ZSTD };
+
+  static const size_t CHUNK_LEN = 1 << 20;
+  static const size_t QUEUE_DEPTH = 4;
+
+  /* Format from the first bytes of the input */
+  static Format detect(const unsigned char *data, size_t len);
+
+  /* Hashes fd from its current position. threads bounds the zstd frame
+   * decoders, <= 1 decodes frames in order. Returns false on a read or
+   * decode error, or a format this build can not decode, leaving a null
+   * hash. */
+  static bool make_hash(int fd, unsigned char *hash, int threads = 1);
+
+};
+#endif
@@ -0,0 +1,369 @@
+/*
+ * MD5File.cpp
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "MD5File.h"
+
+bool MD5File::write_all(int fd, const char *data, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t n = write(fd, data, len);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return false;
+    }
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+/* Hashes each window from the mapping, which faults it into the page cache,
+ * then has the kernel copy the same pages to dst. Falls back to writing from
+ * the mapping when copy_file_range() is not supported between the two files. */
+bool MD5File::copy_mapped(const char *map, int src_fd, int dst_fd, size_t len, MD5 &context)
+{
+  bool kernel_copy = true;
+  bool result = true;
+  size_t offset = 0;
+  while (result && (offset < len))
+  {
+    size_t window = (len - offset < WINDOW_LEN) ? len - offset : WINDOW_LEN;
+    context.update(map + offset, window);
+
+    size_t done = 0;
+    while (kernel_copy && (done < window))
+    {
+      loff_t in_off = offset + done;
+      loff_t out_off = offset + done;
+      ssize_t n = copy_file_range(src_fd, &in_off, dst_fd, &out_off, window - done, 0);
+      if (n > 0)
+      {
+        done += n;
+      }
+      else if ((n < 0) && (errno == EINTR))
+      {
+        continue;
+      }
+      else if ((n < 0) && (done == 0) && (offset == 0) &&
+               ((errno == EXDEV) || (errno == ENOSYS) || (errno == EINVAL) || (errno == EOPNOTSUPP)))
+      {
+        kernel_copy = false;
+      }
+      else
+      {
+        result = false;
+        break;
+      }
+    }
+    if (!kernel_copy)
+    {
+      // the fallback only starts before anything was copied, and explicit
+      // copy offsets leave the file position alone, so writing in order
+      // also works for pipes and terminals that can not seek
+      result = write_all(dst_fd, map + offset, window);
+    }
+    offset += window;
+  }
+  return result;
+}
+
+char *MD5File::alloc_buffer(size_t &len, int flags)
+{
+  void *buffer = MAP_FAILED;
+  if (flags & HUGE_PAGES)
+  {
+    len = (len + HUGE_PAGE_LEN - 1) & ~(HUGE_PAGE_LEN - 1);
+    buffer = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (buffer == MAP_FAILED)
+    {
+      // no hugetlb pages reserved, align a normal mapping for transparent huge pages
+      char *region = (char *) mmap(NULL, len + HUGE_PAGE_LEN, PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (region == MAP_FAILED)
+      {
+        return NULL;
+      }
+      char *aligned = (char *) (((uintptr_t) region + HUGE_PAGE_LEN - 1) & ~(HUGE_PAGE_LEN - 1));
+      if (aligned > region)
+      {
+        munmap(region, aligned - region);
+      }
+      munmap(aligned + len, region + HUGE_PAGE_LEN - aligned);
+      madvise(aligned, len, MADV_HUGEPAGE);
+      buffer = aligned;
+    }
+  }
+  else
+  {
+    buffer = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  }
+  return (buffer == MAP_FAILED) ? NULL : (char *) buffer;
+}
+
+void MD5File::free_buffer(char *buffer, size_t len)
+{
+  if (buffer != NULL)
+  {
+    munmap(buffer, len);
+  }
+}
+
+bool MD5File::copy_buffered(int src_fd, int dst_fd, MD5 &context, int flags)
+{
+  size_t len = READ_LEN;
+  char *buffer = alloc_buffer(len, flags);
+  if (buffer == NULL)
+  {
+    return false;
+  }
+
+  bool result = true;
+  ssize_t n = 0;
+  while ((n = read(src_fd, buffer, len)) != 0)
+  {
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      result = false;
+      break;
+    }
+    context.update(buffer, n);
+    if (!write_all(dst_fd, buffer, n))
+    {
+      result = false;
+      break;
+    }
+  }
+  free_buffer(buffer, len);
+  return result;
+}
+
+bool MD5File::copy(const char *src, const char *dst, unsigned char *hash, int flags)
+{
+  MD5 context;
+  struct stat st;
+  memset(hash, '\0', MD5::HASH_LEN + 1);
+
+  int src_fd = open(src, O_RDONLY | O_CLOEXEC);
+  if (src_fd < 0)
+  {
+    perror("Failed to open copy source.\n");
+    return false;
+  }
+  if (fstat(src_fd, &st) != 0)
+  {
+    perror("Failed to stat copy source.\n");
+    close(src_fd);
+    return false;
+  }
+  // truncate only once dst is known not to be src, or src would be emptied
+  struct stat dst_st;
+  int dst_fd = open(dst, O_WRONLY | O_CREAT | O_CLOEXEC, st.st_mode & 0777);
+  if ((dst_fd < 0) || (fstat(dst_fd, &dst_st) != 0))
+  {
+    perror("Failed to open copy destination.\n");
+    if (dst_fd >= 0)
+    {
+      close(dst_fd);
+    }
+    close(src_fd);
+    return false;
+  }
+  if ((dst_st.st_dev == st.st_dev) && (dst_st.st_ino == st.st_ino))
+  {
+    fprintf(stderr, "Copy source and destination are the same file.\n");
+    close(dst_fd);
+    close(src_fd);
+    return false;
+  }
+  if (S_ISREG(dst_st.st_mode) && (ftruncate(dst_fd, 0) != 0))
+  {
+    perror("Failed to truncate copy destination.\n");
+    close(dst_fd);
+    close(src_fd);
+    return false;
+  }
+
+  bool result = false;
+  char *map = (char *) MAP_FAILED;
+  if (S_ISREG(st.st_mode) && (st.st_size > 0))
+  {
+    map = (char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, src_fd, 0);
+  }
+  if (map != MAP_FAILED)
+  {
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    if (flags & HUGE_PAGES)
+    {
+      madvise(map, st.st_size, MADV_HUGEPAGE);
+    }
+    result = copy_mapped(map, src_fd, dst_fd, st.st_size, context);
+    munmap(map, st.st_size);
+  }
+  else
+  {
+    result = copy_buffered(src_fd, dst_fd, context, flags);
+  }
+  if (close(dst_fd) != 0)
+  {
+    result = false;
+  }
+  close(src_fd);
+
+  if (!result)
+  {
+    perror("Failed to copy file.\n");
+    return false;
+  }
+  context.finish(hash);
+  return true;
+}
+
+/* Reads fd to the end into context. With DIRECT a regular file is switched
+ * to O_DIRECT when the buffer allows it; if the filesystem refuses, or a
+ * short read leaves the offset unaligned before EOF, the rest is read through
+ * the cache and each range is dropped with POSIX_FADV_DONTNEED once hashed. */
+bool MD5File::read_all(int fd, MD5 &context, char *buffer, size_t len, int flags)
+{
+  struct stat st;
+  int fd_flags = fcntl(fd, F_GETFL);
+  bool regular = (flags & DIRECT) && (fstat(fd, &st) == 0) && S_ISREG(st.st_mode);
+  bool aligned = (((uintptr_t) buffer | len) & (DIRECT_ALIGN - 1)) == 0;
+  bool direct = regular && aligned && (fd_flags >= 0) &&
+                (fcntl(fd, F_SETFL, fd_flags | O_DIRECT) == 0);
+  off_t dropped = regular ? lseek(fd, 0, SEEK_CUR) : -1;   // cache before this offset is released
+
+  bool result = true;
+  ssize_t n = 0;
+  while ((n = read(fd, buffer, len)) != 0)
+  {
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      if (direct && (errno == EINVAL))
+      {
+        // unaligned offset or no direct I/O support, finish through the cache
+        fcntl(fd, F_SETFL, fd_flags);
+        direct = false;
+        continue;
+      }
+      result = false;
+      break;
+    }
+    context.update(buffer, n);
+    if (!direct && (dropped >= 0))
+    {
+      off_t offset = lseek(fd, 0, SEEK_CUR);
+      posix_fadvise(fd, dropped, offset - dropped, POSIX_FADV_DONTNEED);
+      dropped = offset;
+    }
+  }
+  if (direct)
+  {
+    fcntl(fd, F_SETFL, fd_flags);
+  }
+  return result;
+}
+
+bool MD5File::make_hash(const char *path, unsigned char *hash, char *buffer, size_t len, int flags)
+{
+  MD5 context;
+  memset(hash, '\0', MD5::HASH_LEN + 1);
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return false;
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  bool result = read_all(fd, context, buffer, len, flags);
+  close(fd);
+  if (result)
+  {
+    context.finish(hash);
+  }
+  return result;
+}
+
+bool MD5File::make_hash(int fd, unsigned char *hash, int flags)
+{
+  MD5 context;
+  struct stat st;
+  memset(hash, '\0', MD5::HASH_LEN + 1);
+
+  off_t offset = lseek(fd, 0, SEEK_CUR);
+  if (!(flags & DIRECT) &&
+      (fstat(fd, &st) == 0) && S_ISREG(st.st_mode) && (offset >= 0) && (st.st_size > offset))
+  {
+    size_t len = st.st_size;
+    char *map = (char *) mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED)
+    {
+      madvise(map, len, MADV_SEQUENTIAL);
+      if (flags & HUGE_PAGES)
+      {
+        madvise(map, len, MADV_HUGEPAGE);
+      }
+      for (size_t done = offset; done < len; done += WINDOW_LEN)
+      {
+        context.update(map + done, (len - done < WINDOW_LEN) ? len - done : WINDOW_LEN);
+      }
+      munmap(map, len);
+      lseek(fd, len, SEEK_SET);
+      context.finish(hash);
+      return true;
+    }
+  }
+
+  size_t len = READ_LEN;
+  char *buffer = alloc_buffer(len, flags);
+  if (buffer == NULL)
+  {
+    return false;
+  }
+  bool result = read_all(fd, context, buffer, len, flags);
+  free_buffer(buffer, len);
+  if (result)
+  {
+    context.finish(hash);
+  }
+  return result;
+}
@@ -0,0 +1,78 @@
+/*
+ * MD5File.h
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#ifndef MD5FILE_H
+#define MD5FILE_H
+
+#include "MD5.h"
+
+/* File level operations built on the MD5 context that avoid reading a file
+ * more than once. */
+class MD5File {
+
+public:
+
+  static const size_t WINDOW_LEN = 1 << 23;   // bytes hashed then copied per step
+  static const size_t READ_LEN = 1 << 20;     // buffer for sources that can not be mapped
+  static const size_t HUGE_PAGE_LEN = 1 << 21;
+  static const size_t DIRECT_ALIGN = 4096;    // buffer and offset alignment for O_DIRECT
+
+  // option flags
+  static const int HUGE_PAGES = 1;   // back buffers and mappings with 2 MiB pages when available
+  static const int DIRECT = 2;       // read around the page cache, see read_all()
+
+  /* Copies src to dst and stores the MD5 hash of the copied bytes in hash
+   * (17 element array). Regular files are mapped and hashed from the page
+   * cache, then transferred with copy_file_range() so the data never passes
+   * through user space a second time. Other sources are read once into a
+   * buffer that feeds both the hash and the write. Returns false on error,
+   * leaving a null hash. */
+  static bool copy(const char *src, const char *dst, unsigned char *hash, int flags = 0);
+
+  /* Hashes an open file from its current position. Regular files are mapped
+   * and hashed in place, anything else is read through a READ_LEN buffer.
+   * With DIRECT regular files are read instead of mapped so the page cache
+   * is left as it was. Returns false on error, leaving a null hash. */
+  static bool make_hash(int fd, unsigned char *hash, int flags = 0);
+
+  /* Hashes the file at path reading through the caller's buffer, so callers
+   * control where the buffer lives. DIRECT reads need a DIRECT_ALIGN aligned
+   * buffer to bypass the cache. Returns false on error, leaving a null hash. */
+  static bool make_hash(const char *path, unsigned char *hash, char *buffer, size_t len, int flags = 0);
+
+  /* Anonymous read buffer of at least len bytes, len is updated to the size
+   * allocated. With HUGE_PAGES the buffer comes from the hugetlb pool, or
+   * failing that a 2 MiB aligned region advised for transparent huge pages.
+   * Returns NULL on failure. Release with free_buffer(). */
+  static char *alloc_buffer(size_t &len, int flags);
+  static void free_buffer(char *buffer, size_t len);
+
+private:
+
+  static bool copy_mapped(const char *map, int src_fd, int dst_fd, size_t len, MD5 &context);
+  static bool copy_buffered(int src_fd, int dst_fd, MD5 &context, int flags);
+  static bool read_all(int fd, MD5 &context, char *buffer, size_t len, int flags);
+  static bool write_all(int fd, const char *data, size_t len);
+
+};
+#endif
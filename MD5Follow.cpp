@@ -0,0 +1,164 @@
+/*
+ * MD5Follow.cpp
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include "MD5Follow.h"
+
+MD5Follow::MD5Follow(void)
+{
+  fd = -1;
+  inotify_fd = -1;
+  offset = 0;
+  truncated = false;
+}
+
+MD5Follow::~MD5Follow(void)
+{
+  close();
+}
+
+bool MD5Follow::open(const char *path)
+{
+  close();
+  this->fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (this->fd < 0)
+  {
+    perror("Failed to open file.\n");
+    return false;
+  }
+  this->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if ((this->inotify_fd >= 0) && (inotify_add_watch(this->inotify_fd, path, IN_MODIFY | IN_ATTRIB) < 0))
+  {
+    ::close(this->inotify_fd);
+    this->inotify_fd = -1;
+  }
+  this->buffer.resize(READ_LEN);
+  return update();
+}
+
+void MD5Follow::close(void)
+{
+  if (this->fd >= 0)
+  {
+    ::close(this->fd);
+    this->fd = -1;
+  }
+  if (this->inotify_fd >= 0)
+  {
+    ::close(this->inotify_fd);
+    this->inotify_fd = -1;
+  }
+  this->context.init();
+  this->offset = 0;
+  this->truncated = false;
+}
+
+bool MD5Follow::update(void)
+{
+  struct stat st;
+  if ((this->fd < 0) || this->truncated || (fstat(this->fd, &st) != 0))
+  {
+    return false;
+  }
+  if ((uint64_t) st.st_size < this->offset)
+  {
+    this->truncated = true;
+    return false;
+  }
+  // pread from offset, a writer racing the read only adds bytes for the next call
+  while (this->offset < (uint64_t) st.st_size)
+  {
+    ssize_t n = pread(this->fd, &this->buffer[0], READ_LEN, this->offset);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      perror("Failed to read from file.\n");
+      return false;
+    }
+    if (n == 0)
+    {
+      break;
+    }
+    this->context.update(&this->buffer[0], n);
+    this->offset += n;
+  }
+  return true;
+}
+
+bool MD5Follow::wait(int timeout_ms, const sigset_t *sigmask)
+{
+  if (this->fd < 0)
+  {
+    return false;
+  }
+  struct timespec ts;
+  ts.tv_sec = timeout_ms / 1000;
+  ts.tv_nsec = (long) (timeout_ms % 1000) * 1000000;
+  if (this->inotify_fd < 0)
+  {
+    // no inotify, check the size once per timeout (or once a second)
+    if (timeout_ms < 0)
+    {
+      ts.tv_sec = 1;
+      ts.tv_nsec = 0;
+    }
+    if ((ppoll(NULL, 0, &ts, sigmask) < 0) && (errno == EINTR))
+    {
+      return true;
+    }
+    return update();
+  }
+
+  struct pollfd pfd;
+  pfd.fd = this->inotify_fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  int n = ppoll(&pfd, 1, (timeout_ms < 0) ? NULL : &ts, sigmask);
+  if (n < 0)
+  {
+    return (errno == EINTR);
+  }
+  if (n == 0)
+  {
+    return true;
+  }
+  // events only say the file changed, drain them and read from the file
+  char events[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  while (read(this->inotify_fd, events, sizeof(events)) > 0)
+  {
+  }
+  return update();
+}
+
+void MD5Follow::digest(unsigned char *hash) const
+{
+  this->context.checkpoint(hash);
+}
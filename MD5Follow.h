@@ -0,0 +1,77 @@
+/*
+ * MD5Follow.h
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#ifndef MD5FOLLOW_H
+#define MD5FOLLOW_H
+
+#include <signal.h>
+#include <stdint.h>
+#include <vector>
+#include "MD5.h"
+
+/* Running MD5 of an append-only file such as a log. The context stays open
+ * across calls: update() transforms only the bytes appended since the last
+ * call and digest() finalizes a copy, so publishing the digest of the
+ * current prefix costs O(new bytes) instead of rehashing from byte 0.
+ * Appends are detected with inotify; without it wait() falls back to
+ * polling the file size. A file that shrinks is no longer append-only and
+ * update() fails from then on. */
+class MD5Follow {
+
+  int fd;
+  int inotify_fd;
+  MD5 context;
+  uint64_t offset;          // bytes hashed so far
+  bool truncated;
+  vector<char> buffer;
+
+public:
+
+  static const size_t READ_LEN = 1 << 20;
+
+  MD5Follow(void);
+  ~MD5Follow(void);
+
+  /* Opens path and hashes its current content */
+  bool open(const char *path);
+  void close(void);
+
+  /* Hashes bytes appended since the last call. Returns false on a read
+   * error or when the file was truncated. */
+  bool update(void);
+
+  /* Blocks up to timeout_ms (-1 forever) until the file is written, then
+   * calls update(). Returns true with nothing new on timeout or when
+   * interrupted by a signal. A given sigmask replaces the signal mask for
+   * the wait only, as in ppoll(), so a caller that blocks its signals and
+   * checks for them before waiting can not miss one arriving in between. */
+  bool wait(int timeout_ms, const sigset_t *sigmask = NULL);
+
+  /* Hash (17 element array) of the bytes hashed so far, the context stays open */
+  void digest(unsigned char *hash) const;
+
+  uint64_t length(void) const { return this->offset; }
+  bool was_truncated(void) const { return this->truncated; }
+
+};
+#endif
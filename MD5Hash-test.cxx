@@ -39,7 +39,8 @@
 #include <iostream>
 #include <time.h>
 #include <string.h>
-#include "MD5Hash.h"
+#include "MD5HashArena.h"
+#include "MD5RunStats.h"
 
 // Function declarations
 void MDString(const char *);
@@ -48,6 +49,8 @@ void MDTestSuite(void);
 void MDFile(const char *);
 void MDFilter(FILE *);
 void MDPrint(const char *);
+void MDTimedHash(FILE *, unsigned char *);
+uint64_t MDLap(MD5RunStats::Phase, uint64_t);
 
 
 static const char HELP[] = "\
@@ -56,6 +59,8 @@ Arguments (may be any combination):\n\
 \t-t        - runs time trial\n\
 \t-x        - runs test script\n\
 \t-h        - print this message\n\
+\t--stats   - prints per phase latency, throughput and slowest files at exit\n\
+\t--stats-json file - writes the --stats report to file as JSON\n\
 \tfilename  - digests file\n\
 \t(none)    - digests standard input\n\
 ";
@@ -68,6 +73,10 @@ static const int OUTPUT_LEN = 1024; // limit memory usage for output buffers
 // char buffer for formatting output
 char *output = NULL;
 
+// optional run statistics, enabled by --stats or --stats-json
+MD5RunStats *stats = NULL;
+const char *stats_json = NULL;
+
 int main(int argc, char **argv)
 {
   output = (char*) calloc(OUTPUT_LEN, sizeof(char));
@@ -98,6 +107,21 @@ int main(int argc, char **argv)
       {
         MDPrint(HELP);
       }
+      else if (strcmp(argv[i], "--stats") == 0)
+      {
+        if (stats == NULL)
+        {
+          stats = new MD5RunStats();
+        }
+      }
+      else if ((strcmp(argv[i], "--stats-json") == 0) && (i + 1 < argc))
+      {
+        if (stats == NULL)
+        {
+          stats = new MD5RunStats();
+        }
+        stats_json = argv[++i];
+      }
       else
       {
         MDFile(argv[i]);
@@ -108,6 +132,18 @@ int main(int argc, char **argv)
   {
     MDFilter(stdin);
   }
+  if (stats != NULL)
+  {
+    if (stats_json == NULL)
+    {
+      stats->print(stderr);
+    }
+    else if (!stats->write_json(stats_json))
+    {
+      perror("Failed to write stats.\n");
+    }
+    delete stats;
+  }
   if (output != NULL)
   {
     free(output);
@@ -193,6 +229,23 @@ void MDTestSuite(void)
   MDString("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789");
   MDString("12345678901234567890123456789012345678901234567890123456789012345678901234567890");
 
+  // lengths around the 448 bit length field of the final block
+  static const size_t PAD_LENS[] = { 55, 56, 57, 63, 64 };
+  static const char *PAD_DIGESTS[] = { "ef1772b6dff9a122358552954ad0df65",
+                                       "3b0c8ac703f828b04c6c197006d17218",
+                                       "652b906d60af96844ebd21b674f35e93",
+                                       "b06521f39153d618550606be297466d5",
+                                       "014842d480b571495a4a0363793f7367" };
+  char a_block[64];
+  memset(a_block, 'a', sizeof(a_block));
+  for (size_t i = 0; i < sizeof(PAD_LENS) / sizeof(PAD_LENS[0]); i++)
+  {
+    MD5Hash pad_hash = MD5Hash::make_MD5Hash(a_block, PAD_LENS[i]);
+    snprintf(output, OUTPUT_LEN, "MD5 (%zu x \"a\") = %s %s\n", PAD_LENS[i], pad_hash.c_str(),
+             (strcmp(pad_hash.c_str(), PAD_DIGESTS[i]) == 0) ? "ok" : "FAILED");
+    MDPrint(output);
+  }
+
   char str1[] = "message digest";
   char str2[] = "message digesu";
   char str3[] = "";
@@ -222,14 +275,40 @@ void MDTestSuite(void)
   MDPrint(output);
   snprintf(output, OUTPUT_LEN, "hash1 != hash6 := %d\n", hash1 != hash6);
   MDPrint(output);
+
+  MD5HashArena arena;
+  MD5HashVector hashes(arena);
+  hashes.append(str1, strlen(str1));
+  hashes.append(str2, strlen(str2));
+  hashes.append(string(str3));
+  for (size_t i = 0; i < hashes.size(); i++)
+  {
+    snprintf(output, OUTPUT_LEN, "hashes[%zu] = %.32s\n", i, hashes.hex(i));
+    MDPrint(output);
+  }
+  snprintf(output, OUTPUT_LEN, "hashes[0] == hash1 := %d\n", hashes.at(0) == hash1);
+  MDPrint(output);
+  size_t before = hashes.size();
+  bool rolled_back = (hashes.append((FILE *) NULL) == NULL) && (hashes.size() == before);
+  snprintf(output, OUTPUT_LEN, "append(unreadable) rolled back := %d\n", rolled_back);
+  MDPrint(output);
 }
 
 /* Digests a file and prints the result */
 void MDFile(const char *filename)
 {
   FILE *f;
+  uint64_t t = 0;
 
-  if ((f = fopen(filename, "rb")) == NULL)
+  if (stats != NULL)
+  {
+    stats->begin_file(filename);
+    t = MD5RunStats::now();
+  }
+  f = fopen(filename, "rb");
+  t = MDLap(MD5RunStats::OPEN, t);
+
+  if (f == NULL)
   {
     snprintf(output, OUTPUT_LEN, "Unable to open file %s\n", filename);
     MDPrint(output);
@@ -238,20 +317,76 @@ void MDFile(const char *filename)
   {
     snprintf(output, OUTPUT_LEN, "MD5 (%s) = ", filename);
     MDPrint(output);
+    MDLap(MD5RunStats::PRINT, t);
     MDFilter(f);
+    fclose(f);
+  }
+  if (stats != NULL)
+  {
+    stats->end_file();
   }
 }
 
 /* Digests a FILE stream and prints the result */
 void MDFilter(FILE *f)
 {
-  MD5Hash hash = MD5Hash::make_MD5Hash(f);
+  MD5Hash hash;
+  uint64_t t = 0;
+  if (stats != NULL)
+  {
+    unsigned char raw[MD5::HASH_LEN + 1];
+    memset(raw, '\0', sizeof(raw));
+    MDTimedHash(f, raw);
+    hash = MD5Hash(raw);
+    t = MD5RunStats::now();
+  }
+  else
+  {
+    hash = MD5Hash::make_MD5Hash(f);
+  }
   snprintf(output, OUTPUT_LEN, "%s\n", hash.c_str());
   MDPrint(output);
+  MDLap(MD5RunStats::PRINT, t);
+}
+
+/* Digests a FILE stream charging read and transform time to --stats */
+void MDTimedHash(FILE *f, unsigned char *hash)
+{
+  MD5 context;
+  char buffer[BUFSIZ << 3];
+  size_t bytes_read = 0;
+  uint64_t t = MD5RunStats::now();
+
+  while ((bytes_read = fread(buffer, 1, sizeof(buffer), f)) > 0)
+  {
+    t = MDLap(MD5RunStats::READ, t);
+    stats->add_bytes(bytes_read);
+    context.update(buffer, bytes_read);
+    t = MDLap(MD5RunStats::TRANSFORM, t);
+  }
+  if (ferror(f))
+  {
+    perror("Failed to read from file.\n");
+    return;
+  }
+  context.finish(hash);
+  MDLap(MD5RunStats::TRANSFORM, t);
+}
+
+/* Charges the time since 'since' to a --stats phase and returns the current time */
+uint64_t MDLap(MD5RunStats::Phase phase, uint64_t since)
+{
+  if (stats == NULL)
+  {
+    return 0;
+  }
+  uint64_t t = MD5RunStats::now();
+  stats->add(phase, t - since);
+  return t;
 }
 
 /* Prints to standard output */
 void MDPrint(const char *c_string)
 {
-  printf(c_string);
+  fputs(c_string, stdout);
 }
@@ -31,6 +31,7 @@ MD5Hash::MD5Hash(void)
 
 MD5Hash::MD5Hash(const MD5Hash &obj)
 {
+  c_string = NULL;
   for(int i = 0; i < MD5::HASH_LEN; i++)
   {
     this->hash[i] = obj.hash[i];
@@ -43,6 +44,8 @@ MD5Hash::MD5Hash(const MD5Hash &obj)
 
 MD5Hash::MD5Hash(const unsigned char *hash)
 {
+  c_string = NULL;
+  memset(this->hash, '\0', MD5::HASH_LEN + 1);
   if (hash != NULL)
   {
     for(int i = 0; i < MD5::HASH_LEN; i++)
@@ -102,18 +105,17 @@ bool MD5Hash::operator!=(const MD5Hash &rhs)
 
 char *MD5Hash::c_str(void)
 {
-  this->c_string = (char *) calloc(MD5::DIGEST_LEN + 1, sizeof(char));
+  if (this->c_string == NULL)
+  {
+    this->c_string = (char *) calloc(MD5::DIGEST_LEN + 1, sizeof(char));
+  }
   MD5::make_digest(this->hash, this->c_string);
   return this->c_string;
 }
 
 string MD5Hash::to_string(void)
 {
-  if (this->c_string == NULL)
-  {
-    c_str();
-  }
-  return string(this->c_string);
+  return string(c_str());
 }
 
 MD5Hash MD5Hash::make_MD5Hash(const char *data, size_t len)
@@ -137,6 +139,13 @@ MD5Hash MD5Hash::make_MD5Hash(FILE *f)
   return obj;
 }
 
+MD5Hash MD5Hash::make_MD5Hash(const struct iovec *iov, int iovcnt)
+{
+  MD5Hash obj;
+  MD5::make_hash(iov, iovcnt, obj.hash);
+  return obj;
+}
+
 MD5Hash MD5Hash::make_MD5Hash(const string &data)
 {
   MD5Hash obj;
@@ -21,6 +21,9 @@
  *
  */
 
+#ifndef MD5HASH_H
+#define MD5HASH_H
+
 #include "MD5.h"
 
 using namespace std;
@@ -54,5 +57,7 @@ public:
   static MD5Hash make_MD5Hash(const void *data, size_t len);
   static MD5Hash make_MD5Hash(const string &data);
   static MD5Hash make_MD5Hash(FILE *f);
+  static MD5Hash make_MD5Hash(const struct iovec *iov, int iovcnt);
 
 };
+#endif
@@ -0,0 +1,191 @@
+/*
+ * MD5HashArena.cpp
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <stdlib.h>
+#include "MD5HashArena.h"
+
+MD5HashArena::MD5HashArena(size_t chunk_len)
+{
+  this->head = NULL;
+  this->chunk_len = chunk_len;
+  this->total = 0;
+}
+
+MD5HashArena::~MD5HashArena(void)
+{
+  release();
+}
+
+void *MD5HashArena::alloc(size_t len)
+{
+  len = (len + ALIGN - 1) & ~(ALIGN - 1);
+
+  if ((this->head == NULL) || (this->head->size - this->head->used < len))
+  {
+    // chunk header is padded to ALIGN so the first allocation is aligned
+    size_t header = (sizeof(Chunk) + ALIGN - 1) & ~(ALIGN - 1);
+    size_t size = (len > this->chunk_len) ? len : this->chunk_len;
+    void *mem = NULL;
+    if (posix_memalign(&mem, ALIGN, header + size) != 0)
+    {
+      return NULL;
+    }
+    Chunk *chunk = (Chunk *) mem;
+    chunk->next = this->head;
+    chunk->used = header;
+    chunk->size = header + size;
+    this->head = chunk;
+    this->total += header + size;
+  }
+
+  void *ptr = (char *) this->head + this->head->used;
+  this->head->used += len;
+  return ptr;
+}
+
+void MD5HashArena::release(void)
+{
+  while (this->head != NULL)
+  {
+    Chunk *next = this->head->next;
+    free(this->head);
+    this->head = next;
+  }
+  this->total = 0;
+}
+
+MD5HashVector::MD5HashVector(MD5HashArena &arena) : arena(arena)
+{
+  this->count = 0;
+  this->formatted = 0;
+}
+
+unsigned char *MD5HashVector::next_slot(void)
+{
+  size_t offset = this->count % SLOTS_PER_RUN;
+  size_t run = this->count / SLOTS_PER_RUN;
+
+  if ((offset == 0) && (run == this->runs.size()))
+  {
+    unsigned char *slots = (unsigned char *) this->arena.alloc(SLOTS_PER_RUN * MD5::HASH_LEN);
+    if (slots == NULL)
+    {
+      return NULL;
+    }
+    this->runs.push_back(slots);
+  }
+  this->count++;
+  return this->runs[run] + offset * MD5::HASH_LEN;
+}
+
+unsigned char *MD5HashVector::append(const char *data, size_t len)
+{
+  unsigned char *slot = next_slot();
+  if (slot != NULL)
+  {
+    MD5 context(len);
+    context.finalize(data);
+    context.store(slot);
+  }
+  return slot;
+}
+
+unsigned char *MD5HashVector::append(const void *data, size_t len)
+{
+  return append((const char *) data, len);
+}
+
+unsigned char *MD5HashVector::append(const string &data)
+{
+  return append(data.c_str(), data.length());
+}
+
+unsigned char *MD5HashVector::append(FILE *f)
+{
+  // hash before claiming a slot so a failed read leaves the vector unchanged
+  MD5 context;
+  unsigned char hash[MD5::HASH_LEN + 1];
+  char buffer[BUFSIZ];
+  size_t bytes_read = 0;
+  while ((f != NULL) && ((bytes_read = fread(buffer, 1, sizeof(buffer), f)) > 0))
+  {
+    context.update(buffer, bytes_read);
+  }
+  if ((f == NULL) || ferror(f))
+  {
+    perror("Failed to read from file.\n");
+    return NULL;
+  }
+  context.finish(hash);
+  unsigned char *slot = next_slot();
+  if (slot != NULL)
+  {
+    memcpy(slot, hash, MD5::HASH_LEN);
+  }
+  return slot;
+}
+
+MD5Hash MD5HashVector::at(size_t i)
+{
+  return MD5Hash((*this)[i]);
+}
+
+const char *MD5HashVector::hex(size_t i)
+{
+  if (i >= this->formatted)
+  {
+    format();
+    if (i >= this->formatted)
+    {
+      return NULL;
+    }
+  }
+  return this->hex_runs[i / SLOTS_PER_RUN] + (i % SLOTS_PER_RUN) * MD5::DIGEST_LEN;
+}
+
+void MD5HashVector::format(void)
+{
+  while (this->hex_runs.size() < this->runs.size())
+  {
+    char *digests = (char *) this->arena.alloc(SLOTS_PER_RUN * MD5::DIGEST_LEN);
+    if (digests == NULL)
+    {
+      return;
+    }
+    this->hex_runs.push_back(digests);
+  }
+  for (size_t i = this->formatted; i < this->count; i++)
+  {
+    MD5::make_digest((*this)[i],
+      this->hex_runs[i / SLOTS_PER_RUN] + (i % SLOTS_PER_RUN) * MD5::DIGEST_LEN);
+  }
+  this->formatted = this->count;
+}
+
+void MD5HashVector::clear(void)
+{
+  this->runs.clear();
+  this->hex_runs.clear();
+  this->count = 0;
+  this->formatted = 0;
+}
@@ -0,0 +1,118 @@
+/*
+ * MD5HashArena.h
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#ifndef MD5HASHARENA_H
+#define MD5HASHARENA_H
+
+#include <vector>
+#include "MD5Hash.h"
+
+/* Bump allocator for bulk hash results. Memory is carved from large chunks
+ * and is only returned all at once by release() or the destructor. */
+class MD5HashArena {
+
+  struct Chunk {
+    Chunk *next;
+    size_t used;
+    size_t size;
+  };
+
+  Chunk *head;        // chunk currently being carved, links to older chunks
+  size_t chunk_len;   // default chunk size
+  size_t total;       // bytes reserved from the heap
+
+public:
+
+  static const size_t CHUNK_LEN = 1 << 20;
+  static const size_t ALIGN = 16;
+
+  MD5HashArena(size_t chunk_len = CHUNK_LEN);
+  ~MD5HashArena(void);
+
+  /* Returns len bytes aligned to ALIGN, NULL if the heap is exhausted */
+  void *alloc(size_t len);
+
+  /* Frees every chunk. Pointers handed out by alloc() are invalidated. */
+  void release(void);
+
+  /* Bytes reserved from the heap */
+  size_t bytes(void) { return total; }
+
+private:
+
+  MD5HashArena(const MD5HashArena &);
+  MD5HashArena& operator=(const MD5HashArena &);
+
+};
+
+/* Packed sequence of hashes in 16 byte slots allocated from a MD5HashArena.
+ * Slots are allocated in runs of SLOTS_PER_RUN so indexing stays O(1). An
+ * optional hex region holds DIGEST_LEN chars per slot (not null terminated)
+ * and is only allocated once formatting is requested. */
+class MD5HashVector {
+
+  MD5HashArena &arena;
+  vector<unsigned char *> runs;   // hash slots, SLOTS_PER_RUN per entry
+  vector<char *> hex_runs;        // hex slots, parallel to runs when formatted
+  size_t count;
+  size_t formatted;               // slots below this index have hex in hex_runs
+
+public:
+
+  static const size_t SLOTS_PER_RUN = 1 << 14;
+
+  MD5HashVector(MD5HashArena &arena);
+
+  /* Hash data straight into the next slot, returns the slot or NULL if the
+   * arena is exhausted. append(FILE *) also returns NULL, without adding a
+   * slot, when the file can not be read. */
+  unsigned char *append(const char *data, size_t len);
+  unsigned char *append(const void *data, size_t len);
+  unsigned char *append(const string &data);
+  unsigned char *append(FILE *f);
+
+  /* 16 byte hash in slot i */
+  const unsigned char *operator[](size_t i) { return runs[i / SLOTS_PER_RUN] + (i % SLOTS_PER_RUN) * MD5::HASH_LEN; }
+
+  /* Copy of slot i as a MD5Hash */
+  MD5Hash at(size_t i);
+
+  /* Human readable hash of slot i in the packed hex region. Returns DIGEST_LEN
+   * chars without a terminating null, use "%.32s" to print. NULL if the
+   * arena is exhausted. */
+  const char *hex(size_t i);
+
+  /* Formats every slot into the hex region */
+  void format(void);
+
+  size_t size(void) { return count; }
+
+  /* Forgets all slots. Memory stays with the arena until it is released. */
+  void clear(void);
+
+private:
+
+  unsigned char *next_slot(void);
+
+};
+#endif
@@ -0,0 +1,429 @@
+/*
+ * MD5HashSet.cpp
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "MD5HashSet.h"
+
+const char MD5HashSet::MAGIC[8] = {'M', 'D', '5', 'H', 'S', 'E', 'T', '\0'};
+
+static const int PARTITIONS = 256;   // first byte radix for build()
+
+struct MDRawHash {
+  unsigned char b[MD5::HASH_LEN];
+  bool operator<(const MDRawHash &o) const { return memcmp(b, o.b, MD5::HASH_LEN) < 0; }
+  bool operator==(const MDRawHash &o) const { return memcmp(b, o.b, MD5::HASH_LEN) == 0; }
+};
+
+MD5HashSet::MD5HashSet(void)
+{
+  fd = -1;
+  map = NULL;
+  map_len = 0;
+  memset(&header, '\0', sizeof(header));
+  index = NULL;
+  bloom = NULL;
+  hashes = NULL;
+}
+
+MD5HashSet::~MD5HashSet(void)
+{
+  close();
+}
+
+/* Leading 64 bits of a hash, most significant first, so order matches memcmp */
+uint64_t MD5HashSet::prefix(const unsigned char *hash)
+{
+  uint64_t x = 0;
+  for (int i = 0; i < 8; i++)
+  {
+    x = (x << 8) | hash[i];
+  }
+  return x;
+}
+
+/* Converts between host order and the little endian words of the file */
+static inline uint64_t MDLittle(uint64_t x)
+{
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  return __builtin_bswap64(x);
+#else
+  return x;
+#endif
+}
+
+/* Stores or loads the header fields, integers little endian, at their
+ * offsets in the Header struct */
+static void MDStore(unsigned char *p, uint64_t x, int bytes)
+{
+  for (int i = 0; i < bytes; i++)
+  {
+    p[i] = (unsigned char) (x >> (8 * i));
+  }
+}
+
+static uint64_t MDLoad(const unsigned char *p, int bytes)
+{
+  uint64_t x = 0;
+  for (int i = bytes - 1; i >= 0; i--)
+  {
+    x = (x << 8) | p[i];
+  }
+  return x;
+}
+
+static void MDEncodeHeader(const MD5HashSet::Header &h, unsigned char *p)
+{
+  memcpy(p, h.magic, sizeof(h.magic));
+  MDStore(p + 8, h.version, 4);
+  MDStore(p + 12, h.index_bits, 4);
+  MDStore(p + 16, h.count, 8);
+  MDStore(p + 24, h.bloom_blocks, 8);
+  MDStore(p + 32, h.index_offset, 8);
+  MDStore(p + 40, h.bloom_offset, 8);
+  MDStore(p + 48, h.hash_offset, 8);
+  memcpy(p + 56, h.reserved, sizeof(h.reserved));
+}
+
+static void MDDecodeHeader(const unsigned char *p, MD5HashSet::Header &h)
+{
+  memcpy(h.magic, p, sizeof(h.magic));
+  h.version = MDLoad(p + 8, 4);
+  h.index_bits = MDLoad(p + 12, 4);
+  h.count = MDLoad(p + 16, 8);
+  h.bloom_blocks = MDLoad(p + 24, 8);
+  h.index_offset = MDLoad(p + 32, 8);
+  h.bloom_offset = MDLoad(p + 40, 8);
+  h.hash_offset = MDLoad(p + 48, 8);
+  memcpy(h.reserved, p + 56, sizeof(h.reserved));
+}
+
+/* Hashes are uniform, so the filter takes its block from the high half and
+ * its bit positions from the low half instead of rehashing */
+static void MDBloomBits(const unsigned char *hash, uint64_t blocks, uint64_t &block, int *bits)
+{
+  uint64_t hi = 0, lo = 0;
+  for (int i = 0; i < 8; i++)
+  {
+    hi = (hi << 8) | hash[i];
+    lo = (lo << 8) | hash[i + 8];
+  }
+  block = (uint64_t) (((unsigned __int128) hi * blocks) >> 64);
+  for (int k = 0; k < MD5HashSet::BLOOM_K; k++)
+  {
+    bits[k] = (lo >> (9 * k)) & 511;
+  }
+}
+
+/* Parses the first run of exactly 32 hex digits in line */
+static bool MDParseHex(const char *line, unsigned char *hash)
+{
+  for (const char *p = line; *p != '\0'; p++)
+  {
+    int n = 0;
+    while (isxdigit((unsigned char) p[n]))
+    {
+      n++;
+    }
+    if (n == MD5::DIGEST_LEN)
+    {
+      for (int i = 0; i < MD5::HASH_LEN; i++)
+      {
+        char pair[3] = { p[2 * i], p[2 * i + 1], '\0' };
+        hash[i] = (unsigned char) strtoul(pair, NULL, 16);
+      }
+      return true;
+    }
+    if (n > 0)
+    {
+      p += n - 1;
+    }
+  }
+  return false;
+}
+
+bool MD5HashSet::build(const char *list, const char *path, int bloom_bits)
+{
+  FILE *in = fopen(list, "r");
+  if (in == NULL)
+  {
+    perror("Failed to open hash list.\n");
+    return false;
+  }
+
+  // pass 1: partition by first byte into temporary files
+  string base = string(path) + ".part.";
+  FILE *parts[PARTITIONS];
+  bool result = true;
+  for (int i = 0; i < PARTITIONS; i++)
+  {
+    parts[i] = fopen((base + std::to_string(i)).c_str(), "w+b");
+    result = result && (parts[i] != NULL);
+  }
+  char line[4096];
+  MDRawHash h;
+  uint64_t parsed = 0;
+  while (result && (fgets(line, sizeof(line), in) != NULL))
+  {
+    if (MDParseHex(line, h.b))
+    {
+      result = fwrite(h.b, MD5::HASH_LEN, 1, parts[h.b[0]]) == 1;
+      parsed++;
+    }
+  }
+  fclose(in);
+
+  // the index and filter are sized from the parsed count; duplicates only shrink buckets
+  Header header;
+  memset(&header, '\0', sizeof(header));
+  memcpy(header.magic, MAGIC, sizeof(header.magic));
+  header.version = VERSION;
+  header.index_bits = 1;
+  while ((header.index_bits < 32) && (((uint64_t) BUCKET_FILL << header.index_bits) < parsed))
+  {
+    header.index_bits++;
+  }
+  header.bloom_blocks = (bloom_bits > 0) ? (parsed * bloom_bits + 511) / 512 : 0;
+  header.index_offset = HEADER_LEN;
+  header.bloom_offset = header.index_offset + (((uint64_t) 1 << header.index_bits) + 1) * sizeof(uint64_t);
+  header.bloom_offset = (header.bloom_offset + 63) & ~(uint64_t) 63;
+  header.hash_offset = header.bloom_offset + header.bloom_blocks * 64;
+
+  string tmp = string(path) + ".tmp";
+  int out = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  result = result && (out >= 0);
+  vector<uint64_t> index(((size_t) 1 << header.index_bits) + 1, 0);
+  vector<uint64_t> bloom(header.bloom_blocks * 8, 0);
+  uint64_t count = 0;
+  vector<MDRawHash> partition;
+
+  // pass 2: sort and dedup each partition, appending to the hash array
+  for (int i = 0; result && (i < PARTITIONS); i++)
+  {
+    long len = ftell(parts[i]);
+    partition.resize(len / MD5::HASH_LEN);
+    rewind(parts[i]);
+    if (fread(partition.data(), MD5::HASH_LEN, partition.size(), parts[i]) != partition.size())
+    {
+      result = false;
+      break;
+    }
+    sort(partition.begin(), partition.end());
+    partition.erase(unique(partition.begin(), partition.end()), partition.end());
+    for (size_t j = 0; j < partition.size(); j++)
+    {
+      index[(prefix(partition[j].b) >> (64 - header.index_bits)) + 1]++;
+      if (header.bloom_blocks > 0)
+      {
+        uint64_t block = 0;
+        int bits[BLOOM_K];
+        MDBloomBits(partition[j].b, header.bloom_blocks, block, bits);
+        for (int k = 0; k < BLOOM_K; k++)
+        {
+          bloom[block * 8 + (bits[k] >> 6)] |= (uint64_t) 1 << (bits[k] & 63);
+        }
+      }
+    }
+    size_t bytes = partition.size() * MD5::HASH_LEN;
+    result = (size_t) pwrite(out, partition.data(), bytes, header.hash_offset + count * MD5::HASH_LEN) == bytes;
+    count += partition.size();
+  }
+  for (size_t i = 1; i < index.size(); i++)
+  {
+    index[i] += index[i - 1];
+  }
+  header.count = count;
+  for (size_t i = 0; i < index.size(); i++)
+  {
+    index[i] = MDLittle(index[i]);
+  }
+  for (size_t i = 0; i < bloom.size(); i++)
+  {
+    bloom[i] = MDLittle(bloom[i]);
+  }
+  unsigned char raw[HEADER_LEN];
+  MDEncodeHeader(header, raw);
+
+  for (int i = 0; i < PARTITIONS; i++)
+  {
+    if (parts[i] != NULL)
+    {
+      fclose(parts[i]);
+    }
+    unlink((base + std::to_string(i)).c_str());
+  }
+  if (out >= 0)
+  {
+    size_t index_len = index.size() * sizeof(uint64_t);
+    size_t bloom_len = bloom.size() * sizeof(uint64_t);
+    result = result &&
+             (pwrite(out, raw, sizeof(raw), 0) == (ssize_t) sizeof(raw)) &&
+             ((size_t) pwrite(out, index.data(), index_len, header.index_offset) == index_len) &&
+             ((size_t) pwrite(out, bloom.data(), bloom_len, header.bloom_offset) == bloom_len) &&
+             (ftruncate(out, header.hash_offset + count * MD5::HASH_LEN) == 0);
+    result = (::close(out) == 0) && result && (rename(tmp.c_str(), path) == 0);
+  }
+  if (!result)
+  {
+    perror("Failed to build hash set.\n");
+    unlink(tmp.c_str());
+  }
+  return result;
+}
+
+bool MD5HashSet::open(const char *path)
+{
+  close();
+  this->fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (this->fd < 0)
+  {
+    perror("Failed to open hash set.\n");
+    return false;
+  }
+  // sizes are compared by division, so forged fields can not wrap around
+  struct stat st;
+  unsigned char raw[HEADER_LEN];
+  Header h;
+  bool ok = (fstat(this->fd, &st) == 0) &&
+            (pread(this->fd, raw, sizeof(raw), 0) == (ssize_t) sizeof(raw));
+  MDDecodeHeader(raw, h);
+  uint64_t file_len = ok ? st.st_size : 0;
+  ok = ok && (memcmp(h.magic, MAGIC, sizeof(h.magic)) == 0) && (h.version == VERSION) &&
+       (h.index_bits > 0) && (h.index_bits <= 32) &&
+       (h.index_offset >= HEADER_LEN) && (h.index_offset % 8 == 0) && (h.index_offset <= file_len) &&
+       ((((uint64_t) 1 << h.index_bits) + 1) <= (file_len - h.index_offset) / 8) &&
+       (h.bloom_offset >= h.index_offset + (((uint64_t) 1 << h.index_bits) + 1) * 8) &&
+       (h.bloom_offset % 64 == 0) && (h.bloom_offset <= file_len) &&
+       (h.bloom_blocks <= (file_len - h.bloom_offset) / 64) &&
+       (h.bloom_offset + h.bloom_blocks * 64 == h.hash_offset) &&
+       (h.count <= (file_len - h.hash_offset) / MD5::HASH_LEN) &&
+       (file_len == h.hash_offset + h.count * MD5::HASH_LEN);
+  if (!ok)
+  {
+    fprintf(stderr, "Not a hash set: %s\n", path);
+    close();
+    return false;
+  }
+  this->map_len = st.st_size;
+  void *m = mmap(NULL, this->map_len, PROT_READ, MAP_SHARED, this->fd, 0);
+  if (m == MAP_FAILED)
+  {
+    perror("Failed to map hash set.\n");
+    close();
+    return false;
+  }
+  this->map = (const char *) m;
+  this->header = h;
+  this->index = (const uint64_t *) (this->map + h.index_offset);
+  this->bloom = (const uint64_t *) (this->map + h.bloom_offset);
+  this->hashes = (const unsigned char *) (this->map + h.hash_offset);
+
+  // lookups scan index[bucket] to index[bucket + 1] without checks
+  uint64_t last = 0;
+  for (uint64_t i = 0; i <= ((uint64_t) 1 << h.index_bits); i++)
+  {
+    uint64_t start = MDLittle(this->index[i]);
+    if ((start < last) || (start > h.count))
+    {
+      fprintf(stderr, "Not a hash set: %s\n", path);
+      close();
+      return false;
+    }
+    last = start;
+  }
+  madvise(m, this->map_len, MADV_RANDOM);
+  return true;
+}
+
+void MD5HashSet::close(void)
+{
+  if (this->map != NULL)
+  {
+    munmap((void *) this->map, this->map_len);
+  }
+  if (this->fd >= 0)
+  {
+    ::close(this->fd);
+  }
+  this->fd = -1;
+  this->map = NULL;
+  memset(&this->header, '\0', sizeof(this->header));
+}
+
+bool MD5HashSet::bloom_test(const unsigned char *hash) const
+{
+  uint64_t block = 0;
+  int bits[BLOOM_K];
+  MDBloomBits(hash, this->header.bloom_blocks, block, bits);
+  const uint64_t *words = this->bloom + block * 8;
+  for (int k = 0; k < BLOOM_K; k++)
+  {
+    if ((MDLittle(words[bits[k] >> 6]) & ((uint64_t) 1 << (bits[k] & 63))) == 0)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool MD5HashSet::contains(const unsigned char *hash) const
+{
+  if ((this->map == NULL) || (this->header.count == 0))
+  {
+    return false;
+  }
+  if ((this->header.bloom_blocks > 0) && !bloom_test(hash))
+  {
+    return false;
+  }
+  uint64_t bucket = prefix(hash) >> (64 - this->header.index_bits);
+  const unsigned char *p = this->hashes + MDLittle(this->index[bucket]) * MD5::HASH_LEN;
+  const unsigned char *end = this->hashes + MDLittle(this->index[bucket + 1]) * MD5::HASH_LEN;
+#ifdef __SSE2__
+  __m128i key = _mm_loadu_si128((const __m128i *) hash);
+  for (; p < end; p += MD5::HASH_LEN)
+  {
+    __m128i eq = _mm_cmpeq_epi8(key, _mm_loadu_si128((const __m128i *) p));
+    if (_mm_movemask_epi8(eq) == 0xffff)
+    {
+      return true;
+    }
+  }
+#else
+  for (; p < end; p += MD5::HASH_LEN)
+  {
+    if (memcmp(p, hash, MD5::HASH_LEN) == 0)
+    {
+      return true;
+    }
+  }
+#endif
+  return false;
+}
@@ -0,0 +1,99 @@
+/*
+ * MD5HashSet.h
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#ifndef MD5HASHSET_H
+#define MD5HASHSET_H
+
+#include <stdint.h>
+#include <string>
+#include "MD5.h"
+
+/* Read only set of known hashes (NSRL style reference lists) stored as a
+ * sorted array of raw 16 byte hashes in a file that is mapped at open, so
+ * start up costs no parsing or allocation. A prefix index maps the leading
+ * bits of a hash to its bucket of about BUCKET_FILL hashes, which is then
+ * scanned with SSE2 compares. An optional blocked Bloom filter in front
+ * answers most misses with a single cache line. build() sorts lists larger
+ * than memory by radix partitioning on the first byte through temporary
+ * files, then sorting each partition in memory. The header, index and
+ * filter words are stored little endian, the layout of the Header struct on
+ * such hosts, and are checked once at open so lookups trust them. */
+class MD5HashSet {
+
+public:
+
+  static const char MAGIC[8];
+  static const uint32_t VERSION = 1;
+  static const size_t BUCKET_FILL = 8;      // target hashes per index bucket, two cache lines
+  static const int BLOOM_K = 6;             // bits set per hash, all in one 64 byte block
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t index_bits;
+    uint64_t count;
+    uint64_t bloom_blocks;    // 64 byte blocks, 0 without a filter
+    uint64_t index_offset;    // (1 << index_bits) + 1 uint64_t bucket starts
+    uint64_t bloom_offset;
+    uint64_t hash_offset;     // count sorted hashes
+    char reserved[8];
+  };
+
+  static const size_t HEADER_LEN = 72;      // Header as stored in the file
+
+private:
+
+  int fd;
+  const char *map;
+  size_t map_len;
+  Header header;            // decoded at open
+  const uint64_t *index;
+  const uint64_t *bloom;
+  const unsigned char *hashes;
+
+public:
+
+  MD5HashSet(void);
+  ~MD5HashSet(void);
+
+  /* Builds a set file from a text list. Each line contributes the first run
+   * of 32 hex digits found in it, so md5sum output and CSV exports both
+   * work; other lines are skipped. Duplicates are dropped. bloom_bits is the
+   * filter size in bits per hash, 0 for none. */
+  static bool build(const char *list, const char *path, int bloom_bits = 10);
+
+  bool open(const char *path);
+  void close(void);
+
+  /* hash - 16 byte raw hash */
+  bool contains(const unsigned char *hash) const;
+
+  size_t size(void) const { return (this->map == NULL) ? 0 : this->header.count; }
+
+private:
+
+  bool bloom_test(const unsigned char *hash) const;
+  static uint64_t prefix(const unsigned char *hash);
+
+};
+#endif
@@ -0,0 +1,235 @@
+/*
+ * MD5Kernel.cpp
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/if_alg.h>
+#include "MD5Kernel.h"
+
+#ifndef AF_ALG
+#define AF_ALG 38
+#endif
+
+MD5Kernel::MD5Kernel(void)
+{
+  tfm_fd = -1;
+  op_fd = -1;
+  pipe_fd[0] = -1;
+  pipe_fd[1] = -1;
+}
+
+MD5Kernel::~MD5Kernel(void)
+{
+  close();
+}
+
+bool MD5Kernel::open(void)
+{
+  struct sockaddr_alg addr;
+  memset(&addr, '\0', sizeof(addr));
+  addr.salg_family = AF_ALG;
+  strcpy((char *) addr.salg_type, "hash");
+  strcpy((char *) addr.salg_name, "md5");
+
+  close();
+  this->tfm_fd = socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if ((this->tfm_fd < 0) || (bind(this->tfm_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0))
+  {
+    close();
+    return false;
+  }
+  this->op_fd = accept4(this->tfm_fd, NULL, NULL, SOCK_CLOEXEC);
+  if (this->op_fd < 0)
+  {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void MD5Kernel::close(void)
+{
+  int *fds[] = { &this->op_fd, &this->tfm_fd, &this->pipe_fd[0], &this->pipe_fd[1] };
+  for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++)
+  {
+    if (*fds[i] >= 0)
+    {
+      ::close(*fds[i]);
+      *fds[i] = -1;
+    }
+  }
+}
+
+bool MD5Kernel::update(const char *data, size_t len)
+{
+  if (this->op_fd < 0)
+  {
+    return false;
+  }
+  while (len > 0)
+  {
+    ssize_t n = send(this->op_fd, data, len, MSG_MORE);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      perror("Failed to send to AF_ALG socket.\n");
+      return false;
+    }
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool MD5Kernel::update(int fd)
+{
+  if (this->op_fd < 0)
+  {
+    return false;
+  }
+  if ((this->pipe_fd[0] < 0) && (pipe2(this->pipe_fd, O_CLOEXEC) != 0))
+  {
+    this->pipe_fd[0] = -1;
+    this->pipe_fd[1] = -1;
+  }
+
+  // file -> pipe -> socket, the pipe holds page references rather than copies
+  while (this->pipe_fd[0] >= 0)
+  {
+    ssize_t n = splice(fd, NULL, this->pipe_fd[1], NULL, SPLICE_LEN, SPLICE_F_MORE);
+    if (n == 0)
+    {
+      return true;
+    }
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      if ((errno == EINVAL) || (errno == ENOSYS))
+      {
+        break;   // not spliceable, nothing was consumed
+      }
+      perror("Failed to splice from file.\n");
+      return false;
+    }
+    while (n > 0)
+    {
+      ssize_t sent = splice(this->pipe_fd[0], NULL, this->op_fd, NULL, n, SPLICE_F_MORE);
+      if ((sent < 0) && (errno == EINTR))
+      {
+        continue;
+      }
+      if (sent <= 0)
+      {
+        perror("Failed to splice to AF_ALG socket.\n");
+        // drop what is left in the pipe so the next message starts clean
+        close();
+        return false;
+      }
+      n -= sent;
+    }
+  }
+
+  char buffer[SPLICE_LEN];
+  for (;;)
+  {
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n == 0)
+    {
+      return true;
+    }
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      perror("Failed to read from file.\n");
+      return false;
+    }
+    if (!update(buffer, n))
+    {
+      return false;
+    }
+  }
+}
+
+bool MD5Kernel::finish(unsigned char *hash)
+{
+  memset(hash, '\0', MD5::HASH_LEN + 1);
+  if (this->op_fd < 0)
+  {
+    return false;
+  }
+  // a send without MSG_MORE ends the message
+  while (send(this->op_fd, NULL, 0, 0) < 0)
+  {
+    if (errno != EINTR)
+    {
+      perror("Failed to send to AF_ALG socket.\n");
+      return false;
+    }
+  }
+  ssize_t n = 0;
+  while ((n = read(this->op_fd, hash, MD5::HASH_LEN)) < 0)
+  {
+    if (errno != EINTR)
+    {
+      break;
+    }
+  }
+  if (n != MD5::HASH_LEN)
+  {
+    perror("Failed to read from AF_ALG socket.\n");
+    memset(hash, '\0', MD5::HASH_LEN + 1);
+    return false;
+  }
+  return true;
+}
+
+bool MD5Kernel::available(void)
+{
+  MD5Kernel context;
+  return context.open();
+}
+
+bool MD5Kernel::make_hash(const char *data, size_t len, unsigned char *hash)
+{
+  MD5Kernel context;
+  memset(hash, '\0', MD5::HASH_LEN + 1);
+  return context.open() && context.update(data, len) && context.finish(hash);
+}
+
+bool MD5Kernel::make_hash(int fd, unsigned char *hash)
+{
+  MD5Kernel context;
+  memset(hash, '\0', MD5::HASH_LEN + 1);
+  return context.open() && context.update(fd) && context.finish(hash);
+}
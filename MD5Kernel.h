@@ -0,0 +1,69 @@
+/*
+ * MD5Kernel.h
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#ifndef MD5KERNEL_H
+#define MD5KERNEL_H
+
+#include "MD5.h"
+
+/* MD5 computed by the Linux kernel crypto API through an AF_ALG hash socket,
+ * which may be backed by a platform driver. Data is sent with MSG_MORE, or
+ * spliced from a descriptor through a pipe so file pages never reach user
+ * space. One context hashes any number of messages in turn. Every call
+ * returns false when AF_ALG or its md5 transform is unavailable (kernels
+ * without CONFIG_CRYPTO_USER_API_HASH, seccomp filtered containers); use
+ * available() to choose between this and MD5 up front. */
+class MD5Kernel {
+
+  int tfm_fd;     // bound transform socket
+  int op_fd;      // accepted operation socket, one message at a time
+  int pipe_fd[2]; // splice staging, opened on first use
+
+public:
+
+  static const size_t SPLICE_LEN = 1 << 16;   // default pipe capacity
+
+  MD5Kernel(void);
+  ~MD5Kernel(void);
+
+  bool open(void);
+  void close(void);
+
+  /* Adds data to the current message */
+  bool update(const char *data, size_t len);
+
+  /* Adds fd from its position to end of file. Descriptors that can not be
+   * spliced are read and sent instead. */
+  bool update(int fd);
+
+  /* Ends the message, storing the hash (17 element array), and starts the next */
+  bool finish(unsigned char *hash);
+
+  /* True when an md5 transform can be opened */
+  static bool available(void);
+
+  static bool make_hash(const char *data, size_t len, unsigned char *hash);
+  static bool make_hash(int fd, unsigned char *hash);
+
+};
+#endif
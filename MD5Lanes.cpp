@@ -0,0 +1,181 @@
+/*
+ * MD5Lanes.cpp
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "MD5Lanes.h"
+
+#ifdef __SSE2__
+
+// sine constants, step shifts and message word order of RFC 1321
+static const uint32_t T[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+  0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+  0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+  0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+  0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+  0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+  0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+  0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+  0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const int S[4][4] = { {7, 12, 17, 22}, {5, 9, 14, 20}, {4, 11, 16, 23}, {6, 10, 15, 21} };
+
+static inline __m128i MDRotl(__m128i x, int s)
+{
+  return _mm_or_si128(_mm_sll_epi32(x, _mm_cvtsi32_si128(s)), _mm_srl_epi32(x, _mm_cvtsi32_si128(32 - s)));
+}
+
+static inline uint32_t MDLoad32(const char *p)
+{
+  const unsigned char *u = (const unsigned char *) p;
+  return (uint32_t) u[0] | ((uint32_t) u[1] << 8) | ((uint32_t) u[2] << 16) | ((uint32_t) u[3] << 24);
+}
+
+/* One 64 byte block from each lane, state holds a, b, c, d */
+static void MDTransform(__m128i *state, const char *const *block)
+{
+  __m128i x[16];
+  for (int i = 0; i < 16; i++)
+  {
+    x[i] = _mm_set_epi32(MDLoad32(block[3] + 4 * i), MDLoad32(block[2] + 4 * i),
+                         MDLoad32(block[1] + 4 * i), MDLoad32(block[0] + 4 * i));
+  }
+
+  const __m128i ones = _mm_set1_epi32(-1);
+  __m128i a = state[0], b = state[1], c = state[2], d = state[3];
+  for (int i = 0; i < 64; i++)
+  {
+    __m128i f;
+    int k;
+    switch (i >> 4)
+    {
+    case 0:
+      f = _mm_xor_si128(d, _mm_and_si128(b, _mm_xor_si128(c, d)));
+      k = i;
+      break;
+    case 1:
+      f = _mm_xor_si128(c, _mm_and_si128(d, _mm_xor_si128(b, c)));
+      k = (5 * i + 1) & 15;
+      break;
+    case 2:
+      f = _mm_xor_si128(_mm_xor_si128(b, c), d);
+      k = (3 * i + 5) & 15;
+      break;
+    default:
+      f = _mm_xor_si128(c, _mm_or_si128(b, _mm_xor_si128(d, ones)));
+      k = (7 * i) & 15;
+      break;
+    }
+    f = _mm_add_epi32(_mm_add_epi32(f, a), _mm_add_epi32(x[k], _mm_set1_epi32(T[i])));
+    a = d;
+    d = c;
+    c = b;
+    b = _mm_add_epi32(b, MDRotl(f, S[i >> 4][i & 3]));
+  }
+  state[0] = _mm_add_epi32(state[0], a);
+  state[1] = _mm_add_epi32(state[1], b);
+  state[2] = _mm_add_epi32(state[2], c);
+  state[3] = _mm_add_epi32(state[3], d);
+}
+
+void MD5Lanes::make_hashes(const char *const *data, size_t len, unsigned char *hashes)
+{
+  __m128i state[4] = { _mm_set1_epi32(0x67452301), _mm_set1_epi32(0xefcdab89),
+                       _mm_set1_epi32(0x98badcfe), _mm_set1_epi32(0x10325476) };
+  const char *block[LANES];
+
+  size_t full = len / MD5::BUFFER_LEN;
+  for (size_t j = 0; j < full; j++)
+  {
+    for (int l = 0; l < LANES; l++)
+    {
+      block[l] = data[l] + j * MD5::BUFFER_LEN;
+    }
+    MDTransform(state, block);
+  }
+
+  // the lanes share a length, so they share the padding layout
+  char tail[LANES][MD5::BUFFER_LEN << 1];
+  size_t rest = len - full * MD5::BUFFER_LEN;
+  size_t tail_len = (rest < (size_t) MD5::SOURCE_SIZE_INDEX) ? MD5::BUFFER_LEN : MD5::BUFFER_LEN << 1;
+  uint64_t bits = (uint64_t) len << 3;
+  for (int l = 0; l < LANES; l++)
+  {
+    memset(tail[l], '\0', tail_len);
+    memcpy(tail[l], data[l] + full * MD5::BUFFER_LEN, rest);
+    tail[l][rest] = (char) 0x80;
+    for (int i = 0; i < 8; i++)
+    {
+      tail[l][tail_len - 8 + i] = (char) (bits >> (8 * i));
+    }
+  }
+  for (size_t off = 0; off < tail_len; off += MD5::BUFFER_LEN)
+  {
+    for (int l = 0; l < LANES; l++)
+    {
+      block[l] = tail[l] + off;
+    }
+    MDTransform(state, block);
+  }
+
+  uint32_t words[4][LANES];
+  for (int i = 0; i < 4; i++)
+  {
+    _mm_storeu_si128((__m128i *) words[i], state[i]);
+  }
+  for (int l = 0; l < LANES; l++)
+  {
+    unsigned char *hash = hashes + l * (MD5::HASH_LEN + 1);
+    for (int i = 0; i < 4; i++)
+    {
+      for (int j = 0; j < 4; j++)
+      {
+        hash[4 * i + j] = (unsigned char) (words[i][l] >> (8 * j));
+      }
+    }
+    hash[MD5::HASH_LEN] = '\0';
+  }
+}
+
+#else
+
+void MD5Lanes::make_hashes(const char *const *data, size_t len, unsigned char *hashes)
+{
+  for (int l = 0; l < LANES; l++)
+  {
+    MD5::make_hash(data[l], len, hashes + l * (MD5::HASH_LEN + 1));
+  }
+}
+
+#endif
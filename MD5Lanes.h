@@ -0,0 +1,45 @@
+/*
+ * MD5Lanes.h
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#ifndef MD5LANES_H
+#define MD5LANES_H
+
+#include "MD5.h"
+
+/* Hashes several independent messages of the same length at once. Each
+ * message is a lane of a 128 bit vector, so one pass over the MD5 steps
+ * advances all of them; on hosts without SSE2 the lanes are hashed one
+ * after another with MD5. Suited to fixed size blocks such as file
+ * signatures and tree leaves. */
+class MD5Lanes {
+
+public:
+
+  static const int LANES = 4;
+
+  /* data   - LANES pointers to messages of len bytes each
+   * hashes - LANES consecutive 17 element hash arrays */
+  static void make_hashes(const char *const *data, size_t len, unsigned char *hashes);
+
+};
+#endif
@@ -0,0 +1,479 @@
+/*
+ * MD5Manifest.cpp
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "MD5Manifest.h"
+
+const char MD5Manifest::MAGIC[8] = {'M', 'D', '5', 'M', 'A', 'N', 'I', '\0'};
+
+static const size_t RECORD_LEN = MD5::HASH_LEN + 16;   // hash, size, mtime
+static const size_t BLOCK_HEADER_LEN = 16;
+
+uint64_t MD5Manifest::path_hash(const char *path, size_t len)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++)
+  {
+    h = (h ^ (unsigned char) path[i]) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static bool MDIndexLess(const MD5Manifest::IndexEntry &a, const MD5Manifest::IndexEntry &b)
+{
+  return a.path_hash < b.path_hash;
+}
+
+static void MDPutVarint(string &out, uint64_t x)
+{
+  while (x >= 0x80)
+  {
+    out.push_back((char) ((x & 0x7f) | 0x80));
+    x >>= 7;
+  }
+  out.push_back((char) x);
+}
+
+static bool MDGetVarint(const char *&p, const char *end, uint64_t &x)
+{
+  x = 0;
+  for (int shift = 0; (p < end) && (shift < 64); shift += 7)
+  {
+    unsigned char c = *p++;
+    x |= (uint64_t) (c & 0x7f) << shift;
+    if ((c & 0x80) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+MD5ManifestWriter::MD5ManifestWriter(void)
+{
+  f = NULL;
+  flags = 0;
+  offset = 0;
+  pending = 0;
+  ok = false;
+}
+
+MD5ManifestWriter::~MD5ManifestWriter(void)
+{
+  if (this->f != NULL)
+  {
+    // abandoned without close(), discard the partial manifest
+    fclose(this->f);
+    unlink((this->path + ".tmp").c_str());
+  }
+}
+
+bool MD5ManifestWriter::write(const void *data, size_t len)
+{
+  this->ok = this->ok && (fwrite(data, 1, len, this->f) == len);
+  this->offset += len;
+  return this->ok;
+}
+
+bool MD5ManifestWriter::open(const char *path, uint32_t flags)
+{
+  this->path = path;
+  this->flags = flags;
+  this->f = fopen((this->path + ".tmp").c_str(), "wb");
+  if (this->f == NULL)
+  {
+    perror("Failed to create manifest.\n");
+    return false;
+  }
+  setvbuf(this->f, NULL, _IOFBF, 1 << 20);
+  MD5Manifest::Header header;
+  memset(&header, '\0', sizeof(header));
+  memcpy(header.magic, MD5Manifest::MAGIC, sizeof(header.magic));
+  header.version = MD5Manifest::VERSION;
+  header.byte_order = MD5Manifest::BYTE_ORDER_MARK;
+  header.flags = flags;
+  this->ok = true;
+  this->offset = 0;
+  return write(&header, sizeof(header));
+}
+
+bool MD5ManifestWriter::add(const char *path, const unsigned char *hash, uint64_t size, int64_t mtime_ns)
+{
+  size_t len = strlen(path);
+  MD5Manifest::IndexEntry entry = { MD5Manifest::path_hash(path, len),
+                                    (uint32_t) this->block_offsets.size(), this->pending };
+  this->index.push_back(entry);
+  this->fixed.append((const char *) hash, MD5::HASH_LEN);
+  this->fixed.append((const char *) &size, sizeof(size));
+  this->fixed.append((const char *) &mtime_ns, sizeof(mtime_ns));
+  MDPutVarint(this->paths, len);
+  this->paths.append(path, len);
+  return (++this->pending < MD5Manifest::BLOCK_RECORDS) || flush();
+}
+
+bool MD5ManifestWriter::flush(void)
+{
+  if (this->pending == 0)
+  {
+    return this->ok;
+  }
+  this->block_offsets.push_back(this->offset);
+
+  string stored;
+  uint32_t block_flags = 0;
+  if (this->flags & MD5Manifest::COMPRESS)
+  {
+    uLongf len = compressBound(this->paths.size());
+    stored.resize(len);
+    if ((compress2((Bytef *) &stored[0], &len, (const Bytef *) this->paths.data(), this->paths.size(), 1) == Z_OK) &&
+        (len < this->paths.size()))
+    {
+      stored.resize(len);
+      block_flags = MD5Manifest::COMPRESS;
+    }
+  }
+  const string &body = (block_flags & MD5Manifest::COMPRESS) ? stored : this->paths;
+  uint32_t header[4] = { this->pending, (uint32_t) this->paths.size(), (uint32_t) body.size(), block_flags };
+  write(header, sizeof(header));
+  write(this->fixed.data(), this->fixed.size());
+  write(body.data(), body.size());
+  this->pending = 0;
+  this->fixed.clear();
+  this->paths.clear();
+  return this->ok;
+}
+
+bool MD5ManifestWriter::close(void)
+{
+  if (this->f == NULL)
+  {
+    return false;
+  }
+  flush();
+  stable_sort(this->index.begin(), this->index.end(), MDIndexLess);
+
+  MD5Manifest::Trailer trailer;
+  memset(&trailer, '\0', sizeof(trailer));
+  trailer.blocks_offset = this->offset;
+  trailer.blocks = this->block_offsets.size();
+  write(this->block_offsets.data(), this->block_offsets.size() * sizeof(uint64_t));
+  trailer.index_offset = this->offset;
+  trailer.records = this->index.size();
+  write(this->index.data(), this->index.size() * sizeof(MD5Manifest::IndexEntry));
+  memcpy(trailer.magic, MD5Manifest::MAGIC, sizeof(trailer.magic));
+  write(&trailer, sizeof(trailer));
+
+  string tmp = this->path + ".tmp";
+  bool result = (fclose(this->f) == 0) && this->ok && (rename(tmp.c_str(), this->path.c_str()) == 0);
+  this->f = NULL;
+  if (!result)
+  {
+    perror("Failed to write manifest.\n");
+    unlink(tmp.c_str());
+  }
+  this->block_offsets.clear();
+  this->index.clear();
+  return result;
+}
+
+MD5ManifestReader::MD5ManifestReader(void)
+{
+  fd = -1;
+  map = NULL;
+  map_len = 0;
+  flags = 0;
+  memset(&trailer, '\0', sizeof(trailer));
+}
+
+MD5ManifestReader::~MD5ManifestReader(void)
+{
+  close();
+}
+
+bool MD5ManifestReader::open(const char *path)
+{
+  close();
+  this->fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if ((this->fd < 0) || (fstat(this->fd, &st) != 0) ||
+      ((size_t) st.st_size < sizeof(MD5Manifest::Header) + sizeof(MD5Manifest::Trailer)))
+  {
+    fprintf(stderr, "Not a manifest: %s\n", path);
+    close();
+    return false;
+  }
+  this->map_len = st.st_size;
+  void *m = mmap(NULL, this->map_len, PROT_READ, MAP_SHARED, this->fd, 0);
+  if (m == MAP_FAILED)
+  {
+    perror("Failed to map manifest.\n");
+    close();
+    return false;
+  }
+  this->map = (const char *) m;
+
+  MD5Manifest::Header header;
+  memcpy(&header, this->map, sizeof(header));
+  memcpy(&this->trailer, this->map + this->map_len - sizeof(this->trailer), sizeof(this->trailer));
+  size_t footer = this->map_len - sizeof(this->trailer);
+  if ((memcmp(header.magic, MD5Manifest::MAGIC, sizeof(header.magic)) != 0) ||
+      (header.version != MD5Manifest::VERSION) ||
+      (header.byte_order != MD5Manifest::BYTE_ORDER_MARK) ||
+      (memcmp(this->trailer.magic, MD5Manifest::MAGIC, sizeof(this->trailer.magic)) != 0) ||
+      // bounded before they are multiplied, so a forged trailer can not wrap
+      (this->trailer.blocks_offset < sizeof(MD5Manifest::Header)) ||
+      (this->trailer.blocks_offset > footer) ||
+      (this->trailer.blocks > (footer - this->trailer.blocks_offset) / sizeof(uint64_t)) ||
+      (this->trailer.blocks_offset + this->trailer.blocks * sizeof(uint64_t) != this->trailer.index_offset) ||
+      (this->trailer.records > (footer - this->trailer.index_offset) / sizeof(MD5Manifest::IndexEntry)) ||
+      (this->trailer.index_offset + this->trailer.records * sizeof(MD5Manifest::IndexEntry) != footer))
+  {
+    fprintf(stderr, "Not a manifest: %s\n", path);
+    close();
+    return false;
+  }
+  this->flags = header.flags;
+  return true;
+}
+
+void MD5ManifestReader::close(void)
+{
+  if (this->map != NULL)
+  {
+    munmap((void *) this->map, this->map_len);
+  }
+  if (this->fd >= 0)
+  {
+    ::close(this->fd);
+  }
+  this->fd = -1;
+  this->map = NULL;
+  this->map_len = 0;
+  memset(&this->trailer, '\0', sizeof(this->trailer));
+}
+
+bool MD5ManifestReader::block(size_t b, uint32_t *header, const char *&fixed, const char *&paths,
+                              const char *&end, string &scratch)
+{
+  if (b >= this->trailer.blocks)
+  {
+    return false;
+  }
+  uint64_t offset = 0;
+  memcpy(&offset, this->map + this->trailer.blocks_offset + b * sizeof(uint64_t), sizeof(offset));
+  if ((offset < sizeof(MD5Manifest::Header)) || (offset > this->trailer.blocks_offset) ||
+      (this->trailer.blocks_offset - offset < BLOCK_HEADER_LEN))
+  {
+    return false;
+  }
+  memcpy(header, this->map + offset, BLOCK_HEADER_LEN);
+  uint64_t room = this->trailer.blocks_offset - offset - BLOCK_HEADER_LEN;
+  if ((header[0] > room / RECORD_LEN) || (header[2] > room - (uint64_t) header[0] * RECORD_LEN))
+  {
+    return false;
+  }
+  fixed = this->map + offset + BLOCK_HEADER_LEN;
+  paths = fixed + (size_t) header[0] * RECORD_LEN;
+  end = paths + header[2];
+  if (header[3] & MD5Manifest::COMPRESS)
+  {
+    uLongf len = header[1];
+    scratch.resize(len);
+    if ((uncompress((Bytef *) &scratch[0], &len, (const Bytef *) paths, header[2]) != Z_OK) ||
+        (len != header[1]))
+    {
+      return false;
+    }
+    paths = scratch.data();
+    end = paths + len;
+  }
+  return true;
+}
+
+bool MD5ManifestReader::read_block(size_t b, vector<MD5Manifest::Record> &records)
+{
+  uint32_t header[4];
+  const char *p = NULL, *paths = NULL, *end = NULL;
+  string scratch;
+  records.clear();
+  if (!block(b, header, p, paths, end, scratch))
+  {
+    return false;
+  }
+  records.resize(header[0]);
+  for (uint32_t i = 0; i < header[0]; i++)
+  {
+    MD5Manifest::Record &r = records[i];
+    memcpy(r.hash, p, MD5::HASH_LEN);
+    memcpy(&r.size, p + MD5::HASH_LEN, sizeof(r.size));
+    memcpy(&r.mtime_ns, p + MD5::HASH_LEN + 8, sizeof(r.mtime_ns));
+    p += RECORD_LEN;
+    uint64_t len = 0;
+    if (!MDGetVarint(paths, end, len) || (len > (uint64_t) (end - paths)))
+    {
+      records.clear();
+      return false;
+    }
+    r.path.assign(paths, len);
+    paths += len;
+  }
+  return true;
+}
+
+bool MD5ManifestReader::find(const char *path, MD5Manifest::Record &record)
+{
+  if (this->map == NULL)
+  {
+    return false;
+  }
+  size_t path_len = strlen(path);
+  MD5Manifest::IndexEntry key = { MD5Manifest::path_hash(path, path_len), 0, 0 };
+  const MD5Manifest::IndexEntry *index = (const MD5Manifest::IndexEntry *) (this->map + this->trailer.index_offset);
+  const MD5Manifest::IndexEntry *last = index + this->trailer.records;
+  uint32_t header[4];
+  const char *fixed = NULL, *paths = NULL, *end = NULL;
+  string scratch;
+  for (const MD5Manifest::IndexEntry *e = lower_bound(index, last, key, MDIndexLess);
+       (e < last) && (e->path_hash == key.path_hash); e++)
+  {
+    if (!block(e->block, header, fixed, paths, end, scratch) || (e->record >= header[0]))
+    {
+      continue;
+    }
+    // walk the length prefixes up to the record, no other record is decoded
+    uint64_t len = 0;
+    for (uint32_t i = 0; i <= e->record; i++)
+    {
+      if (i > 0)
+      {
+        paths += len;
+      }
+      if (!MDGetVarint(paths, end, len) || (len > (uint64_t) (end - paths)))
+      {
+        return false;
+      }
+    }
+    if ((len == path_len) && (memcmp(paths, path, len) == 0))
+    {
+      const char *p = fixed + (size_t) e->record * RECORD_LEN;
+      record.path.assign(paths, len);
+      memcpy(record.hash, p, MD5::HASH_LEN);
+      memcpy(&record.size, p + MD5::HASH_LEN, sizeof(record.size));
+      memcpy(&record.mtime_ns, p + MD5::HASH_LEN + 8, sizeof(record.mtime_ns));
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Splits an md5sum or md5 output line into hash and path */
+static bool MDParseLine(char *line, unsigned char *hash, const char *&path)
+{
+  size_t n = strlen(line);
+  while ((n > 0) && ((line[n - 1] == '\n') || (line[n - 1] == '\r')))
+  {
+    line[--n] = '\0';
+  }
+  const char *hex = NULL;
+  if ((strncmp(line, "MD5 (", 5) == 0) && (n >= 5 + 4 + MD5::DIGEST_LEN + 1) &&
+      (strncmp(line + n - MD5::DIGEST_LEN - 4, ") = ", 4) == 0))
+  {
+    hex = line + n - MD5::DIGEST_LEN;
+    line[n - MD5::DIGEST_LEN - 4] = '\0';
+    path = line + 5;
+  }
+  else if ((n > (size_t) MD5::DIGEST_LEN + 2) && (line[MD5::DIGEST_LEN] == ' ') &&
+           ((line[MD5::DIGEST_LEN + 1] == ' ') || (line[MD5::DIGEST_LEN + 1] == '*')))
+  {
+    hex = line;
+    path = line + MD5::DIGEST_LEN + 2;
+  }
+  else
+  {
+    return false;
+  }
+  for (int i = 0; i < MD5::HASH_LEN; i++)
+  {
+    if (!isxdigit((unsigned char) hex[2 * i]) || !isxdigit((unsigned char) hex[2 * i + 1]))
+    {
+      return false;
+    }
+    char pair[3] = { hex[2 * i], hex[2 * i + 1], '\0' };
+    hash[i] = (unsigned char) strtoul(pair, NULL, 16);
+  }
+  return true;
+}
+
+bool MD5Manifest::from_md5sum(FILE *in, const char *manifest, uint32_t flags)
+{
+  MD5ManifestWriter writer;
+  if (!writer.open(manifest, flags))
+  {
+    return false;
+  }
+  char line[8192];
+  unsigned char hash[MD5::HASH_LEN];
+  const char *path = NULL;
+  bool ok = true;
+  while (ok && (fgets(line, sizeof(line), in) != NULL))
+  {
+    if (MDParseLine(line, hash, path))
+    {
+      ok = writer.add(path, hash, 0, 0);
+    }
+  }
+  return writer.close() && ok;
+}
+
+bool MD5Manifest::to_md5sum(const char *manifest, FILE *out)
+{
+  MD5ManifestReader reader;
+  if (!reader.open(manifest))
+  {
+    return false;
+  }
+  vector<MD5Manifest::Record> records;
+  char digest[MD5::DIGEST_LEN + 1];
+  memset(digest, '\0', sizeof(digest));
+  unsigned char hash[MD5::HASH_LEN + 1];
+  hash[MD5::HASH_LEN] = '\0';
+  for (size_t b = 0; b < reader.blocks(); b++)
+  {
+    if (!reader.read_block(b, records))
+    {
+      return false;
+    }
+    for (size_t i = 0; i < records.size(); i++)
+    {
+      memcpy(hash, records[i].hash, MD5::HASH_LEN);
+      MD5::make_digest(hash, digest);
+      fprintf(out, "%s  %s\n", digest, records[i].path.c_str());
+    }
+  }
+  return true;
+}
@@ -0,0 +1,159 @@
+/*
+ * MD5Manifest.h
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#ifndef MD5MANIFEST_H
+#define MD5MANIFEST_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "MD5.h"
+
+/* Binary manifest of file hashes, an alternative to text output for large
+ * trees. Records are written in blocks of up to BLOCK_RECORDS:
+ *
+ *   block header  records, path bytes, stored path bytes, flags (u32 each)
+ *   records       hash[16], size (u64), mtime_ns (i64) per record
+ *   paths         varint length and bytes per record, deflated with COMPRESS
+ *
+ * After the last block a footer holds the block offsets and an index of
+ * (FNV-1a path hash, block, record) sorted by path hash, followed by a
+ * fixed Trailer. Integers are stored in host byte order; the Header records
+ * which one. A reader maps the file and finds a path by binary search of
+ * the index and one block decode. */
+class MD5Manifest {
+
+public:
+
+  static const char MAGIC[8];
+  static const uint32_t VERSION = 1;
+  static const uint32_t BLOCK_RECORDS = 1024;   // small enough to decode for one lookup
+  static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+  // flags
+  static const uint32_t COMPRESS = 1;   // deflate path blocks (zlib)
+
+  struct Record {
+    string path;
+    unsigned char hash[MD5::HASH_LEN];
+    uint64_t size;
+    int64_t mtime_ns;
+  };
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t flags;
+    char reserved[12];
+  };
+
+  struct Trailer {
+    uint64_t blocks_offset;   // block offset table
+    uint64_t blocks;
+    uint64_t index_offset;    // IndexEntry array
+    uint64_t records;
+    char magic[8];
+  };
+
+  struct IndexEntry {
+    uint64_t path_hash;
+    uint32_t block;
+    uint32_t record;
+  };
+
+  /* Path hash used by the index, 64 bit FNV-1a */
+  static uint64_t path_hash(const char *path, size_t len);
+
+  /* Converters. from_md5sum() accepts md5sum lines ("hex  path", "hex *path")
+   * and md5 lines ("MD5 (path) = hex"); sizes and mtimes are unknown and left
+   * zero. to_md5sum() writes "hex  path" lines. */
+  static bool from_md5sum(FILE *in, const char *manifest, uint32_t flags = 0);
+  static bool to_md5sum(const char *manifest, FILE *out);
+
+};
+
+/* Appends records and writes the footer on close(). The manifest is built
+ * under path.tmp and renamed into place by a successful close(). */
+class MD5ManifestWriter {
+
+  FILE *f;
+  string path;
+  uint32_t flags;
+  uint64_t offset;
+  uint32_t pending;   // records in the block being filled
+  string fixed;       // their hash, size and mtime fields
+  string paths;       // their length prefixed paths
+  vector<uint64_t> block_offsets;
+  vector<MD5Manifest::IndexEntry> index;
+  bool ok;
+
+public:
+
+  MD5ManifestWriter(void);
+  ~MD5ManifestWriter(void);
+
+  bool open(const char *path, uint32_t flags = 0);
+  bool add(const char *path, const unsigned char *hash, uint64_t size, int64_t mtime_ns);
+  bool close(void);
+
+private:
+
+  bool flush(void);
+  bool write(const void *data, size_t len);
+
+};
+
+class MD5ManifestReader {
+
+  int fd;
+  const char *map;
+  size_t map_len;
+  MD5Manifest::Trailer trailer;
+  uint32_t flags;
+
+public:
+
+  MD5ManifestReader(void);
+  ~MD5ManifestReader(void);
+
+  bool open(const char *path);
+  void close(void);
+
+  size_t blocks(void) const { return this->trailer.blocks; }
+  size_t size(void) const { return this->trailer.records; }
+
+  /* Decodes block b into records */
+  bool read_block(size_t b, vector<MD5Manifest::Record> &records);
+
+  /* Looks a path up through the index */
+  bool find(const char *path, MD5Manifest::Record &record);
+
+private:
+
+  /* Locates block b, inflating its paths into scratch if compressed */
+  bool block(size_t b, uint32_t *header, const char *&fixed, const char *&paths,
+             const char *&end, string &scratch);
+
+};
+#endif
@@ -0,0 +1,458 @@
+/*
+ * MD5Merkle.cpp
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "MD5Lanes.h"
+#include "MD5Merkle.h"
+
+const char MD5Merkle::MAGIC[8] = {'M', 'D', '5', 'T', 'R', 'E', 'E', '\0'};
+
+static const unsigned char LEAF = 0x00;
+static const unsigned char INTERIOR = 0x01;
+
+MD5Merkle::MD5Merkle(void)
+{
+  memset(&this->header, '\0', sizeof(this->header));
+}
+
+string MD5Merkle::sidecar_path(const char *path)
+{
+  return string(path) + ".md5tree";
+}
+
+/* Reads len bytes at offset, short only at end of file. Returns bytes read or -1 */
+static ssize_t MDPreadFull(int fd, char *buffer, size_t len, uint64_t offset)
+{
+  size_t done = 0;
+  while (done < len)
+  {
+    ssize_t n = pread(fd, buffer + done, len - done, offset + done);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return -1;
+    }
+    if (n == 0)
+    {
+      break;
+    }
+    done += n;
+  }
+  return done;
+}
+
+void MD5Merkle::record(const struct stat &st)
+{
+  this->header.file_len = st.st_size;
+  this->header.mtime_ns = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  uint64_t leaves = (st.st_size + this->header.leaf_len - 1) / this->header.leaf_len;
+  this->header.leaves = (leaves == 0) ? 1 : leaves;
+}
+
+/* Hashes the listed leaves (ascending) into levels[0]. Each leaf is read
+ * behind its LEAF prefix byte, and runs of LANES consecutive full leaves go
+ * through MD5Lanes together. */
+bool MD5Merkle::hash_leaves(int fd, const vector<uint64_t> &leaves)
+{
+  size_t leaf_len = this->header.leaf_len;
+  size_t stride = leaf_len + 1;
+  vector<char> buffer(stride * MD5Lanes::LANES);
+  unsigned char hashes[MD5Lanes::LANES * (MD5::HASH_LEN + 1)];
+  const char *lanes[MD5Lanes::LANES];
+  size_t lens[MD5Lanes::LANES];
+
+  size_t i = 0;
+  while (i < leaves.size())
+  {
+    size_t run = 1;
+    while ((run < (size_t) MD5Lanes::LANES) && (i + run < leaves.size()) &&
+           (leaves[i + run] == leaves[i] + run))
+    {
+      run++;
+    }
+    bool full = (run == (size_t) MD5Lanes::LANES);
+    for (size_t l = 0; l < run; l++)
+    {
+      buffer[l * stride] = LEAF;
+      ssize_t n = MDPreadFull(fd, &buffer[l * stride + 1], leaf_len, (leaves[i] + l) * leaf_len);
+      if (n < 0)
+      {
+        return false;
+      }
+      lens[l] = n;
+      full = full && (lens[l] == leaf_len);
+    }
+    if (full)
+    {
+      for (int l = 0; l < MD5Lanes::LANES; l++)
+      {
+        lanes[l] = &buffer[l * stride];
+      }
+      MD5Lanes::make_hashes(lanes, stride, hashes);
+    }
+    else
+    {
+      for (size_t l = 0; l < run; l++)
+      {
+        MD5::make_hash(&buffer[l * stride], lens[l] + 1, hashes + l * (MD5::HASH_LEN + 1));
+      }
+    }
+    for (size_t l = 0; l < run; l++)
+    {
+      memcpy(node(0, leaves[i + l]), hashes + l * (MD5::HASH_LEN + 1), MD5::HASH_LEN);
+    }
+    i += run;
+  }
+  return true;
+}
+
+void MD5Merkle::hash_parent(size_t level, size_t i)
+{
+  size_t count = this->levels[level].size() / MD5::HASH_LEN;
+  size_t left = i << 1;
+  if (left + 1 >= count)
+  {
+    memcpy(node(level + 1, i), node(level, left), MD5::HASH_LEN);
+    return;
+  }
+  unsigned char pair[1 + (MD5::HASH_LEN << 1)];
+  unsigned char hash[MD5::HASH_LEN + 1];
+  pair[0] = INTERIOR;
+  memcpy(pair + 1, node(level, left), MD5::HASH_LEN << 1);
+  MD5::make_hash(pair, sizeof(pair), hash);
+  memcpy(node(level + 1, i), hash, MD5::HASH_LEN);
+}
+
+/* Sizes and recomputes every level above level */
+void MD5Merkle::rebuild(size_t level)
+{
+  this->levels.resize(level + 1);
+  while (this->levels[level].size() > MD5::HASH_LEN)
+  {
+    size_t count = this->levels[level].size() / MD5::HASH_LEN;
+    this->levels.push_back(vector<unsigned char>(((count + 1) >> 1) * MD5::HASH_LEN));
+    for (size_t i = 0; i < (count + 1) >> 1; i++)
+    {
+      hash_parent(level, i);
+    }
+    level++;
+  }
+}
+
+bool MD5Merkle::build(const char *path, uint32_t leaf_len)
+{
+  if ((leaf_len == 0) || (leaf_len > MAX_LEAF_LEN))
+  {
+    return false;
+  }
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if ((fd < 0) || (fstat(fd, &st) != 0))
+  {
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+    return false;
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  memcpy(this->header.magic, MAGIC, sizeof(MAGIC));
+  this->header.version = VERSION;
+  this->header.leaf_len = leaf_len;
+  record(st);
+
+  vector<uint64_t> leaves(this->header.leaves);
+  for (size_t i = 0; i < leaves.size(); i++)
+  {
+    leaves[i] = i;
+  }
+  this->levels.assign(1, vector<unsigned char>(this->header.leaves * MD5::HASH_LEN));
+  bool result = hash_leaves(fd, leaves);
+  close(fd);
+  if (result)
+  {
+    rebuild(0);
+  }
+  return result;
+}
+
+bool MD5Merkle::update(const char *path, const vector<Range> &dirty)
+{
+  if (this->levels.empty())
+  {
+    return build(path);
+  }
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if ((fd < 0) || (fstat(fd, &st) != 0))
+  {
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+    return false;
+  }
+
+  uint64_t leaf_len = this->header.leaf_len;
+  uint64_t old_len = this->header.file_len;
+  uint64_t old_leaves = this->header.leaves;
+  record(st);
+  uint64_t count = this->header.leaves;
+
+  vector<uint64_t> leaves;
+  for (size_t r = 0; r < dirty.size(); r++)
+  {
+    if ((dirty[r].len == 0) || (dirty[r].offset >= (uint64_t) st.st_size))
+    {
+      continue;
+    }
+    uint64_t last = std::min(dirty[r].offset + dirty[r].len - 1, (uint64_t) st.st_size - 1) / leaf_len;
+    for (uint64_t i = dirty[r].offset / leaf_len; i <= last; i++)
+    {
+      leaves.push_back(i);
+    }
+  }
+  if (old_len != (uint64_t) st.st_size)
+  {
+    // the old tail leaf changes length, and leaves past it appear or vanish
+    for (uint64_t i = std::min(old_len, (uint64_t) st.st_size) / leaf_len; i < count; i++)
+    {
+      leaves.push_back(i);
+    }
+  }
+  sort(leaves.begin(), leaves.end());
+  leaves.erase(unique(leaves.begin(), leaves.end()), leaves.end());
+
+  this->levels[0].resize(count * MD5::HASH_LEN);
+  bool result = hash_leaves(fd, leaves);
+  close(fd);
+  if (!result)
+  {
+    return false;
+  }
+
+  if (count != old_leaves)
+  {
+    // the shape of the tree changed, interior nodes are cheap to redo
+    rebuild(0);
+    return true;
+  }
+  for (size_t level = 0; level + 1 < this->levels.size(); level++)
+  {
+    size_t n = 0;
+    for (size_t i = 0; i < leaves.size(); i++)
+    {
+      uint64_t parent = leaves[i] >> 1;
+      if ((n == 0) || (leaves[n - 1] != parent))
+      {
+        leaves[n++] = parent;
+        hash_parent(level, parent);
+      }
+    }
+    leaves.resize(n);
+  }
+  return true;
+}
+
+bool MD5Merkle::stale(const char *path)
+{
+  struct stat st;
+  if (stat(path, &st) != 0)
+  {
+    return true;
+  }
+  int64_t mtime_ns = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  return ((uint64_t) st.st_size != this->header.file_len) || (mtime_ns != this->header.mtime_ns);
+}
+
+bool MD5Merkle::verify_range(const char *path, uint64_t offset, uint64_t len)
+{
+  if (this->levels.empty() || ((len > 0) && (offset + len > this->header.file_len)))
+  {
+    return false;
+  }
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return false;
+  }
+  uint64_t leaf_len = this->header.leaf_len;
+  uint64_t first = offset / leaf_len;
+  uint64_t last = (len == 0) ? first : (offset + len - 1) / leaf_len;
+  if (last >= this->header.leaves)
+  {
+    close(fd);
+    return false;
+  }
+
+  vector<char> buffer(leaf_len + 1);
+  unsigned char hash[MD5::HASH_LEN + 1];
+  unsigned char pair[1 + (MD5::HASH_LEN << 1)];
+  unsigned char root_hash[MD5::HASH_LEN + 1];
+  root(root_hash);
+  bool result = true;
+  for (uint64_t leaf = first; result && (leaf <= last); leaf++)
+  {
+    buffer[0] = LEAF;
+    ssize_t n = MDPreadFull(fd, &buffer[1], leaf_len, leaf * leaf_len);
+    if (n < 0)
+    {
+      result = false;
+      break;
+    }
+    MD5::make_hash(&buffer[0], n + 1, hash);
+
+    // fold up through the stored siblings, the result must be the root
+    uint64_t i = leaf;
+    for (size_t level = 0; level + 1 < this->levels.size(); level++, i >>= 1)
+    {
+      size_t count = this->levels[level].size() / MD5::HASH_LEN;
+      uint64_t sibling = i ^ 1;
+      if (sibling >= count)
+      {
+        continue;
+      }
+      pair[0] = INTERIOR;
+      memcpy(pair + 1 + ((i & 1) ? 0 : MD5::HASH_LEN), node(level, sibling), MD5::HASH_LEN);
+      memcpy(pair + 1 + ((i & 1) ? MD5::HASH_LEN : 0), hash, MD5::HASH_LEN);
+      MD5::make_hash(pair, sizeof(pair), hash);
+    }
+    result = memcmp(hash, root_hash, MD5::HASH_LEN) == 0;
+  }
+  close(fd);
+  return result;
+}
+
+void MD5Merkle::root(unsigned char *hash)
+{
+  memset(hash, '\0', MD5::HASH_LEN + 1);
+  if (!this->levels.empty())
+  {
+    memcpy(hash, &this->levels.back()[0], MD5::HASH_LEN);
+  }
+}
+
+static bool MDPut(FILE *f, uint64_t x, int bytes)
+{
+  unsigned char b[8];
+  for (int i = 0; i < bytes; i++)
+  {
+    b[i] = (unsigned char) (x >> (8 * i));
+  }
+  return fwrite(b, 1, bytes, f) == (size_t) bytes;
+}
+
+static bool MDGet(FILE *f, uint64_t &x, int bytes)
+{
+  unsigned char b[8];
+  if (fread(b, 1, bytes, f) != (size_t) bytes)
+  {
+    return false;
+  }
+  x = 0;
+  for (int i = bytes - 1; i >= 0; i--)
+  {
+    x = (x << 8) | b[i];
+  }
+  return true;
+}
+
+bool MD5Merkle::load(const char *sidecar)
+{
+  FILE *f = fopen(sidecar, "rb");
+  if (f == NULL)
+  {
+    return false;
+  }
+  struct stat st;
+  uint64_t version = 0, leaf_len = 0, mtime_ns = 0;
+  bool ok = (fstat(fileno(f), &st) == 0) &&
+            (fread(this->header.magic, sizeof(this->header.magic), 1, f) == 1) &&
+            MDGet(f, version, 4) && MDGet(f, leaf_len, 4) && MDGet(f, this->header.file_len, 8) &&
+            MDGet(f, mtime_ns, 8) && MDGet(f, this->header.leaves, 8) &&
+            (fread(this->header.root, sizeof(this->header.root), 1, f) == 1) &&
+            (fread(this->header.reserved, sizeof(this->header.reserved), 1, f) == 1);
+  this->header.version = version;
+  this->header.leaf_len = leaf_len;
+  this->header.mtime_ns = (int64_t) mtime_ns;
+  ok = ok && (memcmp(this->header.magic, MAGIC, sizeof(MAGIC)) == 0) &&
+       (this->header.version == VERSION) && (this->header.leaf_len > 0) &&
+       (this->header.leaf_len <= MAX_LEAF_LEN) &&
+       (this->header.leaves == std::max((uint64_t) 1, this->header.file_len / this->header.leaf_len +
+                               ((this->header.file_len % this->header.leaf_len) != 0))) &&
+       (this->header.leaves == ((uint64_t) st.st_size - HEADER_LEN) / MD5::HASH_LEN) &&
+       ((uint64_t) st.st_size == HEADER_LEN + this->header.leaves * MD5::HASH_LEN);
+  if (ok)
+  {
+    this->levels.assign(1, vector<unsigned char>(this->header.leaves * MD5::HASH_LEN));
+    ok = fread(&this->levels[0][0], MD5::HASH_LEN, this->header.leaves, f) == this->header.leaves;
+  }
+  fclose(f);
+  if (ok)
+  {
+    rebuild(0);
+    ok = memcmp(&this->levels.back()[0], this->header.root, MD5::HASH_LEN) == 0;
+  }
+  if (!ok)
+  {
+    memset(&this->header, '\0', sizeof(this->header));
+    this->levels.clear();
+  }
+  return ok;
+}
+
+bool MD5Merkle::save(const char *sidecar)
+{
+  if (this->levels.empty())
+  {
+    return false;
+  }
+  memcpy(this->header.root, &this->levels.back()[0], MD5::HASH_LEN);
+  string tmp = string(sidecar) + ".tmp";
+  FILE *f = fopen(tmp.c_str(), "wb");
+  if (f == NULL)
+  {
+    return false;
+  }
+  bool ok = (fwrite(this->header.magic, sizeof(this->header.magic), 1, f) == 1) &&
+            MDPut(f, this->header.version, 4) && MDPut(f, this->header.leaf_len, 4) &&
+            MDPut(f, this->header.file_len, 8) && MDPut(f, (uint64_t) this->header.mtime_ns, 8) &&
+            MDPut(f, this->header.leaves, 8) &&
+            (fwrite(this->header.root, sizeof(this->header.root), 1, f) == 1) &&
+            (fwrite(this->header.reserved, sizeof(this->header.reserved), 1, f) == 1) &&
+            (fwrite(&this->levels[0][0], MD5::HASH_LEN, this->header.leaves, f) == this->header.leaves);
+  ok = (fclose(f) == 0) && ok;
+  if (!ok || (rename(tmp.c_str(), sidecar) != 0))
+  {
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
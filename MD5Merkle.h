@@ -0,0 +1,110 @@
+/*
+ * MD5Merkle.h
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#ifndef MD5MERKLE_H
+#define MD5MERKLE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "MD5.h"
+
+/* MD5 Merkle tree over fixed size leaves of a file, kept in a sidecar so a
+ * large file can be re-verified incrementally. Leaves are MD5(0x00 | data)
+ * of leaf_len bytes (the last leaf may be short), interior nodes are
+ * MD5(0x01 | left | right) as in RFC 6962, so a leaf can not pass for an
+ * interior node, and a node without a sibling is promoted as is.
+ * update() re-hashes only the leaves touched by the dirty ranges and the
+ * nodes above them; verify_range() reads only the leaves under a range and
+ * checks them against the root through their stored siblings. */
+class MD5Merkle {
+
+public:
+
+  static const char MAGIC[8];
+  static const uint32_t VERSION = 2;
+  static const uint32_t LEAF_LEN = 1 << 20;       // default leaf size
+  static const uint32_t MAX_LEAF_LEN = 1 << 26;
+  static const size_t HEADER_LEN = 64;            // Header as stored in the sidecar
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t leaf_len;
+    uint64_t file_len;
+    int64_t mtime_ns;
+    uint64_t leaves;
+    unsigned char root[MD5::HASH_LEN];   // checked against the leaves on load
+    char reserved[8];
+  };
+
+  struct Range {
+    uint64_t offset;
+    uint64_t len;
+  };
+
+private:
+
+  Header header;
+  vector<vector<unsigned char> > levels;   // levels[0] leaves ... back() root, 16 bytes per node
+
+public:
+
+  MD5Merkle(void);
+
+  /* Hashes every leaf of the file at path, leaf_len is 1 to MAX_LEAF_LEN */
+  bool build(const char *path, uint32_t leaf_len = LEAF_LEN);
+
+  /* Re-hashes the leaves overlapping dirty plus any leaves added or cut
+   * short by a change of file size, then the nodes above them. */
+  bool update(const char *path, const vector<Range> &dirty);
+
+  /* True when the size or mtime of path differs from the tree */
+  bool stale(const char *path);
+
+  /* Reads the leaves covering offset..offset+len from path and checks them
+   * against the root. Returns false on a mismatch or read error. */
+  bool verify_range(const char *path, uint64_t offset, uint64_t len);
+
+  /* Root hash, 17 element array */
+  void root(unsigned char *hash);
+
+  /* The sidecar holds the header, integers little endian, and the leaf
+   * hashes; interior nodes are recomputed on load, which fails if they do
+   * not reproduce the root. */
+  bool load(const char *sidecar);
+  bool save(const char *sidecar);
+
+  /* Sidecar stored next to the file, path + ".md5tree" */
+  static string sidecar_path(const char *path);
+
+private:
+
+  bool hash_leaves(int fd, const vector<uint64_t> &leaves);
+  void hash_parent(size_t level, size_t i);
+  void rebuild(size_t level);
+  void record(const struct stat &st);
+  unsigned char *node(size_t level, size_t i) { return &this->levels[level][i * MD5::HASH_LEN]; }
+
+};
+#endif
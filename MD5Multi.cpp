@@ -0,0 +1,308 @@
+/*
+ * MD5Multi.cpp
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#endif
+#include "MD5Multi.h"
+
+static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static const uint32_t CRC32C_POLY = 0x82F63B78; // reflected Castagnoli polynomial
+
+static inline uint64_t MDRotl64(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+/* little endian loads independent of host byte order and alignment */
+static inline uint64_t MDRead64(const unsigned char *p)
+{
+  uint64_t x = 0;
+  for (int i = 7; i >= 0; i--)
+  {
+    x = (x << 8) | p[i];
+  }
+  return x;
+}
+
+static inline uint32_t MDRead32(const unsigned char *p)
+{
+  return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline uint64_t MDRound(uint64_t acc, uint64_t input)
+{
+  acc += input * PRIME64_2;
+  acc = MDRotl64(acc, 31);
+  return acc * PRIME64_1;
+}
+
+static inline uint64_t MDMergeRound(uint64_t acc, uint64_t val)
+{
+  acc ^= MDRound(0, val);
+  return acc * PRIME64_1 + PRIME64_4;
+}
+
+static bool MDHasSSE42(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  static const bool has = __builtin_cpu_supports("sse4.2");
+  return has;
+#else
+  return false;
+#endif
+}
+
+MD5Multi::MD5Multi(int digests, uint64_t seed)
+{
+  this->digests = digests;
+  this->crc = 0xffffffff;
+  this->seed = seed;
+  this->v[0] = seed + PRIME64_1 + PRIME64_2;
+  this->v[1] = seed + PRIME64_2;
+  this->v[2] = seed;
+  this->v[3] = seed - PRIME64_1;
+  this->total_len = 0;
+  this->stripe_len = 0;
+  memset(this->stripe, '\0', sizeof(this->stripe));
+}
+
+/* Byte-at-a-time CRC32C lookup table, built by a function-local static so
+ * concurrent first calls are safe */
+struct MDCrc32cTable {
+  uint32_t entry[256];
+
+  MDCrc32cTable()
+  {
+    for (uint32_t i = 0; i < 256; i++)
+    {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++)
+      {
+        c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+      }
+      this->entry[i] = c;
+    }
+  }
+};
+
+uint32_t MD5Multi::crc32c_sw(uint32_t crc, const char *data, size_t len)
+{
+  static const MDCrc32cTable crc_table;
+  const uint32_t *table = crc_table.entry;
+
+  const unsigned char *p = (const unsigned char *) data;
+  for (size_t i = 0; i < len; i++)
+  {
+    crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.2")))
+uint32_t MD5Multi::crc32c_hw(uint32_t crc, const char *data, size_t len)
+{
+  const unsigned char *p = (const unsigned char *) data;
+#if defined(__x86_64__)
+  uint64_t c = crc;
+  while (len >= 8)
+  {
+    uint64_t x;
+    memcpy(&x, p, sizeof(x));
+    c = _mm_crc32_u64(c, x);
+    p += 8;
+    len -= 8;
+  }
+  crc = (uint32_t) c;
+#endif
+  while (len > 0)
+  {
+    crc = _mm_crc32_u8(crc, *p++);
+    len--;
+  }
+  return crc;
+}
+#else
+uint32_t MD5Multi::crc32c_hw(uint32_t crc, const char *data, size_t len)
+{
+  return crc32c_sw(crc, data, len);
+}
+#endif
+
+void MD5Multi::xxh64_update(const char *data, size_t len)
+{
+  const unsigned char *p = (const unsigned char *) data;
+  const unsigned char *end = p + len;
+  this->total_len += len;
+
+  if (this->stripe_len + len < 32)
+  {
+    memcpy(this->stripe + this->stripe_len, p, len);
+    this->stripe_len += len;
+    return;
+  }
+
+  if (this->stripe_len > 0)
+  {
+    size_t fill = 32 - this->stripe_len;
+    memcpy(this->stripe + this->stripe_len, p, fill);
+    for (int i = 0; i < 4; i++)
+    {
+      this->v[i] = MDRound(this->v[i], MDRead64(this->stripe + (i << 3)));
+    }
+    p += fill;
+    this->stripe_len = 0;
+  }
+
+  uint64_t v1 = this->v[0], v2 = this->v[1], v3 = this->v[2], v4 = this->v[3];
+  while (p + 32 <= end)
+  {
+    v1 = MDRound(v1, MDRead64(p));
+    v2 = MDRound(v2, MDRead64(p + 8));
+    v3 = MDRound(v3, MDRead64(p + 16));
+    v4 = MDRound(v4, MDRead64(p + 24));
+    p += 32;
+  }
+  this->v[0] = v1;
+  this->v[1] = v2;
+  this->v[2] = v3;
+  this->v[3] = v4;
+
+  if (p < end)
+  {
+    memcpy(this->stripe, p, end - p);
+    this->stripe_len = end - p;
+  }
+}
+
+uint64_t MD5Multi::xxh64_final(void)
+{
+  uint64_t h;
+  if (this->total_len >= 32)
+  {
+    h = MDRotl64(this->v[0], 1) + MDRotl64(this->v[1], 7) +
+        MDRotl64(this->v[2], 12) + MDRotl64(this->v[3], 18);
+    for (int i = 0; i < 4; i++)
+    {
+      h = MDMergeRound(h, this->v[i]);
+    }
+  }
+  else
+  {
+    h = this->seed + PRIME64_5;
+  }
+  h += this->total_len;
+
+  const unsigned char *p = this->stripe;
+  const unsigned char *end = p + this->stripe_len;
+  while (p + 8 <= end)
+  {
+    h ^= MDRound(0, MDRead64(p));
+    h = MDRotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    p += 8;
+  }
+  if (p + 4 <= end)
+  {
+    h ^= (uint64_t) MDRead32(p) * PRIME64_1;
+    h = MDRotl64(h, 23) * PRIME64_2 + PRIME64_3;
+    p += 4;
+  }
+  while (p < end)
+  {
+    h ^= (*p) * PRIME64_5;
+    h = MDRotl64(h, 11) * PRIME64_1;
+    p++;
+  }
+
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+void MD5Multi::update(const char *data, size_t len)
+{
+  bool sse42 = MDHasSSE42();
+  while (len > 0)
+  {
+    size_t n = (len < CHUNK_LEN) ? len : CHUNK_LEN;
+    if (this->digests & MD5_DIGEST)
+    {
+      this->md5.update(data, n);
+    }
+    if (this->digests & CRC32C)
+    {
+      this->crc = sse42 ? crc32c_hw(this->crc, data, n) : crc32c_sw(this->crc, data, n);
+    }
+    if (this->digests & XXH64)
+    {
+      xxh64_update(data, n);
+    }
+    data += n;
+    len -= n;
+  }
+}
+
+bool MD5Multi::update(FILE *f)
+{
+  char buffer[CHUNK_LEN];
+  size_t bytes_read = 0;
+  while ((f != NULL) && ((bytes_read = fread(buffer, 1, sizeof(buffer), f)) > 0))
+  {
+    update(buffer, bytes_read);
+  }
+  if ((f == NULL) || ferror(f))
+  {
+    perror("Failed to read from file.\n");
+    return false;
+  }
+  return true;
+}
+
+void MD5Multi::finish(unsigned char *hash, uint32_t *crc32c, uint64_t *xxh64)
+{
+  if (hash != NULL)
+  {
+    memset(hash, '\0', MD5::HASH_LEN + 1);
+    if (this->digests & MD5_DIGEST)
+    {
+      this->md5.finish(hash);
+    }
+  }
+  if (crc32c != NULL)
+  {
+    *crc32c = (this->digests & CRC32C) ? ~this->crc : 0;
+  }
+  if (xxh64 != NULL)
+  {
+    *xxh64 = (this->digests & XXH64) ? xxh64_final() : 0;
+  }
+}
@@ -0,0 +1,84 @@
+/*
+ * MD5Multi.h
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#ifndef MD5MULTI_H
+#define MD5MULTI_H
+
+#include <stdint.h>
+#include "MD5.h"
+
+/* Computes MD5, CRC32C and xxHash64 of one stream in a single pass. Input is
+ * split into CHUNK_LEN pieces that stay in cache while every requested digest
+ * consumes them, so each byte is fetched from memory once. CRC32C uses the
+ * SSE4.2 crc32 instruction when the CPU has it. */
+class MD5Multi {
+
+public:
+
+  // digest selection flags
+  static const int MD5_DIGEST = 1;
+  static const int CRC32C = 2;
+  static const int XXH64 = 4;
+  static const int ALL = MD5_DIGEST | CRC32C | XXH64;
+
+  static const size_t CHUNK_LEN = 1 << 14;
+
+private:
+
+  int digests;
+  MD5 md5;
+  uint32_t crc;
+
+  // xxHash64 state
+  uint64_t v[4];
+  uint64_t seed;
+  uint64_t total_len;
+  unsigned char stripe[32];   // partial 32 byte stripe
+  size_t stripe_len;
+
+public:
+
+  MD5Multi(int digests = ALL, uint64_t seed = 0);
+
+  void update(const char *data, size_t len);
+
+  /* Reads f to end of file, returns false on a read error */
+  bool update(FILE *f);
+
+  /* Final digests. finish() must be called once, after the last update();
+   * digests that were not selected are left as zero. */
+  void finish(unsigned char *hash, uint32_t *crc32c, uint64_t *xxh64);
+
+  /* Software CRC32C (Castagnoli), for hosts without SSE4.2 */
+  static uint32_t crc32c_sw(uint32_t crc, const char *data, size_t len);
+
+  /* CRC32C with the SSE4.2 crc32 instruction, x86 only */
+  static uint32_t crc32c_hw(uint32_t crc, const char *data, size_t len);
+
+private:
+
+  void xxh64_update(const char *data, size_t len);
+  uint64_t xxh64_final(void);
+
+};
+#endif
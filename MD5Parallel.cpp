@@ -0,0 +1,329 @@
+/*
+ * MD5Parallel.cpp
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <time.h>
+#include <thread>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "MD5File.h"
+#include "MD5Parallel.h"
+
+static const int MPOL_PREFERRED_MODE = 1;   // MPOL_PREFERRED from numaif.h
+
+bool MD5Topology::parse_cpulist(const char *list, vector<int> &cpus)
+{
+  const char *p = list;
+  while ((*p != '\0') && (*p != '\n'))
+  {
+    char *end = NULL;
+    long first = strtol(p, &end, 10);
+    if ((end == p) || (first < 0))
+    {
+      return false;
+    }
+    long last = first;
+    p = end;
+    if (*p == '-')
+    {
+      last = strtol(p + 1, &end, 10);
+      if ((end == p + 1) || (last < first))
+      {
+        return false;
+      }
+      p = end;
+    }
+    for (long cpu = first; cpu <= last; cpu++)
+    {
+      cpus.push_back((int) cpu);
+    }
+    if (*p == ',')
+    {
+      p++;
+    }
+    else if ((*p != '\0') && (*p != '\n'))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+MD5Topology MD5Topology::parse(const char *spec)
+{
+  MD5Topology topology;
+  topology.fake = true;
+  string rest(spec);
+  size_t start = 0;
+  while (start <= rest.length())
+  {
+    size_t end = rest.find(';', start);
+    if (end == string::npos)
+    {
+      end = rest.length();
+    }
+    vector<int> cpus;
+    if (parse_cpulist(rest.substr(start, end - start).c_str(), cpus) && !cpus.empty())
+    {
+      topology.nodes.push_back(cpus);
+    }
+    start = end + 1;
+  }
+  return topology;
+}
+
+MD5Topology MD5Topology::detect(void)
+{
+  MD5Topology topology;
+  DIR *dir = opendir("/sys/devices/system/node");
+  if (dir != NULL)
+  {
+    // node directories are read in name order so node ids index nodes
+    vector<int> ids;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+      int id = 0;
+      if ((sscanf(entry->d_name, "node%d", &id) == 1))
+      {
+        ids.push_back(id);
+      }
+    }
+    closedir(dir);
+
+    int max_id = -1;
+    for (size_t i = 0; i < ids.size(); i++)
+    {
+      max_id = (ids[i] > max_id) ? ids[i] : max_id;
+    }
+    topology.nodes.resize(max_id + 1);
+    for (size_t i = 0; i < ids.size(); i++)
+    {
+      char path[128];
+      char list[4096];
+      snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", ids[i]);
+      FILE *f = fopen(path, "r");
+      if ((f != NULL) && (fgets(list, sizeof(list), f) != NULL))
+      {
+        parse_cpulist(list, topology.nodes[ids[i]]);
+      }
+      if (f != NULL)
+      {
+        fclose(f);
+      }
+    }
+  }
+
+  bool any = false;
+  for (size_t i = 0; i < topology.nodes.size(); i++)
+  {
+    any = any || !topology.nodes[i].empty();
+  }
+  if (!any)
+  {
+    topology.nodes.assign(1, vector<int>());
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    for (long cpu = 0; cpu < ((n > 0) ? n : 1); cpu++)
+    {
+      topology.nodes[0].push_back((int) cpu);
+    }
+  }
+  return topology;
+}
+
+bool MD5Parallel::parse_placement(const char *name, Placement &placement)
+{
+  if (strcmp(name, "none") == 0)
+  {
+    placement = NONE;
+  }
+  else if (strcmp(name, "compact") == 0)
+  {
+    placement = COMPACT;
+  }
+  else if (strcmp(name, "scatter") == 0)
+  {
+    placement = SCATTER;
+  }
+  else
+  {
+    return false;
+  }
+  return true;
+}
+
+MD5Parallel::MD5Parallel(const MD5Topology &topology, int threads, Placement placement, int flags)
+{
+  this->topology = topology;
+  this->flags = flags;
+
+  // (node, cpu) slots in the order workers take them
+  vector<Worker> slots;
+  if (placement == SCATTER)
+  {
+    for (size_t round = 0; ; round++)
+    {
+      size_t added = 0;
+      for (size_t node = 0; node < topology.nodes.size(); node++)
+      {
+        if (round < topology.nodes[node].size())
+        {
+          Worker w = {(int) node, topology.nodes[node][round]};
+          slots.push_back(w);
+          added++;
+        }
+      }
+      if (added == 0)
+      {
+        break;
+      }
+    }
+  }
+  else
+  {
+    for (size_t node = 0; node < topology.nodes.size(); node++)
+    {
+      for (size_t i = 0; i < topology.nodes[node].size(); i++)
+      {
+        Worker w = {(int) node, topology.nodes[node][i]};
+        slots.push_back(w);
+      }
+    }
+  }
+  if (slots.empty())
+  {
+    Worker w = {0, -1};
+    slots.push_back(w);
+  }
+
+  size_t count = (threads > 0) ? threads : slots.size();
+  for (size_t i = 0; i < count; i++)
+  {
+    Worker w = slots[i % slots.size()];
+    if (placement == NONE)
+    {
+      w.cpu = -1;
+    }
+    this->workers.push_back(w);
+  }
+}
+
+void MD5Parallel::print_placement(FILE *out)
+{
+  fprintf(out, "topology: %zu node(s)%s\n", this->topology.nodes.size(),
+    this->topology.fake ? " (fake)" : "");
+  for (size_t i = 0; i < this->workers.size(); i++)
+  {
+    if (this->workers[i].cpu < 0)
+    {
+      fprintf(out, "worker %zu: node %d, not pinned\n", i, this->workers[i].node);
+    }
+    else
+    {
+      fprintf(out, "worker %zu: node %d, cpu %d\n", i, this->workers[i].node, this->workers[i].cpu);
+    }
+  }
+}
+
+/* CLOCK_MONOTONIC in nanoseconds */
+static uint64_t MDNow(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void MD5Parallel::run(size_t id, const char *const *paths, size_t n, size_t *next,
+                      unsigned char *hashes, bool *ok, uint64_t *ns)
+{
+  Worker &w = this->workers[id];
+
+  // pin first so the buffer below is placed on this worker's node
+  if (w.cpu >= 0)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(w.cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+    {
+      w.cpu = -1;   // e.g. the CPU is outside this process's cpuset
+    }
+  }
+
+  size_t len = READ_LEN;
+  char *buffer = MD5File::alloc_buffer(len, this->flags);
+  if (buffer == NULL)
+  {
+    return;
+  }
+  if ((w.cpu >= 0) && !this->topology.fake && (w.node < 64))
+  {
+    // prefer the worker's node; ignored by kernels without NUMA support
+    unsigned long mask = 1UL << w.node;
+    syscall(SYS_mbind, buffer, len, MPOL_PREFERRED_MODE, &mask, sizeof(mask) * 8, 0);
+  }
+  memset(buffer, '\0', len);   // first touch
+
+  size_t i;
+  while ((i = __atomic_fetch_add(next, 1, __ATOMIC_RELAXED)) < n)
+  {
+    uint64_t t = (ns != NULL) ? MDNow() : 0;
+    ok[i] = MD5File::make_hash(paths[i], hashes + i * (MD5::HASH_LEN + 1), buffer, len, this->flags);
+    if (ns != NULL)
+    {
+      ns[i] = MDNow() - t;
+    }
+  }
+  MD5File::free_buffer(buffer, len);
+}
+
+size_t MD5Parallel::make_hashes(const char *const *paths, size_t n, unsigned char *hashes, bool *ok,
+                              uint64_t *ns)
+{
+  size_t next = 0;
+  memset(hashes, '\0', n * (MD5::HASH_LEN + 1));
+  for (size_t i = 0; i < n; i++)
+  {
+    ok[i] = false;
+    if (ns != NULL)
+    {
+      ns[i] = 0;
+    }
+  }
+
+  vector<thread> threads;
+  for (size_t id = 0; id < this->workers.size(); id++)
+  {
+    threads.push_back(thread(&MD5Parallel::run, this, id, paths, n, &next, hashes, ok, ns));
+  }
+  for (size_t id = 0; id < threads.size(); id++)
+  {
+    threads[id].join();
+  }
+  // every index below next was taken by a worker with a buffer
+  return (next < n) ? next : n;
+}
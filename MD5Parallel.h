@@ -0,0 +1,108 @@
+/*
+ * MD5Parallel.h
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#ifndef MD5PARALLEL_H
+#define MD5PARALLEL_H
+
+#include <stdint.h>
+#include <vector>
+#include "MD5.h"
+
+using namespace std;
+
+/* CPUs of each NUMA node. detect() reads /sys/devices/system/node and falls
+ * back to one node holding every online CPU. parse() builds a fake topology
+ * from a spec such as "0-3;4-7" (nodes separated by ';', cpulist syntax
+ * within a node) so placement can be exercised on single node hosts. */
+class MD5Topology {
+
+public:
+
+  vector<vector<int> > nodes;
+  bool fake;
+
+  MD5Topology(void) : fake(false) {}
+
+  static MD5Topology detect(void);
+  static MD5Topology parse(const char *spec);
+
+  /* Parses kernel cpulist syntax ("0-3,8,10-11") */
+  static bool parse_cpulist(const char *list, vector<int> &cpus);
+
+};
+
+/* Hashes many files on a pool of worker threads. Each worker is pinned to one
+ * CPU, then allocates its read buffer, so the buffer is bound to (and first
+ * touched on) the worker's node. A file is read and hashed by a single worker,
+ * so its data never crosses nodes.
+ *   NONE    - workers are not pinned
+ *   COMPACT - fill the CPUs of node 0, then node 1, ...
+ *   SCATTER - round robin across nodes */
+class MD5Parallel {
+
+public:
+
+  enum Placement { NONE, COMPACT, SCATTER };
+
+  static const size_t READ_LEN = 1 << 20;   // per worker read buffer
+  static const size_t MAX_THREADS = 1024;    // bound on the requested workers
+
+  struct Worker {
+    int node;
+    int cpu;     // -1 when not pinned
+  };
+
+private:
+
+  MD5Topology topology;
+  vector<Worker> workers;
+  int flags;   // MD5File option flags for the read buffers
+
+public:
+
+  /* threads <= 0 uses one worker per CPU of the topology. flags are
+   * MD5File option flags applied to the worker read buffers. */
+  MD5Parallel(const MD5Topology &topology, int threads, Placement placement, int flags = 0);
+
+  /* Prints one line per worker with its node and CPU. After make_hashes()
+   * workers that could not be pinned are shown as not pinned. */
+  void print_placement(FILE *out);
+
+  /* Hashes n files into hashes (n * (HASH_LEN + 1) bytes). ok[i] is false
+   * for files that could not be read, whose hash is left null. When ns is
+   * given it receives the time spent on each file in nanoseconds. Returns
+   * the number of files attempted, which is less than n only when no worker
+   * could allocate its read buffer; the files from there on were not read. */
+  size_t make_hashes(const char *const *paths, size_t n, unsigned char *hashes, bool *ok,
+                   uint64_t *ns = NULL);
+
+  /* Parses "none", "compact" or "scatter", returns false otherwise */
+  static bool parse_placement(const char *name, Placement &placement);
+
+private:
+
+  void run(size_t id, const char *const *paths, size_t n, size_t *next,
+           unsigned char *hashes, bool *ok, uint64_t *ns);
+
+};
+#endif
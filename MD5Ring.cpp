@@ -0,0 +1,188 @@
+/*
+ * MD5Ring.cpp
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <algorithm>
+#include "MD5Ring.h"
+
+const uint32_t MD5Ring::NO_NODE;
+
+static bool MDPointLess(const MD5Ring::Point &a, const MD5Ring::Point &b)
+{
+  return (a.value < b.value) || ((a.value == b.value) && (a.node < b.node));
+}
+
+uint32_t MD5Ring::point(const unsigned char *hash, int index)
+{
+  const unsigned char *p = hash + (index << 2);
+  return ((uint32_t) p[3] << 24) | ((uint32_t) p[2] << 16) | ((uint32_t) p[1] << 8) | p[0];
+}
+
+uint32_t MD5Ring::add(const string &name, unsigned int weight)
+{
+  uint32_t node = this->names.size();
+  this->names.push_back(name);
+
+  vector<Point> points;
+  unsigned char hash[MD5::HASH_LEN + 1];
+  char key[1024];
+  for (unsigned int k = 0; k < HASHES_PER_NODE * weight; k++)
+  {
+    int len = snprintf(key, sizeof(key), "%s-%u", name.c_str(), k);
+    MD5::make_hash(key, (len < (int) sizeof(key)) ? len : sizeof(key) - 1, hash);
+    for (int i = 0; i < POINTS_PER_HASH; i++)
+    {
+      Point p = {point(hash, i), node};
+      points.push_back(p);
+    }
+  }
+  sort(points.begin(), points.end(), MDPointLess);
+
+  vector<Point> merged(this->sorted.size() + points.size());
+  merge(this->sorted.begin(), this->sorted.end(), points.begin(), points.end(),
+        merged.begin(), MDPointLess);
+  this->sorted.swap(merged);
+  layout();
+  return node;
+}
+
+bool MD5Ring::remove(uint32_t node)
+{
+  if ((node >= this->names.size()) || this->names[node].empty())
+  {
+    return false;
+  }
+  this->names[node].clear();
+
+  size_t j = 0;
+  for (size_t i = 0; i < this->sorted.size(); i++)
+  {
+    if (this->sorted[i].node != node)
+    {
+      this->sorted[j++] = this->sorted[i];
+    }
+  }
+  this->sorted.resize(j);
+  layout();
+  return true;
+}
+
+/* In-order walk of the implicit tree assigns sorted points to Eytzinger slots */
+size_t MD5Ring::layout(size_t i, size_t k)
+{
+  if (k <= this->sorted.size())
+  {
+    i = layout(i, k << 1);
+    this->values[k] = this->sorted[i].value;
+    this->owners[k] = this->sorted[i].node;
+    i = layout(i + 1, (k << 1) + 1);
+  }
+  return i;
+}
+
+void MD5Ring::layout(void)
+{
+  this->values.assign(this->sorted.size() + 1, 0);
+  this->owners.assign(this->sorted.size() + 1, NO_NODE);
+  layout(0, 1);
+}
+
+/* Eytzinger lower bound. The descent records each step's comparison in the
+ * bits of k; stripping the trailing ones and the last zero gives the slot of
+ * the first value >= the key, or 0 when the key is above every point. */
+uint32_t MD5Ring::search(uint32_t value)
+{
+  size_t n = this->sorted.size();
+  if (n == 0)
+  {
+    return NO_NODE;
+  }
+  const uint32_t *v = &this->values[0];
+  size_t k = 1;
+  while (k <= n)
+  {
+    __builtin_prefetch(v + (k << 4));
+    k = (k << 1) + (v[k] < value);
+  }
+  k >>= __builtin_ffsll(~k);
+  return (k == 0) ? this->sorted[0].node : this->owners[k];
+}
+
+uint32_t MD5Ring::route(const char *key, size_t len)
+{
+  unsigned char hash[MD5::HASH_LEN + 1];
+  MD5::make_hash(key, len, hash);
+  return search(point(hash, 0));
+}
+
+void MD5Ring::route(const string *keys, size_t n, uint32_t *nodes)
+{
+  size_t count = this->sorted.size();
+  if (count == 0)
+  {
+    for (size_t i = 0; i < n; i++)
+    {
+      nodes[i] = NO_NODE;
+    }
+    return;
+  }
+
+  const uint32_t *v = &this->values[0];
+  unsigned char hash[MD5::HASH_LEN + 1];
+  uint32_t value[BATCH];
+  size_t k[BATCH];
+
+  for (size_t base = 0; base < n; base += BATCH)
+  {
+    size_t m = (n - base < BATCH) ? n - base : BATCH;
+    for (size_t j = 0; j < m; j++)
+    {
+      MD5::make_hash(keys[base + j].c_str(), keys[base + j].length(), hash);
+      value[j] = point(hash, 0);
+      k[j] = 1;
+    }
+
+    // the complete levels of the tree are descended by every key in lockstep,
+    // only the partial bottom level needs a check
+    for (size_t level = 1; level <= (count + 1) >> 1; level <<= 1)
+    {
+      for (size_t j = 0; j < m; j++)
+      {
+        __builtin_prefetch(v + (k[j] << 4));
+        k[j] = (k[j] << 1) + (v[k[j]] < value[j]);
+      }
+    }
+    for (size_t j = 0; j < m; j++)
+    {
+      if (k[j] <= count)
+      {
+        k[j] = (k[j] << 1) + (v[k[j]] < value[j]);
+      }
+    }
+
+    for (size_t j = 0; j < m; j++)
+    {
+      k[j] >>= __builtin_ffsll(~k[j]);
+      nodes[base + j] = (k[j] == 0) ? this->sorted[0].node : this->owners[k[j]];
+    }
+  }
+}
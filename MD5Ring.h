@@ -0,0 +1,90 @@
+/*
+ * MD5Ring.h
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#ifndef MD5RING_H
+#define MD5RING_H
+
+#include <stdint.h>
+#include <vector>
+#include "MD5Hash.h"
+
+/* Consistent hash ring compatible with ketama (libketama, libmemcached).
+ * Every node contributes HASHES_PER_NODE * weight MD5 hashes of "name-k",
+ * and each hash gives POINTS_PER_HASH points. A key maps to the node owning
+ * the first point at or above the first four bytes of the key's MD5, wrapping
+ * to the lowest point. With equal weights the ring matches ketama.
+ *
+ * Points are kept sorted for updates and copied into an Eytzinger (breadth
+ * first) array for lookups, which descend without branches and prefetch the
+ * cache line four levels ahead. Adding or removing a node merges or filters
+ * the sorted points without rehashing the other nodes. */
+class MD5Ring {
+
+public:
+
+  static const int HASHES_PER_NODE = 40;
+  static const int POINTS_PER_HASH = 4;
+  static const uint32_t NO_NODE = 0xffffffff;
+  static const size_t BATCH = 8;   // keys descended in lockstep by route()
+
+  struct Point {
+    uint32_t value;
+    uint32_t node;
+  };
+
+private:
+
+  vector<string> names;      // node ids index names, removed nodes are empty
+  vector<Point> sorted;      // all points ordered by value then node
+  vector<uint32_t> values;   // Eytzinger layout of point values, 1 based
+  vector<uint32_t> owners;   // node of each entry in values
+
+public:
+
+  /* Adds a node, returns its id */
+  uint32_t add(const string &name, unsigned int weight = 1);
+
+  /* Removes a node by id, returns false if it is not on the ring */
+  bool remove(uint32_t node);
+
+  /* Node for a key, NO_NODE if the ring is empty */
+  uint32_t route(const char *key, size_t len);
+  uint32_t route(const string &key) { return route(key.c_str(), key.length()); }
+
+  /* Routes n keys into nodes[], interleaving BATCH searches at a time */
+  void route(const string *keys, size_t n, uint32_t *nodes);
+
+  /* Ring position of a key or ketama point */
+  static uint32_t point(const unsigned char *hash, int index);
+
+  const string &name(uint32_t node) { return names[node]; }
+  size_t size(void) { return sorted.size(); }
+
+private:
+
+  void layout(void);
+  size_t layout(size_t i, size_t k);
+  uint32_t search(uint32_t value);
+
+};
+#endif
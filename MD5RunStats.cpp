@@ -0,0 +1,269 @@
+/*
+ * MD5RunStats.cpp
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <string.h>
+#include <time.h>
+#include "MD5RunStats.h"
+
+const char *MD5RunStats::PHASE_NAMES[PHASES] = {"open", "read", "transform", "print"};
+
+MD5Histogram::MD5Histogram(void)
+{
+  memset(this->counts, '\0', sizeof(this->counts));
+  this->total = 0;
+  this->min_value = UINT64_MAX;
+  this->max_value = 0;
+  this->sum = 0;
+}
+
+int MD5Histogram::index(uint64_t value)
+{
+  if (value < (uint64_t) SUB_COUNT)
+  {
+    return (int) value;
+  }
+  int magnitude = 63 - __builtin_clzll(value);
+  int sub = (int) (value >> (magnitude - SUB_BITS)) & (SUB_COUNT - 1);
+  return (magnitude - SUB_BITS + 1) * SUB_COUNT + sub;
+}
+
+uint64_t MD5Histogram::highest(int index)
+{
+  if (index < SUB_COUNT)
+  {
+    return index;
+  }
+  int magnitude = index / SUB_COUNT + SUB_BITS - 1;
+  uint64_t sub = index % SUB_COUNT;
+  uint64_t low = (1ULL << magnitude) | (sub << (magnitude - SUB_BITS));
+  return low + ((1ULL << (magnitude - SUB_BITS)) - 1);
+}
+
+void MD5Histogram::record(uint64_t value)
+{
+  this->counts[index(value)]++;
+  this->total++;
+  this->sum += value;
+  if (value < this->min_value)
+  {
+    this->min_value = value;
+  }
+  if (value > this->max_value)
+  {
+    this->max_value = value;
+  }
+}
+
+uint64_t MD5Histogram::percentile(double p)
+{
+  if (this->total == 0)
+  {
+    return 0;
+  }
+  uint64_t rank = (uint64_t) (p / 100.0 * this->total + 0.5);
+  if (rank < 1)
+  {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (int i = 0; i < BUCKETS; i++)
+  {
+    seen += this->counts[i];
+    if (seen >= rank)
+    {
+      uint64_t value = highest(i);
+      return (value < this->max_value) ? value : this->max_value;
+    }
+  }
+  return this->max_value;
+}
+
+MD5RunStats::MD5RunStats(void)
+{
+  this->start = now();
+  this->bytes = 0;
+  this->current_start = 0;
+  this->current.ns = 0;
+  this->current.bytes = 0;
+  memset(this->current_phases, '\0', sizeof(this->current_phases));
+}
+
+uint64_t MD5RunStats::now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void MD5RunStats::begin_file(const char *name)
+{
+  this->current.name = name;
+  this->current.ns = 0;
+  this->current.bytes = 0;
+  memset(this->current_phases, '\0', sizeof(this->current_phases));
+  this->current_start = now();
+}
+
+void MD5RunStats::add(Phase phase, uint64_t ns)
+{
+  this->current_phases[phase] += ns;
+}
+
+void MD5RunStats::add_bytes(uint64_t n)
+{
+  size_t second = (now() - this->start) / 1000000000ULL;
+  if (this->throughput.size() <= second)
+  {
+    this->throughput.resize(second + 1, 0);
+  }
+  this->throughput[second] += n;
+  this->current.bytes += n;
+  this->bytes += n;
+}
+
+void MD5RunStats::add_file(const char *name, uint64_t ns, uint64_t bytes)
+{
+  begin_file(name);
+  this->current_start -= ns;
+  add(READ, ns);
+  add_bytes(bytes);
+  end_file();
+}
+
+void MD5RunStats::end_file(void)
+{
+  this->current.ns = now() - this->current_start;
+  for (int i = 0; i < PHASES; i++)
+  {
+    this->phases[i].record(this->current_phases[i]);
+  }
+  this->files.record(this->current.ns);
+
+  // insertion into the short list of slowest files
+  if ((this->slowest.size() < SLOWEST) || (this->current.ns > this->slowest.back().ns))
+  {
+    vector<File>::iterator it = this->slowest.begin();
+    while ((it != this->slowest.end()) && (it->ns >= this->current.ns))
+    {
+      ++it;
+    }
+    this->slowest.insert(it, this->current);
+    if (this->slowest.size() > SLOWEST)
+    {
+      this->slowest.pop_back();
+    }
+  }
+}
+
+void MD5RunStats::print(FILE *out)
+{
+  double elapsed = (now() - this->start) / 1e9;
+
+  fprintf(out, "files %llu, bytes %llu, elapsed %.3f s, %.1f MB/s\n",
+    (unsigned long long) this->files.count(), (unsigned long long) this->bytes,
+    elapsed, (elapsed > 0) ? this->bytes / elapsed / 1e6 : 0.0);
+  fprintf(out, "%-10s %12s %12s %12s %12s %12s (usecs per file)\n",
+    "phase", "min", "p50", "p90", "p99", "max");
+  for (int i = 0; i <= PHASES; i++)
+  {
+    MD5Histogram &h = (i < PHASES) ? this->phases[i] : this->files;
+    fprintf(out, "%-10s %12.1f %12.1f %12.1f %12.1f %12.1f\n",
+      (i < PHASES) ? PHASE_NAMES[i] : "total",
+      h.min() / 1e3, h.percentile(50) / 1e3, h.percentile(90) / 1e3,
+      h.percentile(99) / 1e3, h.max() / 1e3);
+  }
+  fprintf(out, "MB/s by second:");
+  for (size_t i = 0; i < this->throughput.size(); i++)
+  {
+    fprintf(out, " %.1f", this->throughput[i] / 1e6);
+  }
+  fprintf(out, "\nslowest files:\n");
+  for (size_t i = 0; i < this->slowest.size(); i++)
+  {
+    fprintf(out, "  %12.1f usecs %12llu bytes  %s\n", this->slowest[i].ns / 1e3,
+      (unsigned long long) this->slowest[i].bytes, this->slowest[i].name.c_str());
+  }
+}
+
+/* Writes s as a JSON string literal */
+static void MDJsonString(FILE *out, const string &s)
+{
+  fputc('"', out);
+  for (size_t i = 0; i < s.length(); i++)
+  {
+    unsigned char c = s[i];
+    if ((c == '"') || (c == '\\'))
+    {
+      fprintf(out, "\\%c", c);
+    }
+    else if (c < 0x20)
+    {
+      fprintf(out, "\\u%04x", c);
+    }
+    else
+    {
+      fputc(c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+bool MD5RunStats::write_json(const char *path)
+{
+  FILE *out = fopen(path, "w");
+  if (out == NULL)
+  {
+    return false;
+  }
+
+  uint64_t elapsed = now() - this->start;
+  fprintf(out, "{\n  \"files\": %llu,\n  \"bytes\": %llu,\n  \"elapsed_ns\": %llu,\n  \"phases_ns\": {\n",
+    (unsigned long long) this->files.count(), (unsigned long long) this->bytes,
+    (unsigned long long) elapsed);
+  for (int i = 0; i <= PHASES; i++)
+  {
+    MD5Histogram &h = (i < PHASES) ? this->phases[i] : this->files;
+    fprintf(out, "    \"%s\": {\"count\": %llu, \"min\": %llu, \"mean\": %.0f, \"p50\": %llu, "
+      "\"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}%s\n",
+      (i < PHASES) ? PHASE_NAMES[i] : "total", (unsigned long long) h.count(),
+      (unsigned long long) h.min(), h.mean(), (unsigned long long) h.percentile(50),
+      (unsigned long long) h.percentile(90), (unsigned long long) h.percentile(99),
+      (unsigned long long) h.percentile(99.9), (unsigned long long) h.max(),
+      (i < PHASES) ? "," : "");
+  }
+  fprintf(out, "  },\n  \"bytes_per_second\": [");
+  for (size_t i = 0; i < this->throughput.size(); i++)
+  {
+    fprintf(out, "%s%llu", i ? ", " : "", (unsigned long long) this->throughput[i]);
+  }
+  fprintf(out, "],\n  \"slowest\": [");
+  for (size_t i = 0; i < this->slowest.size(); i++)
+  {
+    fprintf(out, "%s\n    {\"name\": ", i ? "," : "");
+    MDJsonString(out, this->slowest[i].name);
+    fprintf(out, ", \"ns\": %llu, \"bytes\": %llu}", (unsigned long long) this->slowest[i].ns,
+      (unsigned long long) this->slowest[i].bytes);
+  }
+  fprintf(out, "\n  ]\n}\n");
+  return (fclose(out) == 0);
+}
@@ -0,0 +1,128 @@
+/*
+ * MD5RunStats.h
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#ifndef MD5RUNSTATS_H
+#define MD5RUNSTATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/* Log-linear latency histogram in the style of HdrHistogram. Values below
+ * SUB_COUNT are exact; above that each power of two is split into SUB_COUNT
+ * buckets, giving about 3% relative error over the full 64 bit range. */
+class MD5Histogram {
+
+public:
+
+  static const int SUB_BITS = 5;
+  static const int SUB_COUNT = 1 << SUB_BITS;
+  static const int BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+private:
+
+  uint64_t counts[BUCKETS];
+  uint64_t total;
+  uint64_t min_value;
+  uint64_t max_value;
+  double sum;
+
+public:
+
+  MD5Histogram(void);
+
+  void record(uint64_t value);
+
+  /* Smallest value at or above the p'th percentile (0 - 100) */
+  uint64_t percentile(double p);
+
+  uint64_t count(void) { return total; }
+  uint64_t min(void) { return total ? min_value : 0; }
+  uint64_t max(void) { return max_value; }
+  double mean(void) { return total ? sum / total : 0; }
+
+private:
+
+  static int index(uint64_t value);
+  static uint64_t highest(int index);
+
+};
+
+/* Run statistics for the command line drivers (--stats). Keeps a latency
+ * histogram per phase of digesting a file, bytes hashed per second of the
+ * run, and the slowest files. */
+class MD5RunStats {
+
+public:
+
+  enum Phase { OPEN, READ, TRANSFORM, PRINT, PHASES };
+  static const char *PHASE_NAMES[PHASES];
+  static const size_t SLOWEST = 10;
+
+  struct File {
+    string name;
+    uint64_t ns;
+    uint64_t bytes;
+  };
+
+private:
+
+  MD5Histogram phases[PHASES];
+  MD5Histogram files;
+  vector<uint64_t> throughput;   // bytes hashed in each second of the run
+  vector<File> slowest;          // longest files first
+  uint64_t start;
+  uint64_t bytes;
+
+  // file being digested
+  File current;
+  uint64_t current_start;
+  uint64_t current_phases[PHASES];
+
+public:
+
+  MD5RunStats(void);
+
+  /* CLOCK_MONOTONIC in nanoseconds */
+  static uint64_t now(void);
+
+  void begin_file(const char *name);
+  void add(Phase phase, uint64_t ns);
+  void add_bytes(uint64_t n);
+  void end_file(void);
+
+  /* Records a file digested elsewhere, e.g. on a --parallel worker, with its
+   * whole time charged to READ */
+  void add_file(const char *name, uint64_t ns, uint64_t bytes);
+
+  /* Human readable summary */
+  void print(FILE *out);
+
+  /* Same data as JSON, returns false if path can not be written */
+  bool write_json(const char *path);
+
+};
+#endif
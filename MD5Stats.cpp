@@ -0,0 +1,108 @@
+/*
+ * MD5Stats.cpp
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "MD5Stats.h"
+
+#ifdef MD5_STATS
+// list of every thread's slot, slots are never freed so totals survive thread exit
+static MD5Stats::Slot *slots = NULL;
+
+MD5Stats::Slot *MD5Stats::local(void)
+{
+  static thread_local Slot *slot = NULL;
+  if (slot == NULL)
+  {
+    void *mem = NULL;
+    if (posix_memalign(&mem, CACHE_LINE, sizeof(Slot)) != 0)
+    {
+      abort();
+    }
+    slot = (Slot *) mem;
+    memset(slot, '\0', sizeof(Slot));
+    slot->next = __atomic_load_n(&slots, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&slots, &slot->next, slot, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    {
+    }
+  }
+  return slot;
+}
+#endif
+
+MD5Counters MD5Stats::total(void)
+{
+  MD5Counters sum;
+  memset(&sum, '\0', sizeof(sum));
+#ifdef MD5_STATS
+  for (Slot *s = __atomic_load_n(&slots, __ATOMIC_ACQUIRE); s != NULL; s = s->next)
+  {
+    sum.calls += __atomic_load_n(&s->counters.calls, __ATOMIC_RELAXED);
+    sum.small_calls += __atomic_load_n(&s->counters.small_calls, __ATOMIC_RELAXED);
+    sum.bytes += __atomic_load_n(&s->counters.bytes, __ATOMIC_RELAXED);
+    sum.blocks += __atomic_load_n(&s->counters.blocks, __ATOMIC_RELAXED);
+    sum.padding_blocks += __atomic_load_n(&s->counters.padding_blocks, __ATOMIC_RELAXED);
+    sum.transform_ns += __atomic_load_n(&s->counters.transform_ns, __ATOMIC_RELAXED);
+  }
+#endif
+  return sum;
+}
+
+string MD5Stats::prometheus(void)
+{
+  static const struct {
+    const char *name;
+    const char *help;
+  } METRICS[] = {
+    {"md5_calls_total", "Hashes finalized."},
+    {"md5_small_calls_total", "Hashes of less than one 64 byte block."},
+    {"md5_bytes_total", "Source bytes hashed."},
+    {"md5_blocks_total", "64 byte blocks transformed, padding included."},
+    {"md5_padding_blocks_total", "Transforms holding only padding and length."},
+    {"md5_transform_seconds_total", "Time spent in MD5::transform()."}
+  };
+
+  MD5Counters sum = total();
+  uint64_t values[] = {sum.calls, sum.small_calls, sum.bytes, sum.blocks, sum.padding_blocks};
+  string text;
+  char line[256];
+
+  for (int i = 0; i < 6; i++)
+  {
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s counter\n",
+      METRICS[i].name, METRICS[i].help, METRICS[i].name);
+    text += line;
+    if (i < 5)
+    {
+      snprintf(line, sizeof(line), "%s %llu\n", METRICS[i].name, (unsigned long long) values[i]);
+    }
+    else
+    {
+      snprintf(line, sizeof(line), "%s %.9f\n", METRICS[i].name, sum.transform_ns / 1e9);
+    }
+    text += line;
+  }
+  return text;
+}
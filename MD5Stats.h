@@ -0,0 +1,102 @@
+/*
+ * MD5Stats.h
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+/* Optional instrumentation of the MD5 class. Compile with -DMD5_STATS to
+ * enable; otherwise the hooks below are empty inline functions and the
+ * compiler removes them. Each thread counts into its own cache line sized
+ * slot, so counting never contends. MD5::stats() sums the slots. */
+
+#ifndef MD5STATS_H
+#define MD5STATS_H
+
+#include <stdint.h>
+#include <string>
+#include <time.h>
+
+using namespace std;
+
+struct MD5Counters {
+  uint64_t calls;           // hashes finalized
+  uint64_t small_calls;     // hashes of less than one block
+  uint64_t bytes;           // source bytes hashed
+  uint64_t blocks;          // 64 byte blocks transformed, padding included
+  uint64_t padding_blocks;  // transforms holding only padding and length
+  uint64_t transform_ns;    // time spent in MD5::transform()
+};
+
+class MD5Stats {
+
+public:
+
+  static const int CACHE_LINE = 64;
+
+  /* Per thread counters, padded so no two threads share a cache line */
+  struct alignas(CACHE_LINE) Slot {
+    MD5Counters counters;
+    Slot *next;
+  };
+
+  /* Sum of all thread slots, including threads that have exited */
+  static MD5Counters total(void);
+
+  /* total() in Prometheus text exposition format */
+  static string prometheus(void);
+
+#ifdef MD5_STATS
+  static Slot *local(void);
+
+  static uint64_t now(void)
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+
+  static void count(uint64_t &counter, uint64_t n)
+  {
+    __atomic_store_n(&counter, counter + n, __ATOMIC_RELAXED);
+  }
+
+  static void on_transform(uint64_t blocks, uint64_t start)
+  {
+    MD5Counters &c = local()->counters;
+    count(c.blocks, blocks);
+    count(c.transform_ns, now() - start);
+  }
+
+  static void on_finalize(uint64_t bytes, bool padding_only)
+  {
+    MD5Counters &c = local()->counters;
+    count(c.calls, 1);
+    count(c.small_calls, bytes < 64);
+    count(c.bytes, bytes);
+    count(c.padding_blocks, padding_only);
+  }
+#else
+  static uint64_t now(void) { return 0; }
+  static void on_transform(uint64_t, uint64_t) {}
+  static void on_finalize(uint64_t, bool) {}
+#endif
+
+};
+#endif
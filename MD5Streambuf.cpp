@@ -0,0 +1,199 @@
+/*
+ * MD5Streambuf.cpp
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <stdlib.h>
+#include "MD5Streambuf.h"
+
+MD5Streambuf::MD5Streambuf(streambuf *inner)
+{
+  this->inner = inner;
+  this->buffer = (char *) malloc(BUFFER_LEN);
+  if (this->buffer != NULL)
+  {
+    setp(this->buffer, this->buffer + BUFFER_LEN);
+  }
+}
+
+MD5Streambuf::~MD5Streambuf(void)
+{
+  sync();
+  free(this->buffer);
+}
+
+/* Forwards the put area and hashes what the inner buffer took. Bytes it
+ * did not take stay in the put area for the next attempt. */
+bool MD5Streambuf::flush(void)
+{
+  streamsize n = pptr() - pbase();
+  if (n == 0)
+  {
+    return true;
+  }
+  streamsize sent = (this->inner != NULL) ? this->inner->sputn(pbase(), n) : n;
+  sent = (sent < 0) ? 0 : sent;
+  this->context.update(pbase(), sent);
+  memmove(this->buffer, pbase() + sent, n - sent);
+  setp(this->buffer, this->buffer + BUFFER_LEN);
+  pbump(n - sent);
+  return sent == n;
+}
+
+MD5Streambuf::int_type MD5Streambuf::overflow(int_type c)
+{
+  if ((this->buffer == NULL) || !flush())
+  {
+    return traits_type::eof();
+  }
+  if (!traits_type::eq_int_type(c, traits_type::eof()))
+  {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+streamsize MD5Streambuf::xsputn(const char *s, streamsize n)
+{
+  if (n < epptr() - pptr())
+  {
+    memcpy(pptr(), s, n);
+    pbump(n);
+    return n;
+  }
+  if (!flush())
+  {
+    return 0;
+  }
+  streamsize sent = (this->inner != NULL) ? this->inner->sputn(s, n) : n;
+  sent = (sent < 0) ? 0 : sent;
+  this->context.update(s, sent);
+  return sent;
+}
+
+int MD5Streambuf::sync(void)
+{
+  if (!flush())
+  {
+    return -1;
+  }
+  return (this->inner != NULL) ? this->inner->pubsync() : 0;
+}
+
+void MD5Streambuf::hash(unsigned char *hash)
+{
+  flush();
+  MD5 copy(this->context);
+  copy.finish(hash);
+}
+
+MD5IStreambuf::MD5IStreambuf(streambuf *inner)
+{
+  this->inner = inner;
+  this->buffer = (char *) malloc(BUFFER_LEN);
+  this->hashed = this->buffer;
+  setg(this->buffer, this->buffer, this->buffer);
+}
+
+MD5IStreambuf::~MD5IStreambuf(void)
+{
+  free(this->buffer);
+}
+
+/* Adds the bytes consumed from the get area since the last call */
+void MD5IStreambuf::consume(void)
+{
+  if (gptr() > this->hashed)
+  {
+    this->context.update(this->hashed, gptr() - this->hashed);
+    this->hashed = gptr();
+  }
+}
+
+MD5IStreambuf::int_type MD5IStreambuf::underflow(void)
+{
+  if (gptr() < egptr())
+  {
+    return traits_type::to_int_type(*gptr());
+  }
+  consume();
+  if ((this->buffer == NULL) || (this->inner == NULL))
+  {
+    return traits_type::eof();
+  }
+  streamsize n = this->inner->sgetn(this->buffer, BUFFER_LEN);
+  this->hashed = this->buffer;
+  setg(this->buffer, this->buffer, this->buffer + ((n > 0) ? n : 0));
+  if (n <= 0)
+  {
+    return traits_type::eof();
+  }
+  return traits_type::to_int_type(*gptr());
+}
+
+streamsize MD5IStreambuf::xsgetn(char *s, streamsize n)
+{
+  streamsize copied = egptr() - gptr();
+  if (copied > n)
+  {
+    copied = n;
+  }
+  memcpy(s, gptr(), copied);
+  gbump(copied);
+
+  if ((n - copied < (streamsize) BUFFER_LEN) || (this->inner == NULL))
+  {
+    // small remainder, refill through the buffer
+    while (copied < n)
+    {
+      if (traits_type::eq_int_type(underflow(), traits_type::eof()))
+      {
+        break;
+      }
+      streamsize chunk = egptr() - gptr();
+      if (chunk > n - copied)
+      {
+        chunk = n - copied;
+      }
+      memcpy(s + copied, gptr(), chunk);
+      gbump(chunk);
+      copied += chunk;
+    }
+    return copied;
+  }
+
+  consume();
+  streamsize direct = this->inner->sgetn(s + copied, n - copied);
+  if (direct > 0)
+  {
+    this->context.update(s + copied, direct);
+    copied += direct;
+  }
+  return copied;
+}
+
+void MD5IStreambuf::hash(unsigned char *hash)
+{
+  consume();
+  MD5 copy(this->context);
+  copy.finish(hash);
+}
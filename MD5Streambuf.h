@@ -0,0 +1,96 @@
+/*
+ * MD5Streambuf.h
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#ifndef MD5STREAMBUF_H
+#define MD5STREAMBUF_H
+
+#include <streambuf>
+#include "MD5.h"
+
+/* Output stream buffer that hashes everything written through it. When an
+ * inner stream buffer is given the bytes are passed through to it as well.
+ * Writes are collected in a buffer that is a multiple of the MD5 block size
+ * so full blocks are transformed in place; writes larger than the buffer are
+ * hashed and forwarded directly from the caller's memory. With an inner
+ * buffer only the bytes it accepted are hashed; a short write fails and
+ * leaves the rest buffered for a later flush. */
+class MD5Streambuf : public streambuf {
+
+  MD5 context;
+  streambuf *inner;
+  char *buffer;
+
+public:
+
+  static const size_t BUFFER_LEN = 1 << 16;
+
+  MD5Streambuf(streambuf *inner = NULL);
+  ~MD5Streambuf(void);
+
+  /* Hash of the bytes written so far (17 element array), flushing them to
+   * the inner buffer. Writing may continue. */
+  void hash(unsigned char *hash);
+
+protected:
+
+  int_type overflow(int_type c);
+  streamsize xsputn(const char *s, streamsize n);
+  int sync(void);
+
+private:
+
+  bool flush(void);
+
+};
+
+/* Input stream buffer that hashes bytes as they are read from an inner
+ * stream buffer. Only bytes consumed by the reader are included in the hash.
+ * Reads larger than the buffer go directly into the caller's memory. */
+class MD5IStreambuf : public streambuf {
+
+  MD5 context;
+  streambuf *inner;
+  char *buffer;
+  char *hashed;   // bytes of the get area before this are in the context
+
+public:
+
+  static const size_t BUFFER_LEN = 1 << 16;
+
+  MD5IStreambuf(streambuf *inner);
+  ~MD5IStreambuf(void);
+
+  /* Hash of the bytes consumed so far (17 element array). Reading may continue. */
+  void hash(unsigned char *hash);
+
+protected:
+
+  int_type underflow(void);
+  streamsize xsgetn(char *s, streamsize n);
+
+private:
+
+  void consume(void);
+
+};
+#endif
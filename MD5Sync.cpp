@@ -0,0 +1,347 @@
+/*
+ * MD5Sync.cpp
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unordered_map>
+#include "MD5Lanes.h"
+#include "MD5Sync.h"
+
+static const size_t GROUP_BLOCKS = MD5Lanes::LANES * 16;   // blocks read per pass
+
+uint32_t MD5Sync::weak_sum(const char *data, size_t len)
+{
+  const unsigned char *p = (const unsigned char *) data;
+  uint32_t s1 = 0;
+  uint32_t s2 = 0;
+  for (size_t i = 0; i < len; i++)
+  {
+    s1 += p[i];
+    s2 += s1;
+  }
+  return (s1 & 0xffff) | ((s2 & 0xffff) << 16);
+}
+
+/* Fills buffer from fd unless end of file comes first, returns bytes read or -1 */
+static ssize_t MDReadFull(int fd, char *buffer, size_t len)
+{
+  size_t done = 0;
+  while (done < len)
+  {
+    ssize_t n = read(fd, buffer + done, len - done);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return -1;
+    }
+    if (n == 0)
+    {
+      break;
+    }
+    done += n;
+  }
+  return done;
+}
+
+bool MD5Sync::make_signature(const char *path, uint32_t block_len, Signature &sig)
+{
+  sig.block_len = block_len;
+  sig.file_len = 0;
+  sig.blocks.clear();
+  if ((block_len == 0) || (block_len > MAX_BLOCK_LEN))
+  {
+    return false;
+  }
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return false;
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  vector<char> buffer((size_t) block_len * GROUP_BLOCKS);
+  unsigned char hashes[MD5Lanes::LANES * (MD5::HASH_LEN + 1)];
+  const char *lanes[MD5Lanes::LANES];
+  bool result = true;
+  ssize_t n = 0;
+  while ((n = MDReadFull(fd, &buffer[0], buffer.size())) > 0)
+  {
+    size_t count = (n + block_len - 1) / block_len;
+    size_t full = n / block_len;
+    size_t first = sig.blocks.size();
+    sig.blocks.resize(first + count);
+    sig.file_len += n;
+
+    for (size_t i = 0; i < count; i++)
+    {
+      size_t len = (i < full) ? block_len : n - full * block_len;
+      sig.blocks[first + i].weak = weak_sum(&buffer[i * block_len], len);
+    }
+
+    // full blocks in groups of LANES, anything left over one at a time
+    size_t i = 0;
+    for (; i + MD5Lanes::LANES <= full; i += MD5Lanes::LANES)
+    {
+      for (int l = 0; l < MD5Lanes::LANES; l++)
+      {
+        lanes[l] = &buffer[(i + l) * block_len];
+      }
+      MD5Lanes::make_hashes(lanes, block_len, hashes);
+      for (int l = 0; l < MD5Lanes::LANES; l++)
+      {
+        memcpy(sig.blocks[first + i + l].strong, hashes + l * (MD5::HASH_LEN + 1), MD5::HASH_LEN);
+      }
+    }
+    for (; i < count; i++)
+    {
+      size_t len = (i < full) ? block_len : n - full * block_len;
+      MD5::make_hash(&buffer[i * block_len], len, hashes);
+      memcpy(sig.blocks[first + i].strong, hashes, MD5::HASH_LEN);
+    }
+
+    if ((size_t) n < buffer.size())
+    {
+      break;
+    }
+  }
+  if (n < 0)
+  {
+    result = false;
+  }
+  close(fd);
+  return result;
+}
+
+/* Appends a literal run, extending the previous one when they touch */
+static void MDLiteral(vector<MD5Sync::Op> &ops, uint64_t offset, uint64_t len)
+{
+  if (len == 0)
+  {
+    return;
+  }
+  if (!ops.empty() && (ops.back().block < 0) && (ops.back().offset + ops.back().len == offset))
+  {
+    ops.back().len += len;
+    return;
+  }
+  MD5Sync::Op op = { offset, len, -1 };
+  ops.push_back(op);
+}
+
+/* Index of the block in candidates whose strong sum matches data, or -1 */
+static int64_t MDConfirm(const MD5Sync::Signature &sig, const vector<size_t> &candidates,
+                         const char *data, size_t len)
+{
+  unsigned char hash[MD5::HASH_LEN + 1];
+  MD5::make_hash(data, len, hash);
+  for (size_t i = 0; i < candidates.size(); i++)
+  {
+    if (memcmp(sig.blocks[candidates[i]].strong, hash, MD5::HASH_LEN) == 0)
+    {
+      return candidates[i];
+    }
+  }
+  return -1;
+}
+
+bool MD5Sync::match(const char *path, const Signature &sig, vector<Op> &ops)
+{
+  if (sig.block_len == 0)
+  {
+    return false;
+  }
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return false;
+  }
+  struct stat st;
+  if ((fstat(fd, &st) != 0) || !S_ISREG(st.st_mode))
+  {
+    close(fd);
+    return false;
+  }
+  size_t len = st.st_size;
+  if (len == 0)
+  {
+    close(fd);
+    return true;
+  }
+  const char *data = (const char *) mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+  {
+    return false;
+  }
+  madvise((void *) data, len, MADV_SEQUENTIAL);
+
+  // weak sum -> full length blocks, the short last block is only tried at the end
+  size_t block_len = sig.block_len;
+  size_t full = sig.blocks.size();
+  if ((full > 0) && (sig.file_len % block_len != 0))
+  {
+    full--;
+  }
+  unordered_map<uint32_t, vector<size_t> > table;
+  table.reserve(full);
+  for (size_t i = 0; i < full; i++)
+  {
+    table[sig.blocks[i].weak].push_back(i);
+  }
+
+  size_t literal = 0;   // start of the pending literal run
+  size_t pos = 0;
+  bool fresh = true;
+  uint32_t weak = 0;
+  while (pos + block_len <= len)
+  {
+    if (fresh)
+    {
+      weak = weak_sum(data + pos, block_len);
+      fresh = false;
+    }
+    unordered_map<uint32_t, vector<size_t> >::const_iterator hit = table.find(weak);
+    int64_t block = (hit == table.end()) ? -1 : MDConfirm(sig, hit->second, data + pos, block_len);
+    if (block >= 0)
+    {
+      MDLiteral(ops, literal, pos - literal);
+      Op op = { pos, block_len, block };
+      ops.push_back(op);
+      pos += block_len;
+      literal = pos;
+      fresh = true;
+      continue;
+    }
+    if (pos + block_len == len)
+    {
+      break;
+    }
+    weak = roll(weak, block_len, data[pos], data[pos + block_len]);
+    pos++;
+  }
+
+  // a short basis tail can only match the target tail
+  size_t tail = sig.file_len % block_len;
+  if ((tail > 0) && (len - literal >= tail))
+  {
+    const Block &last = sig.blocks.back();
+    const char *end = data + len - tail;
+    unsigned char hash[MD5::HASH_LEN + 1];
+    if (weak_sum(end, tail) == last.weak)
+    {
+      MD5::make_hash(end, tail, hash);
+      if (memcmp(hash, last.strong, MD5::HASH_LEN) == 0)
+      {
+        MDLiteral(ops, literal, len - tail - literal);
+        Op op = { len - tail, tail, (int64_t) sig.blocks.size() - 1 };
+        ops.push_back(op);
+        literal = len;
+      }
+    }
+  }
+  MDLiteral(ops, literal, len - literal);
+  munmap((void *) data, len);
+  return true;
+}
+
+static bool MDPut(FILE *f, uint64_t x, int bytes)
+{
+  unsigned char b[8];
+  for (int i = 0; i < bytes; i++)
+  {
+    b[i] = (unsigned char) (x >> (8 * i));
+  }
+  return fwrite(b, 1, bytes, f) == (size_t) bytes;
+}
+
+static bool MDGet(FILE *f, uint64_t &x, int bytes)
+{
+  unsigned char b[8];
+  if (fread(b, 1, bytes, f) != (size_t) bytes)
+  {
+    return false;
+  }
+  x = 0;
+  for (int i = bytes - 1; i >= 0; i--)
+  {
+    x = (x << 8) | b[i];
+  }
+  return true;
+}
+
+bool MD5Sync::write_signature(FILE *f, const Signature &sig)
+{
+  bool ok = MDPut(f, MAGIC, 4) && MDPut(f, sig.block_len, 4) &&
+            MDPut(f, sig.file_len, 8) && MDPut(f, sig.blocks.size(), 8);
+  for (size_t i = 0; ok && (i < sig.blocks.size()); i++)
+  {
+    ok = MDPut(f, sig.blocks[i].weak, 4) &&
+         (fwrite(sig.blocks[i].strong, 1, MD5::HASH_LEN, f) == (size_t) MD5::HASH_LEN);
+  }
+  return ok;
+}
+
+bool MD5Sync::read_signature(FILE *f, Signature &sig)
+{
+  uint64_t magic = 0, block_len = 0, count = 0;
+  if (!MDGet(f, magic, 4) || (magic != MAGIC) || !MDGet(f, block_len, 4) ||
+      (block_len == 0) || (block_len > MAX_BLOCK_LEN) || !MDGet(f, sig.file_len, 8) ||
+      !MDGet(f, count, 8) ||
+      (count != sig.file_len / block_len + ((sig.file_len % block_len) != 0)))
+  {
+    return false;
+  }
+
+  // a forged count must not size the table beyond what the file holds
+  struct stat st;
+  long offset = ftell(f);
+  if ((fstat(fileno(f), &st) == 0) && S_ISREG(st.st_mode) && (offset >= 0) &&
+      (count > (uint64_t) (st.st_size - offset) / (4 + MD5::HASH_LEN)))
+  {
+    return false;
+  }
+
+  // grown per block, as a stream can not be measured up front
+  sig.block_len = block_len;
+  sig.blocks.clear();
+  for (uint64_t i = 0; i < count; i++)
+  {
+    Block block;
+    uint64_t weak = 0;
+    if (!MDGet(f, weak, 4) ||
+        (fread(block.strong, 1, MD5::HASH_LEN, f) != (size_t) MD5::HASH_LEN))
+    {
+      return false;
+    }
+    block.weak = weak;
+    sig.blocks.push_back(block);
+  }
+  return true;
+}
@@ -0,0 +1,89 @@
+/*
+ * MD5Sync.h
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#ifndef MD5SYNC_H
+#define MD5SYNC_H
+
+#include <stdint.h>
+#include <vector>
+#include "MD5.h"
+
+/* rsync style delta detection. A signature holds a weak rolling checksum and
+ * the MD5 hash of every block_len block of a basis file; both are computed
+ * in one read, with MD5Lanes hashing LANES blocks per pass. match() slides
+ * the weak checksum over a target file a byte at a time and confirms each
+ * weak hit with MD5, so only the target ranges without a matching block
+ * need to be sent. */
+class MD5Sync {
+
+public:
+
+  struct Block {
+    uint32_t weak;
+    unsigned char strong[MD5::HASH_LEN];
+  };
+
+  struct Signature {
+    uint32_t block_len;
+    uint64_t file_len;
+    vector<Block> blocks;   // the last block may be short
+  };
+
+  /* A run of the target: block >= 0 copies that basis block, block < 0 is
+   * len literal bytes at offset in the target. */
+  struct Op {
+    uint64_t offset;
+    uint64_t len;
+    int64_t block;
+  };
+
+  static const uint32_t MAGIC = 0x5335444d;   // "MDS5" little endian
+  static const uint32_t MAX_BLOCK_LEN = 1 << 20;   // largest block make_signature() accepts
+
+  /* Weak checksum of a block, s1 = sum of bytes and s2 = sum of the running
+   * s1, each mod 2^16, packed as s1 | s2 << 16. */
+  static uint32_t weak_sum(const char *data, size_t len);
+
+  /* Slides a len byte window one byte: drops out, appends in */
+  static uint32_t roll(uint32_t weak, size_t len, unsigned char out, unsigned char in)
+  {
+    uint32_t s1 = ((weak & 0xffff) - out + in) & 0xffff;
+    uint32_t s2 = ((weak >> 16) - (uint32_t) (len * out) + s1) & 0xffff;
+    return s1 | (s2 << 16);
+  }
+
+  /* Builds the signature of the file at path with blocks of 1 to
+   * MAX_BLOCK_LEN bytes. Returns false on error. */
+  static bool make_signature(const char *path, uint32_t block_len, Signature &sig);
+
+  /* Scans the target file against sig and appends the delta to ops, literal
+   * runs merged. Returns false on error. */
+  static bool match(const char *path, const Signature &sig, vector<Op> &ops);
+
+  /* Signature files: MAGIC, block_len, file_len, block count, then weak and
+   * strong sum per block, integers little endian. */
+  static bool write_signature(FILE *f, const Signature &sig);
+  static bool read_signature(FILE *f, Signature &sig);
+
+};
+#endif
@@ -0,0 +1,460 @@
+/*
+ * MD5Tar.cpp
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <errno.h>
+#include <thread>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "MD5Tar.h"
+
+// ustar header field offsets and lengths
+static const int NAME = 0, NAME_LEN = 100;
+static const int SIZE = 124, SIZE_LEN = 12;
+static const int MTIME = 136, MTIME_LEN = 12;
+static const int CHKSUM = 148, CHKSUM_LEN = 8;
+static const int TYPEFLAG = 156;
+static const int MAGIC = 257;
+static const int PREFIX = 345, PREFIX_LEN = 155;
+static const int GNU_EXTENDED = 482;        // old GNU sparse header continues
+static const int GNU_EXTENDED_NEXT = 504;   // same flag in each continuation block
+
+/* Octal field, or base-256 when the high bit of the first byte is set */
+static uint64_t MDTarNumber(const char *field, int len)
+{
+  const unsigned char *p = (const unsigned char *) field;
+  uint64_t x = 0;
+  if (p[0] & 0x80)
+  {
+    x = p[0] & 0x3f;
+    for (int i = 1; i < len; i++)
+    {
+      x = (x << 8) | p[i];
+    }
+    return x;
+  }
+  for (int i = 0; i < len; i++)
+  {
+    if ((p[i] >= '0') && (p[i] <= '7'))
+    {
+      x = (x << 3) | (p[i] - '0');
+    }
+    else if ((p[i] != ' ') || (x != 0))
+    {
+      break;
+    }
+  }
+  return x;
+}
+
+static string MDTarString(const char *field, int len)
+{
+  return string(field, strnlen(field, len));
+}
+
+static bool MDTarChecksum(const char *block)
+{
+  const unsigned char *u = (const unsigned char *) block;
+  uint64_t sum = 0;
+  int64_t signed_sum = 0;
+  for (size_t i = 0; i < MD5TarReader::BLOCK_LEN; i++)
+  {
+    unsigned char c = ((i >= (size_t) CHKSUM) && (i < (size_t) (CHKSUM + CHKSUM_LEN))) ? ' ' : u[i];
+    sum += c;
+    signed_sum += (signed char) c;
+  }
+  uint64_t stored = MDTarNumber(block + CHKSUM, CHKSUM_LEN);
+  return (stored == sum) || ((int64_t) stored == signed_sum);
+}
+
+/* Applies "len key=value\n" pax records that override path or size, and
+ * notes GNU.sparse.* records. Returns false for a size that is not a plain
+ * decimal number. */
+static bool MDTarPax(const string &records, string &path, uint64_t &size, bool &has_size, bool &sparse)
+{
+  size_t p = 0;
+  while (p < records.size())
+  {
+    size_t space = records.find(' ', p);
+    if (space == string::npos)
+    {
+      return true;
+    }
+    size_t len = strtoul(records.c_str() + p, NULL, 10);
+    if ((len == 0) || (len > records.size() - p) || (space + 1 >= p + len))
+    {
+      return true;
+    }
+    string record = records.substr(space + 1, p + len - space - 2);   // without the newline
+    size_t eq = record.find('=');
+    if (eq != string::npos)
+    {
+      string key = record.substr(0, eq);
+      if (key.compare(0, 11, "GNU.sparse.") == 0)
+      {
+        sparse = true;
+      }
+      if ((key == "path") || (key == "GNU.sparse.name"))
+      {
+        path = record.substr(eq + 1);
+      }
+      else if (key == "size")
+      {
+        const char *value = record.c_str() + eq + 1;
+        char *end = NULL;
+        errno = 0;
+        size = strtoull(value, &end, 10);
+        if ((*value < '0') || (*value > '9') || (*end != '\0') || (errno != 0))
+        {
+          return false;
+        }
+        has_size = true;
+      }
+    }
+    p += len;
+  }
+  return true;
+}
+
+/* Bytes from the end of len bytes of data to the next block boundary */
+static uint64_t MDTarPadding(uint64_t len)
+{
+  return (MD5TarReader::BLOCK_LEN - (len % MD5TarReader::BLOCK_LEN)) % MD5TarReader::BLOCK_LEN;
+}
+
+MD5TarReader::MD5TarReader(void)
+{
+  fd = -1;
+  map = NULL;
+  map_len = 0;
+  pos = 0;
+  buf_pos = 0;
+  buf_len = 0;
+  failed = false;
+}
+
+MD5TarReader::~MD5TarReader(void)
+{
+  if (this->map != NULL)
+  {
+    munmap((void *) this->map, this->map_len);
+  }
+}
+
+bool MD5TarReader::open(int fd)
+{
+  this->fd = fd;
+  this->pos = 0;
+  this->failed = false;
+  struct stat st;
+  off_t offset = lseek(fd, 0, SEEK_CUR);
+  if ((fstat(fd, &st) == 0) && S_ISREG(st.st_mode) && (offset == 0) && (st.st_size > 0))
+  {
+    void *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m != MAP_FAILED)
+    {
+      madvise(m, st.st_size, MADV_SEQUENTIAL);
+      this->map = (const char *) m;
+      this->map_len = st.st_size;
+      return true;
+    }
+  }
+  this->buffer.resize(READ_LEN);
+  return true;
+}
+
+/* Moves len bytes past the read position, hashing them into context if given */
+bool MD5TarReader::skip(uint64_t len, MD5 *context)
+{
+  if (this->map != NULL)
+  {
+    if (!fits(len))
+    {
+      return false;
+    }
+    if (context != NULL)
+    {
+      context->update(this->map + this->pos, len);
+    }
+    this->pos += len;
+    return true;
+  }
+  while (len > 0)
+  {
+    if (this->buf_pos == this->buf_len)
+    {
+      ssize_t n = read(this->fd, &this->buffer[0], READ_LEN);
+      if (n < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        return false;
+      }
+      if (n == 0)
+      {
+        return false;
+      }
+      this->buf_pos = 0;
+      this->buf_len = n;
+    }
+    size_t n = this->buf_len - this->buf_pos;
+    n = (len < n) ? len : n;
+    if (context != NULL)
+    {
+      context->update(&this->buffer[this->buf_pos], n);
+    }
+    this->buf_pos += n;
+    this->pos += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool MD5TarReader::read_block(char *block)
+{
+  if (this->map != NULL)
+  {
+    if (!fits(BLOCK_LEN))
+    {
+      this->failed = (this->pos < this->map_len);
+      return false;
+    }
+    memcpy(block, this->map + this->pos, BLOCK_LEN);
+    this->pos += BLOCK_LEN;
+    return true;
+  }
+  size_t done = 0;
+  while (done < BLOCK_LEN)
+  {
+    if (this->buf_pos == this->buf_len)
+    {
+      ssize_t n = read(this->fd, &this->buffer[0], READ_LEN);
+      if ((n < 0) && (errno == EINTR))
+      {
+        continue;
+      }
+      if (n <= 0)
+      {
+        this->failed = (n < 0) || (done > 0);
+        return false;
+      }
+      this->buf_pos = 0;
+      this->buf_len = n;
+    }
+    size_t n = this->buf_len - this->buf_pos;
+    n = (BLOCK_LEN - done < n) ? BLOCK_LEN - done : n;
+    memcpy(block + done, &this->buffer[this->buf_pos], n);
+    this->buf_pos += n;
+    this->pos += n;
+    done += n;
+  }
+  return true;
+}
+
+/* Reads a pax or GNU long name payload, padding included */
+bool MD5TarReader::read_string(size_t len, string &out)
+{
+  out.clear();
+  char block[BLOCK_LEN];
+  for (uint64_t done = 0; done < len; done += BLOCK_LEN)
+  {
+    if (!read_block(block))
+    {
+      this->failed = true;
+      return false;
+    }
+    out.append(block, (len - done < BLOCK_LEN) ? len - done : BLOCK_LEN);
+  }
+  return true;
+}
+
+bool MD5TarReader::next(Member &m, bool hash_data)
+{
+  char block[BLOCK_LEN];
+  string long_name;
+  string pax_path;
+  uint64_t pax_size = 0;
+  bool has_size = false;
+  bool sparse = false;
+
+  for (;;)
+  {
+    if (!read_block(block))
+    {
+      // archives ending on a header boundary without end of archive blocks are accepted
+      return false;
+    }
+    bool zero = true;
+    for (size_t i = 0; zero && (i < BLOCK_LEN); i++)
+    {
+      zero = (block[i] == '\0');
+    }
+    if (zero)
+    {
+      return false;
+    }
+    if (!MDTarChecksum(block))
+    {
+      this->failed = true;
+      return false;
+    }
+
+    char type = block[TYPEFLAG];
+    uint64_t size = MDTarNumber(block + SIZE, SIZE_LEN);
+    if ((type == 'x') || (type == 'L'))
+    {
+      string payload;
+      if (!fits(size) || !read_string(size, payload))
+      {
+        this->failed = true;
+        return false;
+      }
+      if (type == 'L')
+      {
+        long_name = string(payload.c_str());
+      }
+      else if (!MDTarPax(payload, pax_path, pax_size, has_size, sparse))
+      {
+        this->failed = true;
+        return false;
+      }
+      continue;
+    }
+    if ((type == 'g') || (type == 'K'))
+    {
+      // global pax headers and GNU long link names do not name this member
+      if (!skip(size, NULL) || !skip(MDTarPadding(size), NULL))
+      {
+        this->failed = true;
+        return false;
+      }
+      continue;
+    }
+
+    // old GNU sparse maps may continue in blocks ahead of the data
+    bool extended = (type == SPARSE) && (block[GNU_EXTENDED] != '\0');
+    while (extended)
+    {
+      char more[BLOCK_LEN];
+      if (!read_block(more))
+      {
+        this->failed = true;
+        return false;
+      }
+      extended = (more[GNU_EXTENDED_NEXT] != '\0');
+    }
+
+    m.type = sparse ? SPARSE : ((type == '\0') || (type == '7')) ? REGULAR : type;
+    m.size = has_size ? pax_size : size;
+    m.mtime = MDTarNumber(block + MTIME, MTIME_LEN);
+    if (!pax_path.empty())
+    {
+      m.name = pax_path;
+    }
+    else if (!long_name.empty())
+    {
+      m.name = long_name;
+    }
+    else if ((memcmp(block + MAGIC, "ustar", 5) == 0) && (block[PREFIX] != '\0'))
+    {
+      m.name = MDTarString(block + PREFIX, PREFIX_LEN) + "/" + MDTarString(block + NAME, NAME_LEN);
+    }
+    else
+    {
+      m.name = MDTarString(block + NAME, NAME_LEN);
+    }
+    m.offset = this->pos;
+    memset(m.hash, '\0', sizeof(m.hash));
+
+    // links, devices, directories and FIFOs ('1' to '6') carry no data,
+    // every other member is followed by size bytes
+    uint64_t data_len = ((type >= '1') && (type <= '6')) ? 0 : m.size;
+    bool ok = fits(data_len);
+    if (ok && (m.type == REGULAR) && hash_data)
+    {
+      MD5 context;
+      ok = skip(m.size, &context) && skip(MDTarPadding(m.size), NULL);
+      context.finish(m.hash);
+    }
+    else if (ok)
+    {
+      ok = skip(data_len, NULL) && skip(MDTarPadding(data_len), NULL);
+    }
+    if (!ok)
+    {
+      this->failed = true;
+      return false;
+    }
+    return true;
+  }
+}
+
+static void MDTarWorker(const char *data, vector<MD5TarReader::Member> *members, size_t first, size_t *next)
+{
+  size_t i = 0;
+  while ((i = __atomic_fetch_add(next, 1, __ATOMIC_RELAXED)) < members->size() - first)
+  {
+    MD5TarReader::Member &m = (*members)[first + i];
+    if (m.type == MD5TarReader::REGULAR)
+    {
+      MD5::make_hash(data + m.offset, m.size, m.hash);
+    }
+  }
+}
+
+bool MD5Tar::hash_members(int fd, vector<MD5TarReader::Member> &members, int threads)
+{
+  MD5TarReader reader;
+  MD5TarReader::Member m;
+  if (!reader.open(fd))
+  {
+    return false;
+  }
+  bool parallel = reader.mapped() && (threads > 1);
+  size_t first = members.size();
+  while (reader.next(m, !parallel))
+  {
+    members.push_back(m);
+  }
+  if (reader.error())
+  {
+    return false;
+  }
+  if (parallel)
+  {
+    // headers are located without touching member data, now hash it in parallel
+    size_t next = 0;
+    vector<thread> pool;
+    for (int t = 0; t < threads; t++)
+    {
+      pool.push_back(thread(MDTarWorker, reader.data(), &members, first, &next));
+    }
+    for (size_t t = 0; t < pool.size(); t++)
+    {
+      pool[t].join();
+    }
+  }
+  return true;
+}
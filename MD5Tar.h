@@ -0,0 +1,108 @@
+/*
+ * MD5Tar.h
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+#ifndef MD5TAR_H
+#define MD5TAR_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "MD5.h"
+
+/* Reads a tar archive member by member without extracting it. ustar, pax
+ * extended headers (path, size) and GNU long names are understood. Sparse
+ * members, GNU 'S' or pax GNU.sparse.*, are skipped unhashed. Mapped
+ * archives are hashed in place; pipes are read through a READ_LEN buffer
+ * and each member's data is hashed straight out of it. */
+class MD5TarReader {
+
+public:
+
+  static const size_t BLOCK_LEN = 512;
+  static const size_t READ_LEN = 1 << 20;
+
+  struct Member {
+    string name;
+    char type;            // ustar typeflag, REGULAR for file data, SPARSE unhashed
+    uint64_t size;
+    uint64_t offset;      // of the data in the archive
+    int64_t mtime;
+    unsigned char hash[MD5::HASH_LEN + 1];   // regular files, when hashed
+  };
+
+  static const char REGULAR = '0';
+  static const char SPARSE = 'S';
+
+private:
+
+  int fd;
+  const char *map;      // whole archive when it could be mapped
+  size_t map_len;
+  uint64_t pos;         // archive offset of the next header
+  vector<char> buffer;  // streaming input
+  size_t buf_pos;
+  size_t buf_len;
+  bool failed;
+
+public:
+
+  MD5TarReader(void);
+  ~MD5TarReader(void);
+
+  /* Reads from fd, mapping it when it is a regular file */
+  bool open(int fd);
+
+  /* Advances to the next member. Data of regular files is hashed into
+   * m.hash when hash_data is set and skipped otherwise; a mapped archive
+   * skips without reading. Returns false at the end of the archive or on a
+   * malformed header, see error(). */
+  bool next(Member &m, bool hash_data = true);
+
+  bool error(void) const { return this->failed; }
+  bool mapped(void) const { return this->map != NULL; }
+
+  /* Start of the mapped archive, NULL when streaming */
+  const char *data(void) const { return this->map; }
+
+private:
+
+  bool read_block(char *block);
+  bool read_string(size_t len, string &out);
+  bool skip(uint64_t len, MD5 *context);
+
+  /* False when a mapped archive has less than len bytes left */
+  bool fits(uint64_t len) const { return (this->map == NULL) || (len <= this->map_len - this->pos); }
+
+};
+
+class MD5Tar {
+
+public:
+
+  /* Appends every member of the archive on fd to members, hashing regular
+   * files. Members of a mapped archive are located first, then hashed on
+   * up to threads threads. Returns false on a read error or bad header. */
+  static bool hash_members(int fd, vector<MD5TarReader::Member> &members, int threads);
+
+};
+#endif
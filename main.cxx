@@ -37,17 +37,73 @@
  */
 
 #include <iostream>
+#include <sstream>
+#include <vector>
+#include <thread>
 #include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <signal.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/perf_event.h>
 #include "MD5.h"
+#include "MD5Cache.h"
+#include "MD5RunStats.h"
+#include "MD5File.h"
+#include "MD5Parallel.h"
+#include "MD5Streambuf.h"
+#include "MD5Multi.h"
+#include "MD5Ring.h"
+#include "MD5Sync.h"
+#include "MD5Chunker.h"
+#include "MD5Merkle.h"
+#include "MD5HashSet.h"
+#include "MD5Manifest.h"
+#include "MD5Decompress.h"
+#include "MD5Tar.h"
+#include "MD5Kernel.h"
+#include "MD5Follow.h"
 
 // Function declarations
 void MDString(const char *);
 void MDTimeTrial(void);
 void MDTestSuite(void);
+void MDCheck(const char *, bool);
+bool MDCacheConflict(void);
+bool MDParseSize(const char *, const char *, size_t, size_t, size_t &);
+string MDTempFile(const char *, size_t);
 void MDFile(const char *);
 void MDFilter(FILE *);
+void MDCopy(const char *, const char *);
+void MDParallel(void);
+void MDTlbBench(const char *);
+void MDKernelBench(const char *);
+void MDSignature(const char *, const char *, const char *);
+void MDDelta(const char *, const char *);
+void MDChunks(const char *, const char *, const char *, const char *);
+void MDTree(const char *, const char *);
+void MDTreeUpdate(const char *, const char *);
+void MDTreeVerify(const char *, const char *, const char *);
+void MDTreeRoot(MD5Merkle &, const char *);
+void MDManifestFile(const char *);
+void MDManifestClose(void);
+void MDManifestFind(const char *, const char *);
+void MDTar(const char *);
+void MDFollow(const char *, const char *);
+void MDPrefixes(const char *, const char *);
+int MDTlbCounter(void);
 void MDPrint(const char *);
+void MDTimedHash(FILE *, unsigned char *);
+void MDChargeBytes(FILE *);
+uint64_t MDLap(MD5RunStats::Phase, uint64_t);
 
 
 static const char HELP[] = "\
@@ -56,6 +112,36 @@ Arguments (may be any combination):\n\
 \t-t        - runs time trial\n\
 \t-x        - runs test script\n\
 \t-h        - print this message\n\
+\t--stats   - prints per phase latency, throughput and slowest files at exit\n\
+\t--stats-json file - writes the --stats report to file as JSON\n\
+\t--cache file - look up and record file hashes in cache file\n\
+\t--copy src dst - copies src to dst and digests the copied bytes\n\
+\t--parallel n - digests the named files on n pinned threads (0 = one per cpu)\n\
+\t--placement none|compact|scatter - thread placement for --parallel\n\
+\t--topology spec - fake numa topology, e.g. \"0-3;4-7\"\n\
+\t--show-placement - prints the --parallel thread placement\n\
+\t--huge-pages - backs read buffers and file mappings with huge pages\n\
+\t--tlb-bench file - compares dTLB misses with and without huge pages\n\
+\t--direct  - reads files with O_DIRECT, bypassing the page cache\n\
+\t--signature file block_len sigfile - writes rsync style block signatures of file\n\
+\t--delta sigfile file - prints the copy and literal ops rebuilding file from sigfile\n\
+\t--chunks min avg max file - digests content defined chunks of file\n\
+\t--tree file leaf_len - builds the Merkle tree sidecar of file\n\
+\t--tree-update file off:len,... - rehashes the changed ranges of file\n\
+\t--tree-verify file offset len - verifies a range of file against its tree\n\
+\t--known-build list set - builds a known hash set from md5sum style list\n\
+\t--known set - marks digests found in the known hash set\n\
+\t--manifest file - writes digests of the following files to a binary manifest\n\
+\t--manifest-z file - as --manifest, with compressed blocks\n\
+\t--manifest-find manifest path - prints the manifest record of path\n\
+\t--to-md5sum manifest - prints a manifest in md5sum format\n\
+\t--from-md5sum list|- manifest - converts md5sum output to a manifest\n\
+\t--decompress - digests the decompressed content of gzip, xz or zstd files, or of standard input when no file is named\n\
+\t--tar archive|- - digests each regular member of a tar archive\n\
+\t--kernel  - digests files with the kernel crypto API (AF_ALG) when available\n\
+\t--kernel-bench file - compares the built in transform with AF_ALG send and splice\n\
+\t--follow file seconds - reprints the digest of an append-only file as it grows\n\
+\t--prefixes step file|- - digests every step bytes (K, M or G suffix) prefix and the whole input\n\
 \tfilename  - digests file\n\
 \t(none)    - digests standard input\n\
 ";
@@ -64,10 +150,50 @@ Arguments (may be any combination):\n\
 static const int TEST_BLOCK_COUNT = 1000;
 static const int TEST_BLOCK_LEN = 1000;
 static const int OUTPUT_LEN = 1024; // limit memory usage for output buffers
+static const int MAX_FOLLOW_INTERVAL = 86400; // --follow interval seconds, one day
 
 // char buffer for formatting output
 char *output = NULL;
 
+// optional run statistics, enabled by --stats or --stats-json
+MD5RunStats *stats = NULL;
+const char *stats_json = NULL;
+
+// optional persistent hash cache, opened by --cache
+MD5Cache *cache = NULL;
+
+// parallel digesting of the named files, enabled by --parallel
+bool parallel = false;
+int parallel_threads = 0;
+MD5Parallel::Placement placement = MD5Parallel::COMPACT;
+const char *topology_spec = NULL;
+bool show_placement = false;
+vector<const char *> parallel_files;
+
+// optional set of known hashes, opened by --known
+MD5HashSet *known = NULL;
+
+// binary manifest output, opened by --manifest
+MD5ManifestWriter *manifest = NULL;
+const char *manifest_path = NULL;
+
+// hash decompressed content, set by --decompress; standard input is read
+// when no file is named
+bool decompress = false;
+bool named_files = false;
+
+// hash files with the kernel crypto API, set by --kernel
+bool kernel = false;
+
+// last signal caught while following a file with --follow
+volatile sig_atomic_t follow_signal = 0;
+
+// MD5File option flags, set by --direct and --huge-pages
+int file_flags = 0;
+
+// returned from main, non-zero once an argument or file failed
+int exit_status = 0;
+
 int main(int argc, char **argv)
 {
   output = (char*) calloc(OUTPUT_LEN, sizeof(char));
@@ -98,21 +224,293 @@ int main(int argc, char **argv)
       {
         MDPrint(HELP);
       }
+      else if (strcmp(argv[i], "--stats") == 0)
+      {
+        if (stats == NULL)
+        {
+          stats = new MD5RunStats();
+        }
+      }
+      else if ((strcmp(argv[i], "--stats-json") == 0) && (i + 1 < argc))
+      {
+        if (stats == NULL)
+        {
+          stats = new MD5RunStats();
+        }
+        stats_json = argv[++i];
+      }
+      else if ((strcmp(argv[i], "--cache") == 0) && (i + 1 < argc))
+      {
+        if (cache == NULL)
+        {
+          cache = new MD5Cache();
+        }
+        if (!cache->open(argv[++i]))
+        {
+          delete cache;
+          cache = NULL;
+        }
+        if (MDCacheConflict())
+        {
+          break;
+        }
+      }
+      else if ((strcmp(argv[i], "--copy") == 0) && (i + 2 < argc))
+      {
+        MDCopy(argv[i + 1], argv[i + 2]);
+        i += 2;
+      }
+      else if ((strcmp(argv[i], "--parallel") == 0) && (i + 1 < argc))
+      {
+        size_t threads;
+        if (!MDParseSize("--parallel thread count", argv[++i], 0, MD5Parallel::MAX_THREADS, threads))
+        {
+          break;
+        }
+        parallel = true;
+        parallel_threads = (int) threads;
+        if (MDCacheConflict())
+        {
+          break;
+        }
+      }
+      else if ((strcmp(argv[i], "--placement") == 0) && (i + 1 < argc))
+      {
+        if (!MD5Parallel::parse_placement(argv[++i], placement))
+        {
+          snprintf(output, OUTPUT_LEN, "Unknown placement %s\n", argv[i]);
+          MDPrint(output);
+        }
+      }
+      else if ((strcmp(argv[i], "--topology") == 0) && (i + 1 < argc))
+      {
+        topology_spec = argv[++i];
+      }
+      else if (strcmp(argv[i], "--show-placement") == 0)
+      {
+        show_placement = true;
+      }
+      else if (strcmp(argv[i], "--decompress") == 0)
+      {
+        decompress = true;
+        if (MDCacheConflict())
+        {
+          break;
+        }
+      }
+      else if (strcmp(argv[i], "--kernel") == 0)
+      {
+        kernel = MD5Kernel::available();
+        if (!kernel)
+        {
+          MDPrint("AF_ALG md5 is not available, using the built in transform\n");
+        }
+        if (MDCacheConflict())
+        {
+          break;
+        }
+      }
+      else if (strcmp(argv[i], "--direct") == 0)
+      {
+        file_flags |= MD5File::DIRECT;
+        if (MDCacheConflict())
+        {
+          break;
+        }
+      }
+      else if (strcmp(argv[i], "--huge-pages") == 0)
+      {
+        file_flags |= MD5File::HUGE_PAGES;
+        if (MDCacheConflict())
+        {
+          break;
+        }
+      }
+      else if ((strcmp(argv[i], "--tlb-bench") == 0) && (i + 1 < argc))
+      {
+        MDTlbBench(argv[++i]);
+      }
+      else if ((strcmp(argv[i], "--kernel-bench") == 0) && (i + 1 < argc))
+      {
+        MDKernelBench(argv[++i]);
+      }
+      else if ((strcmp(argv[i], "--signature") == 0) && (i + 3 < argc))
+      {
+        MDSignature(argv[i + 1], argv[i + 2], argv[i + 3]);
+        i += 3;
+      }
+      else if ((strcmp(argv[i], "--delta") == 0) && (i + 2 < argc))
+      {
+        MDDelta(argv[i + 1], argv[i + 2]);
+        i += 2;
+      }
+      else if ((strcmp(argv[i], "--chunks") == 0) && (i + 4 < argc))
+      {
+        MDChunks(argv[i + 1], argv[i + 2], argv[i + 3], argv[i + 4]);
+        i += 4;
+      }
+      else if ((strcmp(argv[i], "--tree") == 0) && (i + 2 < argc))
+      {
+        MDTree(argv[i + 1], argv[i + 2]);
+        i += 2;
+      }
+      else if ((strcmp(argv[i], "--tree-update") == 0) && (i + 2 < argc))
+      {
+        MDTreeUpdate(argv[i + 1], argv[i + 2]);
+        i += 2;
+      }
+      else if ((strcmp(argv[i], "--tree-verify") == 0) && (i + 3 < argc))
+      {
+        MDTreeVerify(argv[i + 1], argv[i + 2], argv[i + 3]);
+        i += 3;
+      }
+      else if ((strcmp(argv[i], "--known-build") == 0) && (i + 2 < argc))
+      {
+        if (MD5HashSet::build(argv[i + 1], argv[i + 2]))
+        {
+          MD5HashSet set;
+          set.open(argv[i + 2]);
+          snprintf(output, OUTPUT_LEN, "MD5 set (%s) = %zu hashes\n", argv[i + 2], set.size());
+          MDPrint(output);
+        }
+        i += 2;
+      }
+      else if ((strcmp(argv[i], "--known") == 0) && (i + 1 < argc))
+      {
+        if (known == NULL)
+        {
+          known = new MD5HashSet();
+        }
+        if (!known->open(argv[++i]))
+        {
+          delete known;
+          known = NULL;
+        }
+      }
+      else if (((strcmp(argv[i], "--manifest") == 0) || (strcmp(argv[i], "--manifest-z") == 0)) &&
+               (i + 1 < argc))
+      {
+        uint32_t flags = (strcmp(argv[i], "--manifest-z") == 0) ? MD5Manifest::COMPRESS : 0;
+        if (manifest == NULL)
+        {
+          manifest = new MD5ManifestWriter();
+        }
+        else
+        {
+          MDManifestClose();
+        }
+        manifest_path = argv[++i];
+        if (!manifest->open(manifest_path, flags))
+        {
+          exit_status = 1;
+          delete manifest;
+          manifest = NULL;
+        }
+        if (MDCacheConflict())
+        {
+          break;
+        }
+      }
+      else if ((strcmp(argv[i], "--manifest-find") == 0) && (i + 2 < argc))
+      {
+        MDManifestFind(argv[i + 1], argv[i + 2]);
+        i += 2;
+      }
+      else if ((strcmp(argv[i], "--to-md5sum") == 0) && (i + 1 < argc))
+      {
+        if (!MD5Manifest::to_md5sum(argv[++i], stdout))
+        {
+          snprintf(output, OUTPUT_LEN, "Unable to read manifest %s\n", argv[i]);
+          MDPrint(output);
+        }
+      }
+      else if ((strcmp(argv[i], "--from-md5sum") == 0) && (i + 2 < argc))
+      {
+        FILE *f = (strcmp(argv[i + 1], "-") == 0) ? stdin : fopen(argv[i + 1], "r");
+        if ((f == NULL) || !MD5Manifest::from_md5sum(f, argv[i + 2], MD5Manifest::COMPRESS))
+        {
+          snprintf(output, OUTPUT_LEN, "Unable to convert %s\n", argv[i + 1]);
+          MDPrint(output);
+        }
+        if ((f != NULL) && (f != stdin))
+        {
+          fclose(f);
+        }
+        i += 2;
+      }
+      else if ((strcmp(argv[i], "--prefixes") == 0) && (i + 2 < argc))
+      {
+        MDPrefixes(argv[i + 1], argv[i + 2]);
+        i += 2;
+      }
+      else if ((strcmp(argv[i], "--follow") == 0) && (i + 2 < argc))
+      {
+        MDFollow(argv[i + 1], argv[i + 2]);
+        i += 2;
+      }
+      else if ((strcmp(argv[i], "--tar") == 0) && (i + 1 < argc))
+      {
+        MDTar(argv[++i]);
+      }
+      else if (manifest != NULL)
+      {
+        MDManifestFile(argv[i]);
+        named_files = true;
+      }
+      else if (parallel)
+      {
+        parallel_files.push_back(argv[i]);
+        named_files = true;
+      }
       else
       {
         MDFile(argv[i]);
+        named_files = true;
       }
     }
+    if (parallel)
+    {
+      MDParallel();
+    }
+    if (decompress && !named_files && (exit_status == 0))
+    {
+      MDFilter(stdin);
+    }
   }
   else
   {
     MDFilter(stdin);
   }
+  if (stats != NULL)
+  {
+    if (stats_json == NULL)
+    {
+      stats->print(stderr);
+    }
+    else if (!stats->write_json(stats_json))
+    {
+      perror("Failed to write stats.\n");
+    }
+    delete stats;
+  }
   if (output != NULL)
   {
     free(output);
   }
-  return 0;
+  if (cache != NULL)
+  {
+    delete cache;
+  }
+  if (known != NULL)
+  {
+    delete known;
+  }
+  if (manifest != NULL)
+  {
+    MDManifestClose();
+    delete manifest;
+  }
+  return exit_status;
 }
 
 /* Digests a c_string and prints the result */
@@ -190,6 +588,34 @@ void MDTimeTrial(void)
   }
 }
 
+/* Stream buffer that takes at most room bytes, for the short write check */
+class MDShortStreambuf : public streambuf {
+
+public:
+
+  string taken;
+  size_t room;
+
+  MDShortStreambuf(size_t room) : room(room) {}
+
+protected:
+
+  streamsize xsputn(const char *s, streamsize n)
+  {
+    streamsize len = min(n, (streamsize) (this->room - this->taken.size()));
+    this->taken.append(s, len);
+    return len;
+  }
+
+  int_type overflow(int_type c)
+  {
+    char ch = traits_type::to_char_type(c);
+    return (traits_type::eq_int_type(c, traits_type::eof()) || (xsputn(&ch, 1) == 1)) ?
+           traits_type::not_eof(c) : traits_type::eof();
+  }
+
+};
+
 /* Digests a reference suite of strings and prints the results */
 void MDTestSuite(void)
 {
@@ -202,6 +628,27 @@ void MDTestSuite(void)
   MDString("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789");
   MDString("12345678901234567890123456789012345678901234567890123456789012345678901234567890");
 
+  // lengths around the 448 bit length field of the final block
+  static const size_t PAD_LENS[] = { 55, 56, 57, 63, 64 };
+  static const char *PAD_DIGESTS[] = { "ef1772b6dff9a122358552954ad0df65",
+                                       "3b0c8ac703f828b04c6c197006d17218",
+                                       "652b906d60af96844ebd21b674f35e93",
+                                       "b06521f39153d618550606be297466d5",
+                                       "014842d480b571495a4a0363793f7367" };
+  char a_block[64];
+  memset(a_block, 'a', sizeof(a_block));
+  for (size_t i = 0; i < sizeof(PAD_LENS) / sizeof(PAD_LENS[0]); i++)
+  {
+    unsigned char pad_hash[MD5::HASH_LEN + 1];
+    char pad_digest[MD5::DIGEST_LEN + 1];
+    memset(pad_digest, '\0', sizeof(pad_digest));
+    MD5::make_hash(a_block, PAD_LENS[i], pad_hash);
+    MD5::make_digest(pad_hash, pad_digest);
+    snprintf(output, OUTPUT_LEN, "MD5 (%zu x \"a\") = %s %s\n", PAD_LENS[i], pad_digest,
+             (strcmp(pad_digest, PAD_DIGESTS[i]) == 0) ? "ok" : "FAILED");
+    MDPrint(output);
+  }
+
   char str1[] = "message digest";
   char str2[] = "message digesu";
   char str3[] = "";
@@ -238,14 +685,401 @@ void MDTestSuite(void)
   MDPrint(output);
   snprintf(output, OUTPUT_LEN, "hash3 == hash1 := %d\n", MD5::comp_hash(hash3, hash1));
   MDPrint(output);
+
+  // hash while writing through an ostream
+  MD5Streambuf sb;
+  ostream os(&sb);
+  os << str1;
+  sb.hash(hash3);
+  MD5::make_digest(hash3, digest3);
+  snprintf(output, OUTPUT_LEN, "ostream (\"%s\") = %s\n", str1, digest3);
+  MDPrint(output);
+
+  // streaming: every split of one message into two update() calls
+  static const char DIGITS[] = "12345678901234567890123456789012345678901234567890123456789012345678901234567890";
+  static const char DIGITS_DIGEST[] = "57edf4a22be3c955ac49da2e2107b67a";
+  bool split_ok = true;
+  for (size_t split = 0; split <= strlen(DIGITS); split++)
+  {
+    MD5 context;
+    context.update(DIGITS, split);
+    context.update(DIGITS + split, strlen(DIGITS) - split);
+    context.finish(hash1);
+    MD5::make_digest(hash1, digest1);
+    split_ok = split_ok && (strcmp(digest1, DIGITS_DIGEST) == 0);
+  }
+  MDCheck("update/finish split", split_ok);
+
+  // scatter-gather: segments straddling block boundaries, one of them empty
+  struct iovec iov[4];
+  iov[0].iov_base = (void *) DIGITS;
+  iov[0].iov_len = 37;
+  iov[1].iov_base = (void *) (DIGITS + 37);
+  iov[1].iov_len = 0;
+  iov[2].iov_base = (void *) (DIGITS + 37);
+  iov[2].iov_len = 30;
+  iov[3].iov_base = (void *) (DIGITS + 67);
+  iov[3].iov_len = strlen(DIGITS) - 67;
+  MD5::make_hash(iov, 4, hash1);
+  MD5::make_digest(hash1, digest1);
+  MDCheck("make_hash(iovec)", strcmp(digest1, DIGITS_DIGEST) == 0);
+
+  // prefix hashes from memory and from a stream; the last prefix covers
+  // the whole message, one past its end is left null
+  static const size_t PREFIXES[] = { 0, 1, 55, 64, 80, MD5::PREFIX_END, 100 };
+  static const size_t PREFIX_COUNT = sizeof(PREFIXES) / sizeof(PREFIXES[0]);
+  unsigned char prefixes[2][PREFIX_COUNT * (MD5::HASH_LEN + 1)];
+  MD5::make_prefix_hashes(DIGITS, strlen(DIGITS), PREFIXES, PREFIX_COUNT, prefixes[0]);
+  FILE *prefix_file = tmpfile();
+  bool prefix_ok = (prefix_file != NULL) && (fputs(DIGITS, prefix_file) >= 0) &&
+                   (fseek(prefix_file, 0, SEEK_SET) == 0) &&
+                   !MD5::make_prefix_hashes(prefix_file, PREFIXES, PREFIX_COUNT, prefixes[1]);
+  for (size_t i = 0; prefix_ok && (i < PREFIX_COUNT); i++)
+  {
+    memset(hash1, '\0', sizeof(hash1));
+    if (PREFIXES[i] <= strlen(DIGITS))
+    {
+      MD5::make_hash(DIGITS, PREFIXES[i], hash1);
+    }
+    else if (PREFIXES[i] == MD5::PREFIX_END)
+    {
+      MD5::make_hash(DIGITS, strlen(DIGITS), hash1);
+    }
+    prefix_ok = (memcmp(prefixes[0] + i * (MD5::HASH_LEN + 1), hash1, MD5::HASH_LEN) == 0) &&
+                (memcmp(prefixes[1] + i * (MD5::HASH_LEN + 1), hash1, MD5::HASH_LEN) == 0);
+  }
+  MD5::make_digest(prefixes[1] + 4 * (MD5::HASH_LEN + 1), digest1);
+  MDCheck("make_prefix_hashes", prefix_ok && (strcmp(digest1, DIGITS_DIGEST) == 0));
+
+  // tee into a stream that first takes 10 bytes: the short write fails and
+  // only what got through is hashed, the retry completes without rehashing
+  MDShortStreambuf short_sb(10);
+  MD5Streambuf tee(&short_sb);
+  tee.sputn(DIGITS, strlen(DIGITS));
+  bool tee_ok = (tee.pubsync() == -1);
+  tee.hash(hash3);
+  MD5::make_hash(DIGITS, 10, hash1);
+  tee_ok = tee_ok && (memcmp(hash3, hash1, MD5::HASH_LEN) == 0);
+  short_sb.room = 1000;
+  tee_ok = tee_ok && (tee.pubsync() == 0) && (short_sb.taken == DIGITS);
+  tee.hash(hash3);
+  MD5::make_digest(hash3, digest3);
+  MDCheck("MD5Streambuf short write", tee_ok && (strcmp(digest3, DIGITS_DIGEST) == 0));
+
+  // hash while reading through an istream: a partial read, single
+  // characters, and a read larger than the buffer that bypasses it
+  string long_text;
+  for (int i = 0; long_text.size() < 3 * MD5IStreambuf::BUFFER_LEN; i++)
+  {
+    long_text += to_string(i);
+  }
+  stringbuf source(string(DIGITS) + long_text);
+  MD5IStreambuf isb(&source);
+  istream is(&isb);
+  vector<char> got(long_text.size());
+  is.read(&got[0], 10);
+  isb.hash(hash3);
+  MD5::make_hash(DIGITS, 10, hash1);
+  bool istream_ok = (memcmp(hash3, hash1, MD5::HASH_LEN) == 0);
+  for (size_t i = 10; i < strlen(DIGITS); i++)
+  {
+    istream_ok = istream_ok && (is.get() == DIGITS[i]);
+  }
+  isb.hash(hash3);
+  MD5::make_digest(hash3, digest3);
+  istream_ok = istream_ok && (strcmp(digest3, DIGITS_DIGEST) == 0);
+  is.read(&got[0], got.size());
+  isb.hash(hash3);
+  MD5::make_hash((string(DIGITS) + long_text).c_str(), strlen(DIGITS) + long_text.size(), hash1);
+  istream_ok = istream_ok && (is.gcount() == (streamsize) got.size()) &&
+               (memcmp(&got[0], long_text.data(), got.size()) == 0) &&
+               (memcmp(hash3, hash1, MD5::HASH_LEN) == 0);
+  MDCheck("MD5IStreambuf", istream_ok);
+  if (prefix_file != NULL)
+  {
+    fclose(prefix_file);
+  }
+
+  // single pass MD5, CRC32C and xxHash64, fed in uneven pieces
+  uint32_t crc;
+  uint64_t xxh;
+  MD5Multi multi;
+  multi.update(DIGITS, 5);
+  multi.update(DIGITS + 5, 40);
+  multi.update(DIGITS + 45, strlen(DIGITS) - 45);
+  multi.finish(hash1, &crc, &xxh);
+  MD5::make_digest(hash1, digest1);
+  MDCheck("MD5Multi md5", strcmp(digest1, DIGITS_DIGEST) == 0);
+  MDCheck("MD5Multi crc32c", crc == 0x477a6781);
+  MDCheck("MD5Multi xxh64", xxh == 0xe04a477f19ee145dULL);
+  MDCheck("crc32c_sw (\"123456789\")", (MD5Multi::crc32c_sw(0xffffffff, "123456789", 9) ^ 0xffffffff) == 0xe3069283);
+  MD5Multi xxh_only(MD5Multi::XXH64);
+  xxh_only.update("abc", 3);
+  xxh_only.finish(hash1, &crc, &xxh);
+  MDCheck("xxh64 (\"abc\")", xxh == 0x44bc2cf5ad770999ULL);
+
+  // ketama routing of "key0".."key31", one at a time and batched, before and
+  // after a node leaves the ring
+  static const char RING_ROUTES[] = "20201022100010000111121200011221";
+  static const char RING_ROUTES_REMOVED[] = "20200022200020000002222200000220";
+  MD5Ring ring;
+  ring.add("10.0.0.1:11211");
+  ring.add("10.0.0.2:11211");
+  ring.add("10.0.0.3:11211");
+  string keys[32];
+  uint32_t nodes[32];
+  char routes[33];
+  char batched[33];
+  memset(routes, '\0', sizeof(routes));
+  memset(batched, '\0', sizeof(batched));
+  for (int pass = 0; pass < 2; pass++)
+  {
+    for (int i = 0; i < 32; i++)
+    {
+      keys[i] = "key" + to_string(i);
+      routes[i] = '0' + ring.route(keys[i]);
+    }
+    ring.route(keys, 32, nodes);
+    for (int i = 0; i < 32; i++)
+    {
+      batched[i] = '0' + nodes[i];
+    }
+    const char *expected = (pass == 0) ? RING_ROUTES : RING_ROUTES_REMOVED;
+    MDCheck((pass == 0) ? "MD5Ring route" : "MD5Ring route after remove",
+            (strcmp(routes, expected) == 0) && (strcmp(batched, expected) == 0));
+    ring.remove(1);
+  }
+
+  // rsync style delta: a target with 100 bytes inserted is rebuilt from the
+  // basis blocks and literal runs, after a signature file round trip
+  vector<char> basis(10000);
+  uint32_t seed = 1;
+  for (size_t i = 0; i < basis.size(); i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    basis[i] = (char) (seed >> 16);
+  }
+  vector<char> target(basis.begin(), basis.begin() + 3000);
+  target.insert(target.end(), 100, 'x');
+  target.insert(target.end(), basis.begin() + 3000, basis.end());
+  string basis_path = MDTempFile(&basis[0], basis.size());
+  string target_path = MDTempFile(&target[0], target.size());
+  MD5Sync::Signature sig;
+  MD5Sync::Signature reread;
+  vector<MD5Sync::Op> ops;
+  FILE *sig_file = tmpfile();
+  bool sync_ok = !basis_path.empty() && !target_path.empty() && (sig_file != NULL) &&
+                 MD5Sync::make_signature(basis_path.c_str(), 1024, sig) &&
+                 MD5Sync::write_signature(sig_file, sig) && (fseek(sig_file, 0, SEEK_SET) == 0) &&
+                 MD5Sync::read_signature(sig_file, reread) &&
+                 MD5Sync::match(target_path.c_str(), reread, ops);
+  vector<char> rebuilt;
+  size_t copied = 0;
+  for (size_t i = 0; sync_ok && (i < ops.size()); i++)
+  {
+    if (ops[i].block >= 0)
+    {
+      size_t start = ops[i].block * 1024;
+      rebuilt.insert(rebuilt.end(), basis.begin() + start, basis.begin() + min(start + 1024, basis.size()));
+      copied++;
+    }
+    else
+    {
+      rebuilt.insert(rebuilt.end(), target.begin() + ops[i].offset, target.begin() + ops[i].offset + ops[i].len);
+    }
+  }
+  MDCheck("MD5Sync delta round trip", sync_ok && (copied == 9) && (rebuilt == target));
+
+  // content defined chunking: cut points of the basis, streamed in uneven
+  // pieces and from the file on hashing threads; after the insertion the
+  // target chunks line up with the basis again
+  static const char CHUNK_OFFSETS[] = "0 1082 2329 3608 4715 5804 6914 8128 8648";
+  MD5Chunker chunker(256, 1024, 4096);
+  vector<MD5Chunker::Chunk> streamed;
+  vector<MD5Chunker::Chunk> mapped;
+  vector<MD5Chunker::Chunk> shifted;
+  chunker.update(&basis[0], 1000, streamed);
+  chunker.update(&basis[1000], basis.size() - 1000, streamed);
+  chunker.finish(streamed);
+  chunker.update(&target[0], target.size(), shifted);
+  chunker.finish(shifted);
+  bool chunks_ok = !basis_path.empty() && chunker.chunk_file(basis_path.c_str(), mapped, 2) &&
+                   (mapped.size() == streamed.size());
+  string offsets;
+  for (size_t i = 0; i < streamed.size(); i++)
+  {
+    offsets += ((i > 0) ? " " : "") + to_string(streamed[i].offset);
+    chunks_ok = chunks_ok && (i < mapped.size()) && (mapped[i].offset == streamed[i].offset) &&
+                (mapped[i].len == streamed[i].len) && (mapped[i].hash == streamed[i].hash) &&
+                (streamed[i].hash == MD5Hash::make_MD5Hash(&basis[streamed[i].offset], streamed[i].len));
+  }
+  for (size_t i = 3; chunks_ok && (i < streamed.size()) && (shifted.size() >= streamed.size()); i++)
+  {
+    size_t j = shifted.size() - (streamed.size() - i);
+    chunks_ok = chunks_ok && (shifted[j].offset == streamed[i].offset + 100) && (shifted[j].hash == streamed[i].hash);
+  }
+  MDCheck("MD5Chunker boundaries", chunks_ok && (offsets == CHUNK_OFFSETS));
+
+  // Merkle root over 1024 byte leaves, MD5Lanes runs and a short tail, kept
+  // across a sidecar round trip
+  static const char TREE_ROOT[] = "06fc5b5db7ee436c704dba0a681c65e8";
+  MD5Merkle tree;
+  MD5Merkle reloaded;
+  string sidecar = MD5Merkle::sidecar_path(basis_path.c_str());
+  bool tree_ok = !basis_path.empty() && tree.build(basis_path.c_str(), 1024) && tree.save(sidecar.c_str()) &&
+                 reloaded.load(sidecar.c_str()) && reloaded.verify_range(basis_path.c_str(), 3000, 100);
+  reloaded.root(hash1);
+  MD5::make_digest(hash1, digest1);
+  MDCheck("MD5Merkle root", tree_ok && (strcmp(digest1, TREE_ROOT) == 0));
+  unlink(sidecar.c_str());
+
+  // known hash set: md5sum style list of "0".."199" with a duplicate and a
+  // junk line, with and without the Bloom filter; "200".."999" are absent
+  string list;
+  for (int i = 0; i < 200; i++)
+  {
+    string text = to_string(i);
+    list += MD5Hash::make_MD5Hash(text).c_str() + string("  ") + text + "\n";
+  }
+  list += MD5Hash::make_MD5Hash(string("7")).c_str() + string("  dup\nnot a hash\n");
+  string list_path = MDTempFile(list.c_str(), list.length());
+  string set_path = list_path + ".set";
+  bool set_ok = !list_path.empty();
+  for (int bloom_bits = 0; set_ok && (bloom_bits <= 10); bloom_bits += 10)
+  {
+    MD5HashSet set;
+    set_ok = MD5HashSet::build(list_path.c_str(), set_path.c_str(), bloom_bits) &&
+             set.open(set_path.c_str()) && (set.size() == 200);
+    for (int i = 0; set_ok && (i < 1000); i++)
+    {
+      string text = to_string(i);
+      MD5::make_hash(text.c_str(), text.length(), hash1);
+      set_ok = (set.contains(hash1) == (i < 200));
+    }
+    unlink(set_path.c_str());
+  }
+  MDCheck("MD5HashSet membership", set_ok);
+  unlink(list_path.c_str());
+
+  // binary manifest: 1500 records over two blocks, plain and compressed,
+  // each found again by path
+  string manifest_file = basis_path + ".mf";
+  bool manifest_ok = !basis_path.empty();
+  for (uint32_t flags = 0; manifest_ok && (flags <= MD5Manifest::COMPRESS); flags += MD5Manifest::COMPRESS)
+  {
+    MD5ManifestWriter writer;
+    manifest_ok = writer.open(manifest_file.c_str(), flags);
+    for (int i = 0; manifest_ok && (i < 1500); i++)
+    {
+      string text = to_string(i);
+      MD5::make_hash(text.c_str(), text.length(), hash1);
+      manifest_ok = writer.add(("dir/file-" + text).c_str(), hash1, i, -i);
+    }
+    manifest_ok = writer.close() && manifest_ok;
+    MD5ManifestReader reader;
+    MD5Manifest::Record record;
+    manifest_ok = manifest_ok && reader.open(manifest_file.c_str()) && (reader.blocks() == 2) &&
+                  !reader.find("dir/file-1500", record);
+    for (int i = 0; manifest_ok && (i < 1500); i++)
+    {
+      string text = to_string(i);
+      MD5::make_hash(text.c_str(), text.length(), hash1);
+      manifest_ok = reader.find(("dir/file-" + text).c_str(), record) &&
+                    (memcmp(record.hash, hash1, MD5::HASH_LEN) == 0) &&
+                    (record.size == (uint64_t) i) && (record.mtime_ns == -i);
+    }
+    unlink(manifest_file.c_str());
+  }
+  MDCheck("MD5Manifest round trip", manifest_ok);
+
+  if (sig_file != NULL)
+  {
+    fclose(sig_file);
+  }
+  unlink(basis_path.c_str());
+  unlink(target_path.c_str());
+}
+
+/* --cache stores digests of the raw file contents, computed its own way, so
+ * it can not be combined with options that change how or what is hashed,
+ * nor with --parallel and --manifest, which do not consult it.
+ * Reports the conflict and sets a failing exit status. */
+bool MDCacheConflict(void)
+{
+  if ((cache == NULL) || (!decompress && !kernel && (file_flags == 0) && !parallel && (manifest == NULL)))
+  {
+    return false;
+  }
+  MDPrint("--cache can not be combined with --decompress, --kernel, --direct, --huge-pages, --parallel or --manifest\n");
+  if (manifest != NULL)
+  {
+    // abandoned, so no empty manifest is left behind
+    delete manifest;
+    manifest = NULL;
+  }
+  exit_status = 1;
+  return true;
+}
+
+/* Parses a decimal command line length in [min, max] into value. Reports
+ * what is wrong and sets a failing exit status when it is not one. */
+bool MDParseSize(const char *what, const char *arg, size_t min, size_t max, size_t &value)
+{
+  char *end = NULL;
+  errno = 0;
+  unsigned long long n = strtoull(arg, &end, 10);
+  if ((end == arg) || (*end != '\0') || (arg[0] == '-') || (errno != 0) || (n < min) || (n > max))
+  {
+    snprintf(output, OUTPUT_LEN, "Invalid %s %s, expected %zu to %zu\n", what, arg, min, max);
+    MDPrint(output);
+    exit_status = 1;
+    return false;
+  }
+  value = n;
+  return true;
+}
+
+/* Writes len bytes to a new temporary file for the test suite, returns its
+ * path or an empty string on error */
+string MDTempFile(const char *data, size_t len)
+{
+  char path[] = "/tmp/md5-testXXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+  {
+    return string();
+  }
+  bool ok = (write(fd, data, len) == (ssize_t) len);
+  if ((close(fd) != 0) || !ok)
+  {
+    unlink(path);
+    return string();
+  }
+  return path;
+}
+
+/* Prints the outcome of a known answer check of the test suite */
+void MDCheck(const char *name, bool ok)
+{
+  snprintf(output, OUTPUT_LEN, "%s = %s\n", name, ok ? "ok" : "FAILED");
+  MDPrint(output);
 }
 
 /* Digests a file and prints the result */
 void MDFile(const char *filename)
 {
   FILE *f;
+  uint64_t t = 0;
+
+  if (stats != NULL)
+  {
+    stats->begin_file(filename);
+    t = MD5RunStats::now();
+  }
+  f = fopen(filename, "rb");
+  t = MDLap(MD5RunStats::OPEN, t);
 
-  if ((f = fopen(filename, "rb")) == NULL)
+  if (f == NULL)
   {
     snprintf(output, OUTPUT_LEN, "Unable to open file %s\n", filename);
     MDPrint(output);
@@ -254,7 +1088,13 @@ void MDFile(const char *filename)
   {
     snprintf(output, OUTPUT_LEN, "MD5 (%s) = ", filename);
     MDPrint(output);
+    MDLap(MD5RunStats::PRINT, t);
     MDFilter(f);
+    fclose(f);
+  }
+  if (stats != NULL)
+  {
+    stats->end_file();
   }
 }
 
@@ -265,14 +1105,878 @@ void MDFilter(FILE *f)
   memset(hash, '\0', sizeof(hash));
   char digest[MD5::DIGEST_LEN + 1];
   memset(digest, '\0', sizeof(digest));
-  MD5::make_hash(f, hash);
+  const char *failed = NULL;   // printed instead of the digest
+  uint64_t t = (stats != NULL) ? MD5RunStats::now() : 0;
+  if (cache != NULL)
+  {
+    // cached lookups are not split into phases
+    cache->make_hash(f, hash);
+    t = MDLap(MD5RunStats::READ, t);
+    MDChargeBytes(f);
+  }
+  else if (decompress)
+  {
+    if (!MD5Decompress::make_hash(fileno(f), hash, thread::hardware_concurrency()))
+    {
+      failed = "unable to decompress";
+    }
+    t = MDLap(MD5RunStats::READ, t);
+    MDChargeBytes(f);
+  }
+  else if (kernel)
+  {
+    off_t start = lseek(fileno(f), 0, SEEK_CUR);
+    if (!MD5Kernel::make_hash(fileno(f), hash))
+    {
+      // the built in transform takes over when the input can be read again
+      if ((start >= 0) && (lseek(fileno(f), start, SEEK_SET) == start))
+      {
+        MD5::make_hash(f, hash);
+      }
+      else
+      {
+        failed = "AF_ALG md5 failed";
+      }
+    }
+    t = MDLap(MD5RunStats::READ, t);
+    MDChargeBytes(f);
+  }
+  else if (file_flags != 0)
+  {
+    if (!MD5File::make_hash(fileno(f), hash, file_flags))
+    {
+      failed = "unable to read";
+    }
+    t = MDLap(MD5RunStats::READ, t);
+    MDChargeBytes(f);
+  }
+  else if (stats != NULL)
+  {
+    MDTimedHash(f, hash);
+    t = MD5RunStats::now();
+  }
+  else
+  {
+    MD5::make_hash(f, hash);
+  }
+  if (failed != NULL)
+  {
+    snprintf(output, OUTPUT_LEN, "%s\n", failed);
+    MDPrint(output);
+    exit_status = 1;
+    MDLap(MD5RunStats::PRINT, t);
+    return;
+  }
   MD5::make_digest(hash, digest);
-  snprintf(output, OUTPUT_LEN, "%s\n", digest);
+  bool is_known = (known != NULL) && known->contains(hash);
+  snprintf(output, OUTPUT_LEN, is_known ? "%s known\n" : "%s\n", digest);
   MDPrint(output);
+  MDLap(MD5RunStats::PRINT, t);
+}
+
+/* Digests the files collected by --parallel and prints the results in order */
+void MDParallel(void)
+{
+  MD5Topology topology = (topology_spec != NULL) ? MD5Topology::parse(topology_spec)
+                                                 : MD5Topology::detect();
+  MD5Parallel engine(topology, parallel_threads, placement, file_flags);
+  size_t n = parallel_files.size();
+  if (n == 0)
+  {
+    return;
+  }
+
+  vector<unsigned char> hashes(n * (MD5::HASH_LEN + 1) + 1);
+  bool *ok = new bool[n + 1];
+  char digest[MD5::DIGEST_LEN + 1];
+  memset(digest, '\0', sizeof(digest));
+
+  vector<uint64_t> ns(n + 1);
+  size_t attempted = engine.make_hashes(&parallel_files[0], n, &hashes[0], ok, &ns[0]);
+  if (show_placement)
+  {
+    // after the run, so it shows the pinning that took effect
+    engine.print_placement(stdout);
+  }
+  for (size_t i = 0; i < n; i++)
+  {
+    struct stat st;
+    if (stats != NULL)
+    {
+      stats->add_file(parallel_files[i], ns[i], (ok[i] && (stat(parallel_files[i], &st) == 0)) ? st.st_size : 0);
+    }
+    if (ok[i])
+    {
+      MD5::make_digest(&hashes[i * (MD5::HASH_LEN + 1)], digest);
+      snprintf(output, OUTPUT_LEN, "MD5 (%s) = %s\n", parallel_files[i], digest);
+    }
+    else if (i < attempted)
+    {
+      snprintf(output, OUTPUT_LEN, "Unable to open file %s\n", parallel_files[i]);
+    }
+    else
+    {
+      snprintf(output, OUTPUT_LEN, "Unable to allocate a read buffer for %s\n", parallel_files[i]);
+    }
+    if (!ok[i])
+    {
+      exit_status = 1;
+    }
+    MDPrint(output);
+  }
+  delete[] ok;
+}
+
+/* Copies a file, digesting it in the same pass, and prints the result */
+void MDCopy(const char *src, const char *dst)
+{
+  unsigned char hash[MD5::HASH_LEN + 1];
+  memset(hash, '\0', sizeof(hash));
+  char digest[MD5::DIGEST_LEN + 1];
+  memset(digest, '\0', sizeof(digest));
+
+  if (!MD5File::copy(src, dst, hash, file_flags))
+  {
+    snprintf(output, OUTPUT_LEN, "Unable to copy %s to %s\n", src, dst);
+    MDPrint(output);
+    exit_status = 1;
+    return;
+  }
+  MD5::make_digest(hash, digest);
+  snprintf(output, OUTPUT_LEN, "MD5 (%s) = %s\n", dst, digest);
+  MDPrint(output);
+}
+
+/* Writes the block signature of filename to sigfile */
+void MDSignature(const char *filename, const char *block_len, const char *sigfile)
+{
+  MD5Sync::Signature sig;
+  size_t len = 0;
+  if (!MDParseSize("block length", block_len, 1, MD5Sync::MAX_BLOCK_LEN, len))
+  {
+    return;
+  }
+  if (!MD5Sync::make_signature(filename, len, sig))
+  {
+    snprintf(output, OUTPUT_LEN, "Unable to read file %s\n", filename);
+    MDPrint(output);
+    return;
+  }
+  FILE *f = fopen(sigfile, "wb");
+  if ((f == NULL) || !MD5Sync::write_signature(f, sig) || (fclose(f) != 0))
+  {
+    snprintf(output, OUTPUT_LEN, "Unable to write signature %s\n", sigfile);
+    MDPrint(output);
+    return;
+  }
+  snprintf(output, OUTPUT_LEN, "MD5 signature (%s) = %zu blocks of %u bytes\n",
+           filename, sig.blocks.size(), sig.block_len);
+  MDPrint(output);
+}
+
+/* Matches filename against a signature file and prints the delta */
+void MDDelta(const char *sigfile, const char *filename)
+{
+  MD5Sync::Signature sig;
+  vector<MD5Sync::Op> ops;
+  FILE *f = fopen(sigfile, "rb");
+  bool ok = (f != NULL) && MD5Sync::read_signature(f, sig);
+  if (f != NULL)
+  {
+    fclose(f);
+  }
+  if (!ok)
+  {
+    snprintf(output, OUTPUT_LEN, "Unable to read signature %s\n", sigfile);
+    MDPrint(output);
+    return;
+  }
+  if (!MD5Sync::match(filename, sig, ops))
+  {
+    snprintf(output, OUTPUT_LEN, "Unable to read file %s\n", filename);
+    MDPrint(output);
+    return;
+  }
+
+  size_t copied = 0, runs = 0;
+  uint64_t literal = 0;
+  for (size_t i = 0; i < ops.size(); i++)
+  {
+    if (ops[i].block >= 0)
+    {
+      copied++;
+      continue;
+    }
+    runs++;
+    literal += ops[i].len;
+    snprintf(output, OUTPUT_LEN, "literal %llu +%llu\n",
+             (unsigned long long) ops[i].offset, (unsigned long long) ops[i].len);
+    MDPrint(output);
+  }
+  snprintf(output, OUTPUT_LEN, "MD5 delta (%s) = %zu blocks matched, %llu literal bytes in %zu runs\n",
+           filename, copied, (unsigned long long) literal, runs);
+  MDPrint(output);
+}
+
+/* Splits a file into content defined chunks and prints offset, length and
+ * digest of each. Chunks are hashed on the spare CPUs while the boundaries
+ * are found. */
+void MDChunks(const char *min_len, const char *avg_len, const char *max_len, const char *filename)
+{
+  size_t lens[3];
+  if (!MDParseSize("minimum chunk length", min_len, 64, 0xfffffffdUL, lens[0]) ||
+      !MDParseSize("average chunk length", avg_len, 65, 0xfffffffeUL, lens[1]) ||
+      !MDParseSize("maximum chunk length", max_len, 66, 0xffffffffUL, lens[2]))
+  {
+    return;
+  }
+  if ((lens[0] >= lens[1]) || (lens[1] >= lens[2]))
+  {
+    MDPrint("Chunk sizes need 64 <= min < avg < max <= 4 GiB\n");
+    exit_status = 1;
+    return;
+  }
+  MD5Chunker chunker(lens[0], lens[1], lens[2]);
+  vector<MD5Chunker::Chunk> chunks;
+  int threads = (int) thread::hardware_concurrency() - 1;
+  if (!chunker.chunk_file(filename, chunks, threads))
+  {
+    snprintf(output, OUTPUT_LEN, "Unable to read file %s\n", filename);
+    MDPrint(output);
+    exit_status = 1;
+    return;
+  }
+  snprintf(output, OUTPUT_LEN, "MD5 chunks (%s) = %zu\n", filename, chunks.size());
+  MDPrint(output);
+  for (size_t i = 0; i < chunks.size(); i++)
+  {
+    snprintf(output, OUTPUT_LEN, "%llu %u %s\n", (unsigned long long) chunks[i].offset,
+             chunks[i].len, chunks[i].hash.c_str());
+    MDPrint(output);
+  }
+}
+
+/* Builds the merkle tree of a file, saves the sidecar and prints the root */
+void MDTree(const char *filename, const char *leaf_len)
+{
+  MD5Merkle tree;
+  size_t len = 0;
+  if (!MDParseSize("leaf length", leaf_len, 1, MD5Merkle::MAX_LEAF_LEN, len))
+  {
+    return;
+  }
+  if (!tree.build(filename, len))
+  {
+    snprintf(output, OUTPUT_LEN, "Unable to read file %s\n", filename);
+    MDPrint(output);
+    return;
+  }
+  MDTreeRoot(tree, filename);
+}
+
+/* Re-hashes the comma separated offset:len ranges of a file in its sidecar */
+void MDTreeUpdate(const char *filename, const char *ranges)
+{
+  MD5Merkle tree;
+  if (!tree.load(MD5Merkle::sidecar_path(filename).c_str()))
+  {
+    snprintf(output, OUTPUT_LEN, "Unable to load tree for %s\n", filename);
+    MDPrint(output);
+    exit_status = 1;
+    return;
+  }
+  vector<MD5Merkle::Range> dirty;
+  string list = ranges;
+  size_t start = 0;
+  while (start <= list.size())
+  {
+    size_t comma = list.find(',', start);
+    string item = list.substr(start, (comma == string::npos) ? string::npos : comma - start);
+    size_t colon = item.find(':');
+    size_t offset = 0, len = 0;
+    if (colon == string::npos)
+    {
+      snprintf(output, OUTPUT_LEN, "Invalid range %s, expected offset:len\n", item.c_str());
+      MDPrint(output);
+      exit_status = 1;
+      return;
+    }
+    if (!MDParseSize("range offset", item.substr(0, colon).c_str(), 0, SIZE_MAX, offset) ||
+        !MDParseSize("range length", item.substr(colon + 1).c_str(), 0, SIZE_MAX, len))
+    {
+      return;
+    }
+    MD5Merkle::Range range;
+    range.offset = offset;
+    range.len = len;
+    dirty.push_back(range);
+    start = (comma == string::npos) ? list.size() + 1 : comma + 1;
+  }
+  if (!tree.update(filename, dirty))
+  {
+    snprintf(output, OUTPUT_LEN, "Unable to read file %s\n", filename);
+    MDPrint(output);
+    exit_status = 1;
+    return;
+  }
+  MDTreeRoot(tree, filename);
+}
+
+/* Checks one range of a file against its sidecar */
+void MDTreeVerify(const char *filename, const char *offset, const char *len)
+{
+  MD5Merkle tree;
+  if (!tree.load(MD5Merkle::sidecar_path(filename).c_str()))
+  {
+    snprintf(output, OUTPUT_LEN, "Unable to load tree for %s\n", filename);
+    MDPrint(output);
+    exit_status = 1;
+    return;
+  }
+  size_t range_offset = 0, range_len = 0;
+  if (!MDParseSize("range offset", offset, 0, SIZE_MAX, range_offset) ||
+      !MDParseSize("range length", len, 0, SIZE_MAX, range_len))
+  {
+    return;
+  }
+  bool ok = tree.verify_range(filename, range_offset, range_len);
+  snprintf(output, OUTPUT_LEN, "MD5 tree (%s) %s+%s %s\n", filename, offset, len, ok ? "OK" : "FAILED");
+  MDPrint(output);
+  if (!ok)
+  {
+    exit_status = 1;
+  }
+}
+
+/* Saves the sidecar of a tree and prints its root */
+void MDTreeRoot(MD5Merkle &tree, const char *filename)
+{
+  unsigned char hash[MD5::HASH_LEN + 1];
+  char digest[MD5::DIGEST_LEN + 1];
+  memset(digest, '\0', sizeof(digest));
+  if (!tree.save(MD5Merkle::sidecar_path(filename).c_str()))
+  {
+    snprintf(output, OUTPUT_LEN, "Unable to save tree for %s\n", filename);
+    MDPrint(output);
+    return;
+  }
+  tree.root(hash);
+  MD5::make_digest(hash, digest);
+  snprintf(output, OUTPUT_LEN, "MD5 tree (%s) = %s\n", filename, digest);
+  MDPrint(output);
+}
+
+/* Digests a file into the --manifest instead of printing it */
+void MDManifestFile(const char *filename)
+{
+  unsigned char hash[MD5::HASH_LEN + 1];
+  struct stat st;
+  FILE *f = fopen(filename, "rb");
+  if ((f == NULL) || (fstat(fileno(f), &st) != 0))
+  {
+    snprintf(output, OUTPUT_LEN, "Unable to open file %s\n", filename);
+    MDPrint(output);
+    if (f != NULL)
+    {
+      fclose(f);
+    }
+    return;
+  }
+  bool read_ok = true;
+  if (file_flags != 0)
+  {
+    read_ok = MD5File::make_hash(fileno(f), hash, file_flags);
+  }
+  else
+  {
+    MD5::make_hash(f, hash);
+    read_ok = !ferror(f);
+  }
+  fclose(f);
+  if (!read_ok)
+  {
+    snprintf(output, OUTPUT_LEN, "Unable to read file %s\n", filename);
+    MDPrint(output);
+    exit_status = 1;
+    return;
+  }
+  if (!manifest->add(filename, hash, st.st_size, (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec))
+  {
+    snprintf(output, OUTPUT_LEN, "Unable to write manifest %s\n", manifest_path);
+    MDPrint(output);
+    exit_status = 1;
+  }
+}
+
+/* Finishes the --manifest, reporting a failed write */
+void MDManifestClose(void)
+{
+  if (!manifest->close())
+  {
+    snprintf(output, OUTPUT_LEN, "Unable to write manifest %s\n", manifest_path);
+    MDPrint(output);
+    exit_status = 1;
+  }
+}
+
+/* Prints the manifest record of one path */
+void MDManifestFind(const char *filename, const char *path)
+{
+  MD5ManifestReader reader;
+  MD5Manifest::Record record;
+  if (!reader.open(filename))
+  {
+    return;
+  }
+  if (!reader.find(path, record))
+  {
+    snprintf(output, OUTPUT_LEN, "%s not in manifest %s\n", path, filename);
+    MDPrint(output);
+    return;
+  }
+  unsigned char hash[MD5::HASH_LEN + 1];
+  char digest[MD5::DIGEST_LEN + 1];
+  memset(digest, '\0', sizeof(digest));
+  memcpy(hash, record.hash, MD5::HASH_LEN);
+  hash[MD5::HASH_LEN] = '\0';
+  MD5::make_digest(hash, digest);
+  snprintf(output, OUTPUT_LEN, "MD5 (%s) = %s size %llu mtime %lld\n", path, digest,
+           (unsigned long long) record.size, (long long) record.mtime_ns);
+  MDPrint(output);
+}
+
+/* Digests each regular file member of a tar archive, "-" reads standard input */
+void MDTar(const char *filename)
+{
+  vector<MD5TarReader::Member> members;
+  int fd = (strcmp(filename, "-") == 0) ? STDIN_FILENO : open(filename, O_RDONLY);
+  if (fd < 0)
+  {
+    snprintf(output, OUTPUT_LEN, "Unable to open file %s\n", filename);
+    MDPrint(output);
+    return;
+  }
+  bool ok = MD5Tar::hash_members(fd, members, thread::hardware_concurrency());
+  if (fd != STDIN_FILENO)
+  {
+    close(fd);
+  }
+  char digest[MD5::DIGEST_LEN + 1];
+  for (size_t i = 0; i < members.size(); i++)
+  {
+    if (members[i].type == MD5TarReader::REGULAR)
+    {
+      memset(digest, '\0', sizeof(digest));
+      MD5::make_digest(members[i].hash, digest);
+      snprintf(output, OUTPUT_LEN, "MD5 (%s:%s) = %s\n", filename, members[i].name.c_str(), digest);
+      MDPrint(output);
+    }
+    else if (members[i].type == MD5TarReader::SPARSE)
+    {
+      snprintf(output, OUTPUT_LEN, "MD5 (%s:%s) = unsupported sparse member\n", filename,
+               members[i].name.c_str());
+      MDPrint(output);
+      exit_status = 1;
+    }
+  }
+  if (!ok)
+  {
+    snprintf(output, OUTPUT_LEN, "Malformed or truncated tar archive %s\n", filename);
+    MDPrint(output);
+    exit_status = 1;
+  }
+}
+
+/* Digests every step bytes long prefix of a file, or of standard input for
+ * "-", and the whole input in one pass. step takes a K, M or G (binary)
+ * suffix. Prefixes are taken as the input arrives, so pipes work too, and
+ * each is labelled with the bytes it covers. */
+void MDPrefixes(const char *step_arg, const char *filename)
+{
+  char *suffix = NULL;
+  errno = 0;
+  unsigned long long step = strtoull(step_arg, &suffix, 10);
+  int shift = 0;
+  switch (toupper(*suffix))
+  {
+    case 'G':
+      shift += 10;
+      // fall through
+    case 'M':
+      shift += 10;
+      // fall through
+    case 'K':
+      shift += 10;
+      suffix++;
+      break;
+  }
+  if ((suffix == step_arg) || (*suffix != '\0') || (step_arg[0] == '-') || (errno != 0) ||
+      (step == 0) || (step > (SIZE_MAX >> shift)))
+  {
+    snprintf(output, OUTPUT_LEN, "Invalid prefix step %s\n", step_arg);
+    MDPrint(output);
+    exit_status = 1;
+    return;
+  }
+  step <<= shift;
+
+  FILE *f = (strcmp(filename, "-") == 0) ? stdin : fopen(filename, "rb");
+  if (f == NULL)
+  {
+    snprintf(output, OUTPUT_LEN, "Unable to open file %s\n", filename);
+    MDPrint(output);
+    exit_status = 1;
+    return;
+  }
+
+  MD5 context;
+  unsigned char hash[MD5::HASH_LEN + 1];
+  char digest[MD5::DIGEST_LEN + 1];
+  vector<char> buffer(1 << 16);
+  unsigned long long done = 0;
+  unsigned long long next = step;
+  size_t got;
+  while ((got = fread(&buffer[0], 1, buffer.size(), f)) > 0)
+  {
+    const char *p = &buffer[0];
+    while (got > 0)
+    {
+      // a boundary is only reported once input continues past it, so the
+      // whole input is not printed twice
+      if (done == next)
+      {
+        context.checkpoint(hash);
+        memset(digest, '\0', sizeof(digest));
+        MD5::make_digest(hash, digest);
+        snprintf(output, OUTPUT_LEN, "MD5 (%s:%llu) = %s\n", filename, done, digest);
+        MDPrint(output);
+        next = (next > ULLONG_MAX - step) ? ULLONG_MAX : next + step;
+      }
+      size_t n = (next - done < got) ? next - done : got;
+      context.update(p, n);
+      p += n;
+      got -= n;
+      done += n;
+    }
+  }
+  bool ok = !ferror(f);
+  if (f != stdin)
+  {
+    fclose(f);
+  }
+  if (!ok)
+  {
+    snprintf(output, OUTPUT_LEN, "Unable to read file %s\n", filename);
+    MDPrint(output);
+    exit_status = 1;
+    return;
+  }
+  context.finish(hash);
+  memset(digest, '\0', sizeof(digest));
+  MD5::make_digest(hash, digest);
+  snprintf(output, OUTPUT_LEN, "MD5 (%s:%llu) = %s\n", filename, done, digest);
+  MDPrint(output);
+}
+
+static void MDFollowSignal(int sig)
+{
+  follow_signal = sig;
+}
+
+/* Follows an append-only file, printing the digest of its current prefix at
+ * most every interval seconds when it has grown, and at once on SIGUSR1.
+ * Appended bytes are hashed as they arrive. SIGINT or SIGTERM stops following. */
+void MDFollow(const char *filename, const char *interval)
+{
+  static const int SIGNALS[] = { SIGUSR1, SIGINT, SIGTERM };
+  struct sigaction sa;
+  struct sigaction saved[3];
+  unsigned char hash[MD5::HASH_LEN + 1];
+  char digest[MD5::DIGEST_LEN + 1];
+  MD5Follow follow;
+
+  if (!follow.open(filename))
+  {
+    snprintf(output, OUTPUT_LEN, "Unable to open file %s\n", filename);
+    MDPrint(output);
+    return;
+  }
+  char *end = NULL;
+  errno = 0;
+  double seconds = strtod(interval, &end);
+  if ((end == interval) || (*end != '\0') || (errno != 0) || !isfinite(seconds) ||
+      (seconds <= 0) || (seconds > MAX_FOLLOW_INTERVAL))
+  {
+    snprintf(output, OUTPUT_LEN, "Invalid --follow interval %s, expected seconds above 0 up to %d\n",
+             interval, MAX_FOLLOW_INTERVAL);
+    MDPrint(output);
+    exit_status = 1;
+    return;
+  }
+  uint64_t period = (uint64_t) (seconds * 1e9);
+
+  // the signals stay blocked except inside the wait, which closes the gap
+  // between checking follow_signal and starting to wait
+  sigset_t blocked, waiting;
+  sigemptyset(&blocked);
+  memset(&sa, '\0', sizeof(sa));
+  sa.sa_handler = MDFollowSignal;   // without SA_RESTART so waits are interrupted
+  for (int i = 0; i < 3; i++)
+  {
+    sigaddset(&blocked, SIGNALS[i]);
+    sigaction(SIGNALS[i], &sa, &saved[i]);
+  }
+  sigprocmask(SIG_BLOCK, &blocked, &waiting);
+  sigset_t restore = waiting;
+  for (int i = 0; i < 3; i++)
+  {
+    sigdelset(&waiting, SIGNALS[i]);
+  }
+
+  follow_signal = 0;
+  uint64_t printed = (uint64_t) -1;
+  uint64_t due = MD5RunStats::now();
+  for (;;)
+  {
+    int sig = follow_signal;
+    follow_signal = 0;
+    uint64_t now = MD5RunStats::now();
+    if ((sig == SIGUSR1) || ((now >= due) && (follow.length() != printed)))
+    {
+      memset(digest, '\0', sizeof(digest));
+      follow.digest(hash);
+      MD5::make_digest(hash, digest);
+      snprintf(output, OUTPUT_LEN, "MD5 (%s) = %s length %llu\n", filename, digest,
+               (unsigned long long) follow.length());
+      MDPrint(output);
+      fflush(stdout);
+      printed = follow.length();
+    }
+    if (now >= due)
+    {
+      due = now + period;
+    }
+    if ((sig == SIGINT) || (sig == SIGTERM))
+    {
+      break;
+    }
+    uint64_t timeout_ms = (due - now) / 1000000 + 1;
+    if (!follow.wait((timeout_ms < INT_MAX) ? (int) timeout_ms : INT_MAX, &waiting))
+    {
+      snprintf(output, OUTPUT_LEN, follow.was_truncated() ? "%s was truncated, stopped following\n"
+                                                          : "Unable to read file %s\n", filename);
+      MDPrint(output);
+      break;
+    }
+  }
+
+  for (int i = 0; i < 3; i++)
+  {
+    sigaction(SIGNALS[i], &saved[i], NULL);
+  }
+  sigprocmask(SIG_SETMASK, &restore, NULL);
+}
+
+/* Digests a file with and without MD5File::HUGE_PAGES, printing the elapsed
+ * time and dTLB read misses of each pass. Misses print as n/a when perf
+ * events are not available, e.g. perf_event_paranoid or a container. */
+void MDTlbBench(const char *filename)
+{
+  static const int FLAGS[] = { 0, MD5File::HUGE_PAGES };
+  unsigned char hash[MD5::HASH_LEN + 1];
+  char digest[MD5::DIGEST_LEN + 1];
+  memset(digest, '\0', sizeof(digest));
+
+  for (int i = 0; i < 2; i++)
+  {
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+      snprintf(output, OUTPUT_LEN, "Unable to open file %s\n", filename);
+      MDPrint(output);
+      return;
+    }
+    int counter = MDTlbCounter();
+    uint64_t misses = 0;
+    uint64_t t = MD5RunStats::now();
+    if (counter >= 0)
+    {
+      ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+      ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    MD5File::make_hash(fd, hash, FLAGS[i]);
+    if (counter >= 0)
+    {
+      ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+      if (read(counter, &misses, sizeof(misses)) != sizeof(misses))
+      {
+        close(counter);
+        counter = -1;
+      }
+    }
+    t = MD5RunStats::now() - t;
+    close(fd);
+
+    MD5::make_digest(hash, digest);
+    snprintf(output, OUTPUT_LEN, "%-10s %s %10.3f ms  dTLB misses ",
+             (FLAGS[i] == 0) ? "4k pages" : "huge pages", digest, t / 1e6);
+    MDPrint(output);
+    if (counter >= 0)
+    {
+      snprintf(output, OUTPUT_LEN, "%llu\n", (unsigned long long) misses);
+      close(counter);
+    }
+    else
+    {
+      snprintf(output, OUTPUT_LEN, "n/a\n");
+    }
+    MDPrint(output);
+  }
+}
+
+/* Digests a file with the in process transform and through AF_ALG, from
+ * memory and from the file, printing the elapsed time of each pass so the
+ * faster backend can be chosen per host. AF_ALG passes print n/a when the
+ * kernel does not offer md5. */
+void MDKernelBench(const char *filename)
+{
+  static const char *NAMES[] = { "md5 memory", "af_alg send", "md5 file", "af_alg splice" };
+  unsigned char hash[MD5::HASH_LEN + 1];
+  char digest[MD5::DIGEST_LEN + 1];
+  struct stat st;
+
+  int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if ((fd < 0) || (fstat(fd, &st) != 0) || (st.st_size == 0))
+  {
+    snprintf(output, OUTPUT_LEN, "Unable to open file %s\n", filename);
+    MDPrint(output);
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+    return;
+  }
+  size_t len = st.st_size;
+  void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  if (map == MAP_FAILED)
+  {
+    perror("Failed to map file.\n");
+    close(fd);
+    return;
+  }
+
+  for (int i = 0; i < 4; i++)
+  {
+    bool ok = true;
+    lseek(fd, 0, SEEK_SET);
+    uint64_t t = MD5RunStats::now();
+    switch (i)
+    {
+      case 0:
+        MD5::make_hash((const char *) map, len, hash);
+        break;
+      case 1:
+        ok = MD5Kernel::make_hash((const char *) map, len, hash);
+        break;
+      case 2:
+        ok = MD5File::make_hash(fd, hash);
+        break;
+      default:
+        ok = MD5Kernel::make_hash(fd, hash);
+        break;
+    }
+    t = MD5RunStats::now() - t;
+    if (ok)
+    {
+      memset(digest, '\0', sizeof(digest));
+      MD5::make_digest(hash, digest);
+      snprintf(output, OUTPUT_LEN, "%-14s %s %10.3f ms %10.1f MB/s\n", NAMES[i], digest,
+               t / 1e6, (t > 0) ? len * 1e3 / t : 0.0);
+    }
+    else
+    {
+      snprintf(output, OUTPUT_LEN, "%-14s n/a\n", NAMES[i]);
+    }
+    MDPrint(output);
+  }
+  munmap(map, len);
+  close(fd);
+}
+
+/* Opens a disabled user space dTLB read miss counter for this thread, -1 if unavailable */
+int MDTlbCounter(void)
+{
+  struct perf_event_attr attr;
+  memset(&attr, '\0', sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* Digests a FILE stream charging read and transform time to --stats */
+void MDTimedHash(FILE *f, unsigned char *hash)
+{
+  MD5 context;
+  char buffer[BUFSIZ << 3];
+  size_t bytes_read = 0;
+  uint64_t t = MD5RunStats::now();
+
+  while ((bytes_read = fread(buffer, 1, sizeof(buffer), f)) > 0)
+  {
+    t = MDLap(MD5RunStats::READ, t);
+    stats->add_bytes(bytes_read);
+    context.update(buffer, bytes_read);
+    t = MDLap(MD5RunStats::TRANSFORM, t);
+  }
+  if (ferror(f))
+  {
+    perror("Failed to read from file.\n");
+    return;
+  }
+  context.finish(hash);
+  MDLap(MD5RunStats::TRANSFORM, t);
+}
+
+/* Charges the bytes of f to --stats when it was hashed without MDTimedHash:
+ * the size of a regular file, otherwise how far the descriptor was read */
+void MDChargeBytes(FILE *f)
+{
+  struct stat st;
+  if (stats == NULL)
+  {
+    return;
+  }
+  if ((fstat(fileno(f), &st) == 0) && S_ISREG(st.st_mode))
+  {
+    stats->add_bytes(st.st_size);
+  }
+  else
+  {
+    off_t pos = lseek(fileno(f), 0, SEEK_CUR);
+    stats->add_bytes((pos > 0) ? pos : 0);
+  }
+}
+
+/* Charges the time since 'since' to a --stats phase and returns the current time */
+uint64_t MDLap(MD5RunStats::Phase phase, uint64_t since)
+{
+  if (stats == NULL)
+  {
+    return 0;
+  }
+  uint64_t t = MD5RunStats::now();
+  stats->add(phase, t - since);
+  return t;
 }
 
 /* Prints to standard output */
 void MDPrint(const char *c_string)
 {
-  printf(c_string);
+  fputs(c_string, stdout);
 }
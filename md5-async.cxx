@@ -0,0 +1,140 @@
+/*
+ * md5-async.cxx
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+/* Usage example for MD5Async. Every file named on the command line is hashed
+ * by its own coroutine and all of them are interleaved on one MD5Executor.
+ * "-" hashes standard input as a stream, -x runs the executor self test. */
+
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "MD5Async.h"
+
+/* Awaits a hash task and prints the result */
+static MD5Task MDPrintTask(MD5Task task, const char *name)
+{
+  MD5Hash hash = co_await task;
+  printf("MD5 (%s) = %s\n", name, hash.to_string().c_str());
+  co_return hash;
+}
+
+/* Parks until fd is readable and counts the wake up */
+static MD5Task MDWaitTask(MD5Executor &ex, int fd, int *woken)
+{
+  co_await ex.readable(fd);
+  (*woken)++;
+  co_return MD5Hash();
+}
+
+/* Writes to fd once the coroutines posted before it have parked */
+static MD5Task MDWriteTask(MD5Executor &ex, int fd, const char *data)
+{
+  co_await ex.yield();
+  if (write(fd, data, strlen(data)) < 0)
+  {
+    perror("Failed to write to pipe.\n");
+  }
+  co_return MD5Hash();
+}
+
+static bool MDCheck(const char *name, bool ok)
+{
+  printf("%s = %s\n", name, ok ? "ok" : "FAILED");
+  return ok;
+}
+
+/* Two coroutines parked on one descriptor must both resume, and a hashed
+ * stream must get its blocking mode back */
+static int MDTestSuite(void)
+{
+  int fds[2];
+  bool ok = true;
+  alarm(10);   // a lost waiter would leave run() blocked in epoll
+
+  if (pipe(fds) != 0)
+  {
+    perror("Failed to create pipe.\n");
+    return 1;
+  }
+  int woken = 0;
+  {
+    MD5Executor ex;
+    vector<MD5Task> tasks;
+    tasks.push_back(MDWaitTask(ex, fds[0], &woken));
+    tasks.push_back(MDWaitTask(ex, fds[0], &woken));
+    tasks.push_back(MDWriteTask(ex, fds[1], "message digest"));
+    for (size_t i = 0; i < tasks.size(); i++)
+    {
+      tasks[i].start(ex);
+    }
+    ex.run();
+  }
+  ok = MDCheck("two waiters on one fd", woken == 2) && ok;
+
+  // the stream is what the writer left in the pipe
+  int before = fcntl(fds[0], F_GETFL);
+  close(fds[1]);
+  MD5Executor ex;
+  MD5Task task = MD5Async::hash_stream_async(ex, fds[0]);
+  task.start(ex);
+  ex.run();
+  ok = MDCheck("hash_stream_async", task.done() &&
+               (task.result().to_string() == "f96b697d7cb7938d525a2f31aaf161d0")) && ok;
+  ok = MDCheck("hash_stream_async restores flags", fcntl(fds[0], F_GETFL) == before) && ok;
+  close(fds[0]);
+  return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+  MD5Executor ex;
+  vector<MD5Task> tasks;
+
+  if ((argc == 2) && (strcmp(argv[1], "-x") == 0))
+  {
+    return MDTestSuite();
+  }
+
+  if (argc < 2)
+  {
+    tasks.push_back(MDPrintTask(MD5Async::hash_stream_async(ex, STDIN_FILENO), "-"));
+  }
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-") == 0)
+    {
+      tasks.push_back(MDPrintTask(MD5Async::hash_stream_async(ex, STDIN_FILENO), "-"));
+    }
+    else
+    {
+      tasks.push_back(MDPrintTask(MD5Async::hash_file_async(ex, argv[i]), argv[i]));
+    }
+  }
+
+  for (size_t i = 0; i < tasks.size(); i++)
+  {
+    tasks[i].start(ex);
+  }
+  ex.run();
+  return 0;
+}
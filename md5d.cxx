@@ -0,0 +1,181 @@
+/*
+ * md5d.cxx
+ *
+ * Copyright 2020 Rickie Kerndt <kerndtr@kerndt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ *
+ */
+
+/* md5d hashing daemon, see MD5Daemon.
+ *   md5d [-t threads] socket     - serves requests on socket until SIGINT or SIGTERM
+ *   md5d -c socket file ...      - hashes files through a running md5d, doubling
+ *                                  as a usage example of MD5Client */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "MD5Daemon.h"
+
+static MD5Daemon *daemon_instance = NULL;
+
+static void MDStop(int)
+{
+  if (daemon_instance != NULL)
+  {
+    daemon_instance->stop();
+  }
+}
+
+/* Reads a file into a new client buffer, returns its descriptor or -1 */
+static int MDLoad(const char *path, uint64_t &len)
+{
+  struct stat st;
+  char *data = NULL;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if ((fd < 0) || (fstat(fd, &st) != 0))
+  {
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+    return -1;
+  }
+  len = st.st_size;
+  int buffer = MD5Client::create_buffer(len, &data);
+  size_t done = 0;
+  while ((buffer >= 0) && (done < len))
+  {
+    ssize_t n = read(fd, data + done, len - done);
+    if ((n < 0) && (errno == EINTR))
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      close(buffer);
+      buffer = -1;
+      break;
+    }
+    done += n;
+  }
+  if (data != NULL)
+  {
+    munmap(data, len);
+  }
+  close(fd);
+  return buffer;
+}
+
+/* Hashes the named files, MD5Daemon::MAX_FDS per request */
+static int MDClient(const char *socket_path, char **paths, int n)
+{
+  MD5Client client;
+  if (!client.connect(socket_path))
+  {
+    return 1;
+  }
+  int status = 0;
+  for (int first = 0; first < n; first += MD5Daemon::MAX_FDS)
+  {
+    int fds[MD5Daemon::MAX_FDS];
+    uint64_t lens[MD5Daemon::MAX_FDS];
+    const char *names[MD5Daemon::MAX_FDS];
+    unsigned char hashes[MD5Daemon::MAX_FDS * (MD5::HASH_LEN + 1)];
+    bool ok[MD5Daemon::MAX_FDS];
+    int count = 0;
+    for (int i = first; (i < n) && (i < first + MD5Daemon::MAX_FDS); i++)
+    {
+      fds[count] = MDLoad(paths[i], lens[count]);
+      if (fds[count] < 0)
+      {
+        fprintf(stderr, "Unable to read file %s\n", paths[i]);
+        status = 1;
+        continue;
+      }
+      names[count++] = paths[i];
+    }
+    bool sent = client.make_hashes(fds, lens, count, hashes, ok);
+    for (int i = 0; i < count; i++)
+    {
+      char digest[MD5::DIGEST_LEN + 1];
+      memset(digest, '\0', sizeof(digest));
+      close(fds[i]);
+      if (!sent || !ok[i])
+      {
+        fprintf(stderr, "md5d could not hash %s\n", names[i]);
+        status = 1;
+        continue;
+      }
+      MD5::make_digest(hashes + i * (MD5::HASH_LEN + 1), digest);
+      printf("MD5 (%s) = %s\n", names[i], digest);
+    }
+    if (!sent)
+    {
+      return 1;
+    }
+  }
+  return status;
+}
+
+int main(int argc, char **argv)
+{
+  int threads = 0;
+  int i = 1;
+  if ((argc > 2) && (strcmp(argv[1], "-c") == 0))
+  {
+    return MDClient(argv[2], argv + 3, argc - 3);
+  }
+  if ((argc > 3) && (strcmp(argv[1], "-t") == 0))
+  {
+    char *end = NULL;
+    errno = 0;
+    long n = strtol(argv[2], &end, 10);
+    if ((end == argv[2]) || (*end != '\0') || (errno != 0) || (n < 0) || (n > MD5Daemon::MAX_THREADS))
+    {
+      fprintf(stderr, "Invalid thread count %s, expected 0 to %d\n", argv[2], MD5Daemon::MAX_THREADS);
+      return 2;
+    }
+    threads = (int) n;
+    i = 3;
+  }
+  if (i + 1 != argc)
+  {
+    fprintf(stderr, "usage: md5d [-t threads] socket\n       md5d -c socket file ...\n");
+    return 2;
+  }
+
+  MD5Daemon daemon(threads);
+  if (!daemon.listen(argv[i]))
+  {
+    return 1;
+  }
+  daemon_instance = &daemon;
+  struct sigaction sa;
+  memset(&sa, '\0', sizeof(sa));
+  sa.sa_handler = MDStop;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  daemon.run();
+  daemon_instance = NULL;
+  unlink(argv[i]);
+  return 0;
+}